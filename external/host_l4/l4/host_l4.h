@@ -0,0 +1,92 @@
+#pragma once
+// just enough of the L4Re / Fiasco API to build the server's export path on a linux host,
+// see src/simulate_export.cpp. all the l4/... headers of this directory only include this one.
+// the debugger invocation is forwarded to host_invoke_debugger, which plays the kernel.
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef unsigned long long l4_uint64_t;
+typedef unsigned long      l4_umword_t;
+typedef unsigned long      l4_addr_t;
+typedef unsigned long      l4_cap_idx_t;
+typedef unsigned long long l4_cpu_time_t;
+
+#define L4_NOTHROW
+#define L4_BASE_DEBUGGER_CAP 0x5UL
+#define L4_BASE_TASK_CAP 0x1UL
+// only compared against each other, the values don't have to match the kernel's
+#define L4_DEBUGGER_GET_BTB_SECTION 0x60
+#define L4_DEBUGGER_BTB_CONTROL 0x61
+
+typedef struct l4_msgtag_s {
+	l4_umword_t raw;
+} l4_msgtag_t;
+
+typedef struct l4_msg_regs_s {
+	l4_umword_t mr[64];
+} l4_msg_regs_t;
+typedef l4_msg_regs_t l4_utcb_t;
+
+static inline l4_utcb_t * l4_utcb (void) {
+	// the pipeline's fetch thread and the main thread don't invoke at the same time
+	static l4_utcb_t utcb;
+	return &utcb;
+}
+static inline l4_msg_regs_t * l4_utcb_mr_u (l4_utcb_t * utcb) { return utcb; }
+static inline l4_msg_regs_t * l4_utcb_mr (void) { return l4_utcb(); }
+
+static inline l4_msgtag_t l4_msgtag (long label, unsigned words, unsigned items, unsigned flags) {
+	(void) items;
+	(void) flags;
+	l4_msgtag_t tag = { (l4_umword_t) ((label << 16) | words) };
+	return tag;
+}
+static inline long l4_msgtag_label (l4_msgtag_t tag) { return tag.raw >> 16; }
+static inline int l4_msgtag_words (l4_msgtag_t tag) { return tag.raw & 0x3f; }
+static inline int l4_msgtag_items (l4_msgtag_t tag) { (void) tag; return 0; }
+static inline int l4_msgtag_flags (l4_msgtag_t tag) { (void) tag; return 0; }
+static inline int l4_msgtag_has_error (l4_msgtag_t tag) { (void) tag; return 0; }
+
+// implemented by the host program, reads and writes the message registers like the kernel
+l4_msgtag_t host_invoke_debugger (l4_cap_idx_t cap, l4_msgtag_t tag, l4_utcb_t * utcb);
+static inline l4_msgtag_t l4_invoke_debugger (l4_cap_idx_t cap, l4_msgtag_t tag, l4_utcb_t * utcb) {
+	return host_invoke_debugger(cap, tag, utcb);
+}
+
+typedef struct l4re_env_s {
+	l4_cap_idx_t rm;
+} l4re_env_t;
+static inline l4re_env_t * l4re_env (void) {
+	static l4re_env_t env;
+	return &env;
+}
+static inline void * l4re_kip (void) { return NULL; }
+static inline l4_cap_idx_t l4re_env_get_cap (const char * name) { (void) name; return 0; }
+static inline int l4_is_valid_cap (l4_cap_idx_t cap) { return cap != 0; }
+
+static inline int l4re_util_kumem_alloc (l4_addr_t * mem, unsigned pages_order, l4_cap_idx_t task, l4_cap_idx_t rm) {
+	(void) task;
+	(void) rm;
+	*mem = (l4_addr_t) aligned_alloc(4096, 4096UL << pages_order);
+	return *mem ? 0 : -1;
+}
+
+// the "tsc" counts nanoseconds
+static inline l4_cpu_time_t l4_rdtsc (void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+static inline void l4_calibrate_tsc (void * kip) { (void) kip; }
+static inline l4_uint64_t l4_tsc_to_us (l4_cpu_time_t tsc) { return tsc / 1000; }
+static inline void l4_usleep (l4_uint64_t us) { usleep(us); }
+
+static inline int l4_platform_ctl_system_shutdown (l4_cap_idx_t cap, int reboot) {
+	(void) cap;
+	(void) reboot;
+	return 0;
+}
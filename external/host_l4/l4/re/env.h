@@ -0,0 +1,2 @@
+#pragma once
+#include <l4/host_l4.h>
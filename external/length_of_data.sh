@@ -12,7 +12,7 @@ while True:
 		line = input()
 	except EOFError:
 		break
-	_, marker, offsets, block_id, length, flags, reserved, _ = line.split(" ")
+	_, marker, offsets, block_id, length, flags, encoding, _ = line.split(" ")
 	block_id = int(block_id, 16)
 	length = int(length, 16)
 	if flags == "0000000000000001":
@@ -37,6 +37,27 @@ argparser.add_argument(
     default = 10,
     help = "how many round of measurements to do",
 )
+argparser.add_argument(
+    "--statistics",
+    action = "store_const",
+    const = True,
+    default = False,
+    help = "let measure_loop print statistics per trace interval instead of every round. "
+        "--measure-rounds is then the upper limit of rounds.",
+)
+argparser.add_argument(
+    "--min-rounds",
+    type = int,
+    default = 5,
+    help = "with --statistics: rounds per trace interval before stopping early",
+)
+argparser.add_argument(
+    "--relative-confidence",
+    type = float,
+    default = .01,
+    help = "with --statistics: stop when the 95%% confidence interval of the mean "
+        "is within this fraction of the mean",
+)
 argparser.add_argument(
     "--sleep-before-tracing",
     type = float,
@@ -94,6 +115,55 @@ argparser.add_argument(
     default = False,
     help = "don't just measure overhead, also export data and plot",
 )
+argparser.add_argument(
+    "--no-pipelined",
+    action = "store_const",
+    const = False,
+    default = True,
+    dest = "export_pipelined",
+    help = "with --export: print each section before fetching and compressing the next one, "
+        "instead of in a second thread",
+)
+argparser.add_argument(
+    "--block-encoding",
+    choices = ["hex", "base64"],
+    default = "base64",
+    help = "with --export: how the block lines are printed",
+)
+argparser.add_argument(
+    "--intern-stacks",
+    action = "store_const",
+    const = True,
+    default = False,
+    help = "with --export: export each distinct stack of a section once, with its number of samples",
+)
+argparser.add_argument(
+    "--export-continuously",
+    action = "store_const",
+    const = True,
+    default = False,
+    help = "with --export: drain full sections while tracing is still running",
+)
+argparser.add_argument(
+    "--drain-interval",
+    type = float,
+    default = 1,
+    help = "with --export-continuously: drain at least this often, in seconds",
+)
+argparser.add_argument(
+    "--drain-poll",
+    type = float,
+    default = .010,
+    help = "with --export-continuously: how often to check the kernel buffer against "
+        "--drain-high-watermark, in seconds",
+)
+argparser.add_argument(
+    "--drain-high-watermark",
+    type = int,
+    default = 1 << 20,
+    help = "with --export-continuously: drain sooner when about this many words "
+        "are waiting in the kernel buffer",
+)
 argparser.add_argument(
     "--app-prints-steps",
     action = "store_const",
@@ -214,7 +284,14 @@ def write_measure_defaults(args):
 
     # we don't necessarily have stdbool, so use 0 and 1
     c_do_overhead      = 1 if args.overhead         else 0;
+    c_statistics       = 1 if args.statistics       else 0;
     c_do_export        = 1 if args.export           else 0;
+    c_export_pipelined = 1 if args.export_pipelined else 0;
+    c_block_encoding   = 1 if args.block_encoding == "base64" else 0;
+    c_continuously     = 1 if args.export_continuously else 0;
+    c_intern_stacks    = 1 if args.intern_stacks    else 0;
+    us_drain_interval  = int(1000_000 * args.drain_interval)
+    us_drain_poll      = int(1000_000 * args.drain_poll)
     c_app_prints_steps = 1 if args.app_prints_steps else 0;
     c_ubt_debug        = 1 if args.ubt_debug        else 0;
 
@@ -225,8 +302,18 @@ static const l4_uint64_t trace_interval_count = {trace_interval_count};
 static const l4_uint64_t us_trace_intervals [] = {us_trace_intervals};
 static const l4_uint64_t measure_rounds = {args.measure_rounds};
 static const int do_overhead = {c_do_overhead};
+static const int measure_statistics = {c_statistics};
+static const l4_uint64_t measure_min_rounds = {args.min_rounds};
+static const double measure_relative_confidence = {args.relative_confidence};
 // for backtracer/main.cc
 static const int do_export = {c_do_export};
+static const int export_pipelined = {c_export_pipelined};
+static const int export_block_encoding = {c_block_encoding};
+static const int export_continuously = {c_continuously};
+static const int export_intern_stacks = {c_intern_stacks};
+static const l4_uint64_t us_drain_interval = {us_drain_interval};
+static const l4_uint64_t us_drain_poll = {us_drain_poll};
+static const l4_uint64_t drain_high_watermark_in_words = {args.drain_high_watermark};
 static const int app_controls_tracing = 1;
 static const int app_prints_steps = {c_app_prints_steps};
 // syscall debugging infos, backtracer debugging infos
@@ -261,10 +348,16 @@ def measure_overhead(app, args):
             f"data/{label}/{app}.cleaned",
         )
 
-    csv_filename = f"data/{label}/{app}.csv"
+    if args.statistics:
+        csv_filename = f"data/{label}/{app}.statistics.csv"
+        line_regex = measure_statistics_regex
+    else:
+        csv_filename = f"data/{label}/{app}.csv"
+        line_regex = measure_line_regex
     write_measurement_csv(
         f"data/{label}/{app}.cleaned",
         csv_filename,
+        line_regex,
     )
 
     return csv_filename
@@ -280,13 +373,17 @@ export_regex = re.compile(
 measure_line_regex = re.compile(
     r".*=\.=\.= +\[(.+)\] +s"
 )
-def write_measurement_csv(input_filename, output_filename):
+# with --statistics, one line per trace interval (and statistics_header) instead
+measure_statistics_regex = re.compile(
+    r".*=#=#= +\[(.+)\] +us"
+)
+def write_measurement_csv(input_filename, output_filename, line_regex = measure_line_regex):
     result = {}
 
     with open(output_filename, "w") as output_file:
         with open(input_filename, "r") as input_file:
             for line in input_file:
-                m = measure_line_regex.match(line)
+                m = line_regex.match(line)
                 if m:
                     print(f"matched line {line!r}")
 
@@ -385,6 +482,9 @@ def measure_and_write(args, kconfig = None):
         pd.read_csv(app_csv_filename := measure_overhead(app, args))
         for app in args.apps
     )
+    if args.statistics:
+        # µs in the statistics lines, s like the per-round lines for the trace interval selections
+        measurements["trace_interval"] = measurements["trace_interval"] / 1e6
     measurements["kconfig"] = pd.Series([kconfig.filename for _ in range(len(measurements.index))])
 
     csv_filename = f"data/{args.label}/measurements.csv"
@@ -415,7 +515,8 @@ def main():
             kconfig_measurements,
         ])
 
-    if args.plot:
+    # the plots are made from the single rounds, which --statistics does not print
+    if args.plot and not args.statistics:
         plot_app_durations(measurements, args)
         plot_btb_words(measurements, args)
 
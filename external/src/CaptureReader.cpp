@@ -0,0 +1,138 @@
+#include <cstdlib>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+
+#include "CaptureReader.hpp"
+
+CaptureReader::CaptureReader (const std::string & filename)
+  : filename(filename),
+	clean(!filename.ends_with(".cleaned"))
+{
+	if (filename == "-") {
+		file = stdin;
+	} else {
+		file = fopen(filename.c_str(), "r");
+		if (!file) {
+			perror(filename.c_str());
+			throw std::runtime_error("could not open capture '" + filename + "'!");
+		}
+	}
+
+	// the pages are only backed once they are written to
+	void * reserved = mmap(
+		0, words_capacity * sizeof(uint64_t),
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+	);
+	if (reserved == MAP_FAILED) {
+		perror("mmap");
+		throw std::runtime_error("could not reserve memory for the trace of capture '" + filename + "'!");
+	}
+	words = reinterpret_cast<uint64_t *>(reserved);
+
+	unpacker = new unpacker_t;
+	unpacker_init(unpacker);
+}
+
+CaptureReader::~CaptureReader () {
+	unpacker_free(unpacker);
+	delete unpacker;
+	munmap(words, words_capacity * sizeof(uint64_t));
+	free(line);
+	if (file != stdin)
+		fclose(file);
+}
+
+bool CaptureReader::is_capture (const std::string & filename) {
+	return filename == "-" || filename.ends_with(".traced") || filename.ends_with(".cleaned");
+}
+
+void CaptureReader::write_section_words (void * context, const unsigned long * words, unsigned long count) {
+	CaptureReader * self = reinterpret_cast<CaptureReader *>(context);
+	self->section_words.insert(self->section_words.end(), words, words + count);
+}
+
+void CaptureReader::append (const std::span<const uint64_t> more) {
+	if (words_filled + more.size() > words_capacity) {
+		throw std::runtime_error(std::format(
+			"the trace of capture '{}' is larger than the {} words reserved for it.",
+			filename, words_capacity
+		));
+	}
+	std::copy(more.begin(), more.end(), words + words_filled);
+	words_filled += more.size();
+}
+
+bool CaptureReader::read_line () {
+	const ssize_t filled = getline(&line, &line_capacity, file);
+	if (filled <= 0)
+		return false;
+	line_number ++;
+
+	// as unpack reads the .cleaned line: with its '\n' replaced by '\0', or its last character without one
+	const bool has_newline = line[filled - 1] == '\n';
+	const size_t length = filled - has_newline;
+	size_t cleaned_length;
+	if (clean) {
+		cleaned.resize(4 * length + 1);
+		cleaned_length = clean_line(cleaned.data(), line, length);
+	} else {
+		cleaned.assign(line, line + length + 1);
+		cleaned_length = length;
+	}
+	if (cleaned_length == 0)
+		return true;
+	const unsigned long line_filled = cleaned_length + has_newline;
+	cleaned[line_filled - 1] = '\0';
+
+	const char * marker = find_block_marker(cleaned.data(), line_filled, block_marker_default);
+	if (!marker)
+		return true;
+	unpacker_add_line(
+		unpacker, marker, line_filled - (marker - cleaned.data()), line_number,
+		&write_section_words, this
+	);
+
+	if (!section_words.empty()) {
+		section_decoder.add(section_words, decoded);
+		append(decoded);
+		section_words.clear();
+		decoded.clear();
+	}
+	return true;
+}
+
+bool CaptureReader::read_more (std::span<uint64_t> & buffer) {
+	const size_t filled_before = words_filled;
+	while (!at_end && words_filled == filled_before) {
+		if (!read_line()) {
+			at_end = true;
+			section_decoder.finish();
+			std::cout << std::format(
+				"capture '{}': {} lines, {} sections, {} words of trace.",
+				filename, line_number, section_decoder.sections(), words_filled
+			) << std::endl;
+		}
+	}
+	buffer = this->buffer();
+	return words_filled != filled_before;
+}
+
+void CaptureReader::release (const uint64_t * const needed) {
+	const size_t until = (needed - words) / release_words * release_words;
+	if (until <= words_released)
+		return;
+	if (madvise(words + words_released, (until - words_released) * sizeof(uint64_t), MADV_DONTNEED) != 0) {
+		perror("madvise");
+		return;
+	}
+	words_released = until;
+}
+
+void CaptureReader::read_all () {
+	std::span<uint64_t> buffer;
+	while (read_more(buffer))
+		;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "SectionDecoder.hpp"
+#include "unpack.h"
+
+// reads the serial output of the backtracer (a .traced or .cleaned file, or - for stdin)
+// and makes the words of the .btb from it while it arrives. that is what the Makefile does with
+// cat -v | sed (.cleaned), unpack (.compressed) and decompress (.btb), without the files in between.
+class CaptureReader {
+	std::string filename;
+	FILE * file;
+	// .cleaned files were cleaned already
+	bool clean;
+
+	char * line = nullptr;
+	size_t line_capacity = 0;
+	std::vector<char> cleaned;
+	unsigned long line_number = 0;
+	bool at_end = false;
+
+	unpacker_t * unpacker;
+	SectionDecoder section_decoder;
+	// the data of the sections unpack completed with the last line, and what decompress makes of it
+	std::vector<uint64_t> section_words;
+	std::vector<uint64_t> decoded;
+
+	// the .btb, in address space reserved up front, so it stays where it is while it grows.
+	// the words before words_released were given back to the system
+	uint64_t * words;
+	size_t words_filled = 0;
+	size_t words_released = 0;
+	static constexpr size_t words_capacity = (1ul << 40) / sizeof(uint64_t);
+	// released in steps of this many words (a multiple of the page size), not for every entry
+	static constexpr size_t release_words = (1ul << 21) / sizeof(uint64_t);
+
+	static void write_section_words (void * context, const unsigned long * words, unsigned long count);
+	void append (const std::span<const uint64_t> more);
+	// reads one line into unpack, false at the end of the capture
+	bool read_line ();
+
+public:
+	CaptureReader (const std::string & filename);
+	~CaptureReader ();
+	CaptureReader (const CaptureReader &) = delete;
+	CaptureReader & operator = (const CaptureReader &) = delete;
+
+	// whether interpret should read the file as a capture instead of a .btb
+	static bool is_capture (const std::string & filename);
+
+	std::span<uint64_t> buffer () const {
+		return { words, words_filled };
+	}
+
+	// reads until there are more words of the .btb and widens buffer to them. false at the end of the capture
+	bool read_more (std::span<uint64_t> & buffer);
+	void read_all ();
+	// gives the memory of the words before needed back, they must not be read again.
+	// buffer keeps its start, so the offsets of entries stay the same
+	void release (const uint64_t * needed);
+};
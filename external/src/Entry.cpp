@@ -15,43 +15,62 @@ Entry::Entry (
 		throw std::runtime_error("cannot read an entry from an entry buffer with less than 4 words!");
 	if (entry_buffer + length_in_words > complete_buffer.data() + complete_buffer.size())
 		throw std::runtime_error("cannot read an entry from outside the complete buffer!");
+	if (entry_buffer[1] != length_in_words)
+		throw std::runtime_error(std::format(
+			"entry_length {} does not match the {} words the entry was read with!",
+			entry_buffer[1], length_in_words
+		));
 
 	entry_types entry_type = static_cast<entry_types>(*entry_buffer);
 
-	if (!entry_descriptor_map.contains(entry_type)) {
+	descriptor = entry_descriptor_map.find(entry_type);
+	if (!descriptor) {
 		throw std::runtime_error(std::format(
 			"entry_type {:2x} has no attribute descriptors yet!",
 			static_cast<unsigned long>(entry_type)
 		));
 	}
-
-	const EntryDescriptor & entry_descriptor = entry_descriptor_map.at(entry_type);
-
-	self()["entry_type"] = entry_type;
-	size_t offset = 1;
-	for (; offset < entry_descriptor.size(); offset++) {
-		std::string entry_name = entry_descriptor[offset];
-		self()[entry_name] = entry_descriptor.read_in(offset, entry_buffer, length_in_words);
-	}
-	size_t payload_offset = offset;
-	size_t payload_length = length_in_words - entry_descriptor.size();
-	payload.resize(payload_length);
-	for (; offset < length_in_words; offset++) {
-		size_t index = offset - payload_offset;
-		// newer versions can use the payload as a ring buffer with a start_index
-		if (entry_type == BTE_STACK && has_attribute("start_index"))
-			index = (index + attribute("start_index")) % payload_length;
-
-		payload[offset - payload_offset] = entry_buffer[payload_offset + index];
+	if (descriptor->size() > length_in_words) {
+		throw std::runtime_error(
+			"reading an entry of length " + std::to_string(length_in_words)
+			+ " with an EntryDescriptor for " + std::to_string(descriptor->size())
+			+ " words."
+		);
 	}
+	if (entry_type == BTE_STACK && has_attribute(BTA_START_INDEX) && get_payload().empty())
+		throw std::runtime_error("stack with a start_index but without payload!");
+
 	if (entry_type == BTE_MAPPING) {
 		add_mapping();
 	}
 }
 
+uint64_t Entry::missing_attribute (const std::string & attribute_key) const {
+	// catch these separately, because the rest of the code uses them
+	if (attribute_key == "entry_type" || attribute_key == "tsc_time")
+		throw std::out_of_range(std::format(
+			"access to field '{}' is invalid.",
+			attribute_key
+		));
+
+	// because of the special status of BTE_INFO, cpu_id could not easily be added to it.
+	// but we can just assume it's cpu 0, shouldn't really matter
+	if (type() == BTE_INFO && attribute_key == "cpu_id")
+		return 0;
+
+	throw std::out_of_range(std::format(
+		"access to field '{}' in entry of type '{}' ({}) with timestamp '{}' is invalid.",
+		attribute_key,
+		entry_type_name(type()),
+		static_cast<uint64_t>(type()),
+		attribute(BTA_TSC_TIME)
+	));
+}
+
 std::string Entry::to_string () const {
 	std::string result;
-	for (const auto & [name, value] : self()) {
+	for (const auto & [name, offset] : descriptor->attribute_offsets) {
+		const uint64_t value = entry_buffer[offset];
 		if (name == "task_id") {
 			result += std::format("  {:16}: {:16x} {}\n", name, value, task_binaries(value));
 		} else if (name == "tsc_time") {
@@ -65,18 +84,20 @@ std::string Entry::to_string () const {
 				result += std::format("  {:16}: {:16x} {}\n", name, value, value);
 		}
 	}
+	const std::span<const uint64_t> payload = get_payload();
 	for (size_t i = 0; i < payload.size(); i++) {
-		if (attribute("entry_type") == BTE_STACK) {
-			std::string symbol_name = get_symbol_name(payload[i], attribute("tsc_time"));
-			result += std::format("  {:15} : {:16x} {}\n", i, payload[i], symbol_name);
-		} else if (attribute("entry_type") == BTE_MAPPING) {
+		const uint64_t word = payload_word(i);
+		if (type() == BTE_STACK) {
+			std::string_view symbol_name = get_symbol_name(word, attribute(BTA_TSC_TIME));
+			result += std::format("  {:15} : {:16x} {}\n", i, word, symbol_name);
+		} else if (type() == BTE_MAPPING) {
 			const char * name = reinterpret_cast<const char *>(&payload[i]);
-			result += std::format("  {:15} : {:16x} {:.8}\n", i, payload[i], name);
-		} else if (attribute("entry_type") == BTE_INFO && i >= attribute("type_count")) {
+			result += std::format("  {:15} : {:16x} {:.8}\n", i, word, name);
+		} else if (type() == BTE_INFO && i >= attribute(BTA_TYPE_COUNT)) {
 			const char * name = reinterpret_cast<const char *>(&payload[i]);
-			result += std::format("  {:15} : {:16x} {:.8}\n", i, payload[i], name);
+			result += std::format("  {:15} : {:16x} {:.8}\n", i, word, name);
 		} else {
-			result += std::format("  {:15} : {:16x}\n", i, payload[i]);
+			result += std::format("  {:15} : {:16x}\n", i, word);
 		}
 	}
 	return result;
@@ -84,7 +105,7 @@ std::string Entry::to_string () const {
 
 std::string Entry::to_hex_string () const {
 	std::string result;
-	for (size_t i = 0; i < attribute("entry_length"); i++) {
+	for (size_t i = 0; i < attribute(BTA_ENTRY_LENGTH); i++) {
 		result += std::format(" {:016x}", entry_buffer[i]);
 	}
 	return result;
@@ -95,31 +116,61 @@ std::string Entry::folded (
 	bool with_cpu_id,
 	bool weight_from_time
 ) const {
-	if (attribute("entry_type") != BTE_STACK) {
+	if (type() != BTE_STACK) {
 		throw std::runtime_error("folded can only be called on BTE_STACK entries!");
 	}
 
 	std::string result;
 	if (with_cpu_id)
-		result += "cpu_" + std::to_string(attribute("cpu_id")) + ";";
-	for (ssize_t i = payload.size() - 1; i >= 0; i--) {
-		std::string symbol_name = get_symbol_name(payload[i], attribute("tsc_time"));
+		result += "cpu_" + std::to_string(attribute(BTA_CPU_ID)) + ";";
+	for (ssize_t i = get_payload().size() - 1; i >= 0; i--) {
+		std::string_view symbol_name = get_symbol_name(payload_word(i), attribute(BTA_TSC_TIME));
 		result += symbol_name;
 		if (i > 0)
 			result += ";";
 	}
 	result += " ";
-	uint64_t weight = 1;
-	if (weight_from_time) {
-		if (previous_entry)
-			weight = self().start_time_ns() - previous_entry->end_time_ns();
-		else
-			weight = 1;
+	result += std::to_string(folded_weight(previous_entry, weight_from_time));
+	return result;
+}
+
+folded_stack_t Entry::folded_stack (
+	const Entry * previous_entry,
+	bool with_cpu_id,
+	bool weight_from_time
+) const {
+	if (type() != BTE_STACK) {
+		throw std::runtime_error("folded_stack can only be called on BTE_STACK entries!");
 	}
-	result += std::to_string(weight);
+
+	const size_t depth = get_payload().size();
+	folded_stack_t result;
+	result.frames.reserve(depth + with_cpu_id);
+	if (with_cpu_id)
+		result.frames.push_back(frame_names.intern("cpu_" + std::to_string(attribute(BTA_CPU_ID))));
+	const unsigned long task_id = attribute(BTA_TASK_ID);
+	const unsigned long time = attribute(BTA_TSC_TIME);
+	for (ssize_t i = depth - 1; i >= 0; i--)
+		result.frames.push_back(mappings.lookup_frame(task_id, payload_word(i), time));
+	result.weight = folded_weight(previous_entry, weight_from_time);
 	return result;
 }
 
+uint64_t Entry::folded_weight (
+	const Entry * previous_entry,
+	bool weight_from_time
+) const {
+	if (!weight_from_time)
+		return 1;
+	// samples expanded from a BTE_STACK_REF only have estimated times, they may overlap
+	if (previous_entry && previous_entry->end_time_ns() < start_time_ns())
+		return start_time_ns() - previous_entry->end_time_ns();
+	else if (previous_entry)
+		return 0;
+	else
+		return 1;
+}
+
 std::string Entry::task_binaries (unsigned long task_id) const {
 	return mappings.task_binaries(task_id);
 }
@@ -128,10 +179,10 @@ void Entry::add_mapping () const {
 	mappings.append(*this);
 }
 
-std::string Entry::get_symbol_name (
+std::string_view Entry::get_symbol_name (
 	unsigned long virtual_address,
 	unsigned long time_in_ns
 ) const {
-	unsigned long task_id = attribute("task_id");
+	unsigned long task_id = attribute(BTA_TASK_ID);
 	return mappings.lookup_symbol(task_id, virtual_address, time_in_ns);
 }
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <vector>
 #include <map>
+#include <span>
 #include <fstream>
 #include <memory>
 #include <format>
@@ -12,18 +13,15 @@
 #include <fcntl.h>
 
 #include "EntryDescriptor.hpp"
+#include "FoldedStacks.hpp"
 
-class Entry : public std::map<std::string, uint64_t> {
-	using Self = Entry;
-	using Super = std::map<std::string, uint64_t>;
+// a view of one entry in the raw buffer: attributes are read where they are,
+// at the offsets that the EntryDescriptor of the entry type knows.
+class Entry {
+	const EntryDescriptor * descriptor;
 
-	Self        & self  ()       { return *this; }
-	Self  const & self  () const { return *this; }
-	Super       & super ()       { return dynamic_cast<      Super &>(*this); }
-	Super const & super () const { return dynamic_cast<const Super &>(*this); }
-
-	// must be a contiguous memory type
-	std::vector<uint64_t> payload;
+	// the fallbacks for attributes the entry type does not have, throws if there is none
+	uint64_t missing_attribute (const std::string & attribute_key) const;
 
 public:
 	uint64_t const * entry_buffer; // pointer to the raw data, there is no safeguard that it isn't freed
@@ -36,60 +34,62 @@ public:
 		const EntryDescriptorMap & entry_descriptor_map
 	);
 
-	const std::vector<unsigned long> & get_payload () const {
-		return payload;
+	entry_types type () const {
+		return static_cast<entry_types>(entry_buffer[0]);
+	}
+
+	// the words behind the attributes, as they are in the buffer
+	std::span<const uint64_t> get_payload () const {
+		return { entry_buffer + descriptor->size(), entry_buffer[1] - descriptor->size() };
+	}
+	// newer versions can use the payload of stacks as a ring buffer with a start_index,
+	// this reads it in order
+	uint64_t payload_word (const size_t index) const {
+		const std::span<const uint64_t> payload = get_payload();
+		if (type() == BTE_STACK && descriptor->offset(BTA_START_INDEX) != EntryDescriptor::no_offset)
+			return payload[(index + attribute(BTA_START_INDEX)) % payload.size()];
+		return payload[index];
 	}
 
 	const unsigned long start_time_ns () const {
-		return attribute("tsc_time");
+		return attribute(BTA_TSC_TIME);
 	}
 	const unsigned long end_time_ns () const {
-		return attribute("tsc_time") + attribute("tsc_duration");
+		return attribute(BTA_TSC_TIME) + attribute(BTA_TSC_DURATION);
 	}
 
-	const bool has_attribute(const std::string & attribute_key) const {
-		if (super().contains(attribute_key))
+	const bool has_attribute (const entry_attributes attribute_key) const {
+		if (descriptor->offset(attribute_key) != EntryDescriptor::no_offset)
 			return true;
 
-		// return this one early, because the rest of the code uses it
-		if (attribute_key == "entry_type")
-			return false;
-
 		// because of the special status of BTE_INFO, cpu_id could not easily be added to it.
 		// but we can just assume it's cpu 0, shouldn't really matter
-		if (attribute("entry_type") == BTE_INFO && attribute_key == "cpu_id")
-			return true;
-
-		return false;
+		return type() == BTE_INFO && attribute_key == BTA_CPU_ID;
 	}
 
-	const uint64_t attribute(const std::string & attribute_key) const {
-		if (super().contains(attribute_key))
-			return super().at(attribute_key);
-
-		// catch these separately, because the rest of the code uses them
-		if (attribute_key == "entry_type" || attribute_key == "tsc_time")
-			throw std::out_of_range(std::format(
-				"access to field '{}' is invalid.",
-				attribute_key
-			));
+	const uint64_t attribute (const entry_attributes attribute_key) const {
+		const uint64_t offset = descriptor->offset(attribute_key);
+		if (offset != EntryDescriptor::no_offset)
+			return entry_buffer[offset];
+		return missing_attribute(entry_attribute_names[attribute_key]);
+	}
 
-		// because of the special status of BTE_INFO, cpu_id could not easily be added to it.
-		// but we can just assume it's cpu 0, shouldn't really matter
-		if (attribute("entry_type") == BTE_INFO && attribute_key == "cpu_id")
-			return 0;
+	// by name, for attributes that are not in entry_attributes
+	const bool has_attribute (const std::string & attribute_key) const {
+		if (descriptor->attribute_offsets.contains(attribute_key))
+			return true;
+		return type() == BTE_INFO && attribute_key == "cpu_id";
+	}
 
-		throw std::out_of_range(std::format(
-			"access to field '{}' in entry of type '{}' ({}) with timestamp '{}' is invalid.",
-			attribute_key,
-			entry_type_name(static_cast<entry_types>(super().at("entry_type"))),
-			super().at("entry_type"),
-			super().at("tsc_time")
-		));
+	const uint64_t attribute (const std::string & attribute_key) const {
+		const auto found = descriptor->attribute_offsets.find(attribute_key);
+		if (found != descriptor->attribute_offsets.end())
+			return entry_buffer[found->second];
+		return missing_attribute(attribute_key);
 	}
 
 	void add_mapping () const;
-	std::string get_symbol_name (
+	std::string_view get_symbol_name (
 		unsigned long virtual_address,
 		unsigned long time_in_ns
 	) const;
@@ -99,5 +99,7 @@ public:
 	std::string to_string () const;
 	std::string to_hex_string () const;
 	std::string folded (const Entry * previous_entry, bool with_cpu_id, bool weight_from_time = true) const;
+	// the same, with interned frames, to be aggregated in FoldedStacks
+	folded_stack_t folded_stack (const Entry * previous_entry, bool with_cpu_id, bool weight_from_time = true) const;
+	uint64_t folded_weight (const Entry * previous_entry, bool weight_from_time = true) const;
 };
-
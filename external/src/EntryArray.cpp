@@ -1,56 +1,66 @@
 #include "EntryArray.hpp"
+#include "compress.hpp"
+#include "Mapping.hpp"
 #include "rethrow_error.hpp"
 
-RawEntryArray::RawEntryArray (const std::span<uint64_t> buffer) : buffer(buffer) {
-	const uint64_t * previous = buffer.data();
-	const uint64_t * current = buffer.data();
-	while (true) {
-		auto offset_in_words = [&] () {
-			return current - buffer.data();
-		};
-		if (offset_in_words() == buffer.size()) {
-			return;
-		} else if (offset_in_words() > buffer.size()) {
-			throw std::runtime_error(std::format(
-				"the end of the file is not reached exactly, "
-				"from entry @{}, offset {}, number {}. \n"
-				"overshoots end by {} words.",
-				reinterpret_cast<const void *>(previous),
-				previous - buffer.data(),
-				super().size(),
-				offset_in_words() - buffer.size()
-			));
-		} else if (offset_in_words() + 4 >= buffer.size()) {
-			throw std::runtime_error(std::format(
-				"the end of the file is not reached exactly, "
-				"there are {} words remaining. entry @{}, offset {}, number {}.",
-				std::to_string(buffer.size() - offset_in_words()) ,
-				reinterpret_cast<const void *>(previous),
-				previous - buffer.data(),
-				super().size()
-			));
-		}
-		#if 0
-		printf(
-			"reading at offset %5ld words (%5ld bytes) of length %5ld words: type = %3ld, length = %3ld words\n",
-			offset_in_words(), offset_in_words() * sizeof(uint64_t), buffer.size(),
-			*current, *(current + 1)
-		);
-		#endif
+const uint64_t * checked_raw_entry (
+	const std::span<uint64_t> buffer,
+	const uint64_t * const current,
+	const uint64_t * const previous,
+	const size_t number
+) {
+	auto offset_in_words = [&] () {
+		return static_cast<size_t>(current - buffer.data());
+	};
+	if (offset_in_words() == buffer.size()) {
+		return nullptr;
+	} else if (offset_in_words() > buffer.size()) {
+		throw std::runtime_error(std::format(
+			"the end of the file is not reached exactly, "
+			"from entry @{}, offset {}, number {}. \n"
+			"overshoots end by {} words.",
+			reinterpret_cast<const void *>(previous),
+			previous - buffer.data(),
+			number,
+			offset_in_words() - buffer.size()
+		));
+	} else if (offset_in_words() + 4 >= buffer.size()) {
+		throw std::runtime_error(std::format(
+			"the end of the file is not reached exactly, "
+			"there are {} words remaining. entry @{}, offset {}, number {}.",
+			std::to_string(buffer.size() - offset_in_words()) ,
+			reinterpret_cast<const void *>(previous),
+			previous - buffer.data(),
+			number
+		));
+	}
+	#if 0
+	printf(
+		"reading at offset %5ld words (%5ld bytes) of length %5ld words: type = %3ld, length = %3ld words\n",
+		offset_in_words(), offset_in_words() * sizeof(uint64_t), buffer.size(),
+		*current, *(current + 1)
+	);
+	#endif
 
-		const size_t length = reinterpret_cast<size_t>(*(current + 1));
-		if (length == 0) {
-			if (offset_in_words() + 1 == buffer.size())
-				break;
+	const size_t length = reinterpret_cast<size_t>(*(current + 1));
+	if (length == 0) {
+		if (offset_in_words() + 1 == buffer.size())
+			return nullptr;
 
-			throw std::runtime_error(std::format(
-				"entry of length 0 at offset {} after {} entries, buffer length is {}",
-				offset_in_words(),
-				super().size(),
-				buffer.size()
-			));
-		}
+		throw std::runtime_error(std::format(
+			"entry of length 0 at offset {} after {} entries, buffer length is {}",
+			offset_in_words(),
+			number,
+			buffer.size()
+		));
+	}
+	return current;
+}
 
+RawEntryArray::RawEntryArray (const std::span<uint64_t> buffer) : buffer(buffer) {
+	const uint64_t * previous = buffer.data();
+	const uint64_t * current = buffer.data();
+	while ((current = checked_raw_entry(buffer, current, previous, super().size()))) {
 		try {
 			self().push_back(current);
 		} catch (std::exception & e) {
@@ -58,7 +68,7 @@ RawEntryArray::RawEntryArray (const std::span<uint64_t> buffer) : buffer(buffer)
 				"there was an error in raw entry number {} at offset {},\n"
 				"first bytes {:016x} {:016x} {:016x} {:016x}.",
 				self().size(),
-				offset_in_words(),
+				current - buffer.data(),
 				*current,
 				*(current + 1),
 				*(current + 2),
@@ -66,11 +76,13 @@ RawEntryArray::RawEntryArray (const std::span<uint64_t> buffer) : buffer(buffer)
 			));
 		}
 		previous = current;
-		current += length;
+		current += *(current + 1);
 	}
 }
 
 EntryArray::EntryArray (const RawEntryArray & raw_entry_array) {
+	// the number of the raw entry each entry comes from, to sort entries with the same time
+	std::vector<size_t> sequences;
 	for (size_t i = 0; i < raw_entry_array.size(); i++) {
 		const uint64_t * const type_ptr = raw_entry_array[i];
 		const size_t entry_length = reinterpret_cast<size_t>(*(type_ptr + 1));
@@ -94,7 +106,8 @@ EntryArray::EntryArray (const RawEntryArray & raw_entry_array) {
 		case BTE_STACK:   [[fallthrough]];
 		case BTE_MAPPING: [[fallthrough]];
 		case BTE_CONTROL: [[fallthrough]];
-		case BTE_STATS:
+		case BTE_STATS:   [[fallthrough]];
+		case BTE_STACK_REF:
 			continue;
 		default:
 			throw std::runtime_error(std::format(
@@ -118,6 +131,8 @@ EntryArray::EntryArray (const RawEntryArray & raw_entry_array) {
 	for (size_t i = 0; i < raw_entry_array.size(); i++) {
 		const uint64_t * const type_ptr = raw_entry_array[i];
 		const size_t entry_length = reinterpret_cast<size_t>(*(type_ptr + 1));
+		if (*type_ptr == BTE_STACK_REF)
+			continue;
 		#if 0
 		if (i + 1 < raw_entry_array.size()) printf(
 			"reading from %p, word %lx, byte %lx: typ = %lx, len = %lx "
@@ -136,6 +151,7 @@ EntryArray::EntryArray (const RawEntryArray & raw_entry_array) {
 		#endif
 		try {
 			super().emplace_back(raw_entry_array[i], raw_entry_array.buffer, entry_length, *entry_descriptor_map);
+			sequences.push_back(i);
 		} catch (std::exception & e) {
 			throw rethrow_error<std::runtime_error>(e, std::format(
 				"there was an error in entry number {},\nfirst bytes {:016x} {:016x} {:016x} {:016x}.",
@@ -147,8 +163,367 @@ EntryArray::EntryArray (const RawEntryArray & raw_entry_array) {
 		}
 	}
 
-	std::sort(super().begin(), super().end(), [](const Entry & a, const Entry & b) {
-		return a.attribute("tsc_time") < b.attribute("tsc_time");
+	const std::vector<std::pair<size_t, size_t>> expanded_offsets = expand_stack_references(raw_entry_array);
+	for (size_t i = 0; i < expanded_offsets.size(); i++) {
+		const uint64_t * const type_ptr = &expanded_stacks[expanded_offsets[i].first];
+		const size_t entry_length = reinterpret_cast<size_t>(*(type_ptr + 1));
+		try {
+			super().emplace_back(type_ptr, expanded_stacks, entry_length, *entry_descriptor_map);
+			sequences.push_back(expanded_offsets[i].second);
+		} catch (std::exception & e) {
+			throw rethrow_error<std::runtime_error>(e, std::format(
+				"there was an error in expanded stack number {},\nfirst bytes {:016x} {:016x} {:016x} {:016x}.",
+				i, *type_ptr,
+				*(type_ptr + 1),
+				*(type_ptr + 2),
+				*(type_ptr + 3)
+			));
+		}
+	}
+
+	// entries with the same time stay in buffer order, samples at their BTE_STACK_REF, like in EntryStream
+	std::vector<size_t> order (super().size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&] (const size_t a, const size_t b) {
+		const uint64_t time_a = super()[a].start_time_ns();
+		const uint64_t time_b = super()[b].start_time_ns();
+		return time_a != time_b ? time_a < time_b : sequences[a] < sequences[b];
 	});
+	std::vector<Entry> sorted;
+	sorted.reserve(order.size());
+	for (const size_t i : order)
+		sorted.push_back(super()[i]);
+	super() = std::move(sorted);
+}
+
+std::set<std::string> EntryArray::mapped_binaries (const std::span<uint64_t> buffer) {
+	std::unique_ptr<EntryDescriptorMap> descriptors;
+	std::vector<const uint64_t *> mapping_entries;
+	const uint64_t * previous = buffer.data();
+	const uint64_t * current = buffer.data();
+	for (size_t number = 0; (current = checked_raw_entry(buffer, current, previous, number)); number++) {
+		if (*current == BTE_INFO && !descriptors)
+			descriptors.reset(new EntryDescriptorMap { current, reinterpret_cast<size_t>(*(current + 1)) });
+		if (*current == BTE_MAPPING)
+			mapping_entries.push_back(current);
+		previous = current;
+		current += *(current + 1);
+	}
+	if (!descriptors)
+		return {};
+	const EntryDescriptor * const descriptor = descriptors->find(BTE_MAPPING);
+	if (!descriptor)
+		return {};
+
+	std::set<std::string> binaries;
+	for (const uint64_t * const type_ptr : mapping_entries) {
+		const size_t entry_length = reinterpret_cast<size_t>(*(type_ptr + 1));
+		if (entry_length <= descriptor->size())
+			continue;
+		binaries.insert(Mapping::name_from_payload({
+			type_ptr + descriptor->size(),
+			entry_length - descriptor->size()
+		}));
+	}
+	return binaries;
+}
+
+// a BTE_STACK_REF stands for stack_ref_count samples of the stack stack_ref_stack_id,
+// which was defined by the BTE_STACK entry in the latest BTE_STACK_REF that had one,
+// if that was in the same stack_ref_generation. otherwise the definition was in a section that is missing.
+// the samples become BTE_STACK entries again, spread evenly from the first to the last tsc_time,
+// sharing the sum of their durations.
+
+// the stack the BTE_STACK_REF at type_ptr stands for, after noting a definition it carries in stack_table.
+// empty if it is not defined, because its definition was in a section that is missing.
+static std::optional<std::span<const uint64_t>> resolve_stack_reference (
+	const uint64_t * const type_ptr,
+	const size_t number,
+	const std::span<uint64_t> buffer,
+	const EntryDescriptorMap & entry_descriptor_map,
+	std::map<uint64_t, stack_definition_t> & stack_table
+) {
+	const size_t entry_length = reinterpret_cast<size_t>(*(type_ptr + 1));
+	if (entry_length < stack_ref_header_words) {
+		throw std::runtime_error(std::format(
+			"BTE_STACK_REF number {} at offset {} has only {} words.",
+			number, type_ptr - buffer.data(), entry_length
+		));
+	}
+
+	const uint64_t stack_id = type_ptr[stack_ref_stack_id];
+	const uint64_t generation = type_ptr[stack_ref_generation];
+	if (entry_length > stack_ref_header_words) {
+		std::span<const uint64_t> definition {
+			type_ptr + stack_ref_header_words,
+			entry_length - stack_ref_header_words
+		};
+		if (definition[0] != BTE_STACK || definition[1] != definition.size()) {
+			throw std::runtime_error(std::format(
+				"BTE_STACK_REF number {} at offset {} defines stack {} with something else than a BTE_STACK.",
+				number, type_ptr - buffer.data(), stack_id
+			));
+		}
+		// the samples get their times where BTE_STACK_REF has them
+		const EntryDescriptor * const descriptor = entry_descriptor_map.find(BTE_STACK);
+		if (
+			!descriptor
+			|| descriptor->offset(BTA_TSC_TIME) != stack_ref_tsc_time
+			|| descriptor->offset(BTA_TSC_DURATION) != stack_ref_tsc_duration
+		) {
+			throw std::runtime_error(std::format(
+				"BTE_STACK_REF number {} at offset {} defines stack {}, "
+				"but BTE_STACK entries do not have tsc_time and tsc_duration at offsets {} and {}.",
+				number, type_ptr - buffer.data(), stack_id, +stack_ref_tsc_time, +stack_ref_tsc_duration
+			));
+		}
+		stack_table[stack_id] = { generation, definition };
+	}
+
+	const auto found = stack_table.find(stack_id);
+	if (found == stack_table.end() || found->second.generation != generation)
+		return {};
+	return found->second.entry;
+}
+
+static uint64_t stack_reference_sample_time (const uint64_t * const reference, const uint64_t sample) {
+	const uint64_t count = reference[stack_ref_count];
+	const uint64_t first = reference[stack_ref_tsc_first];
+	const uint64_t last  = reference[stack_ref_tsc_time];
+	return count > 1 ? first + (last - first) * sample / (count - 1) : last;
+}
+
+// writes the BTE_STACK of one sample to expanded, which has room for the definition
+static void expand_stack_reference_sample (
+	const uint64_t * const reference,
+	const std::span<const uint64_t> definition,
+	const uint64_t sample,
+	uint64_t * const expanded
+) {
+	const uint64_t count    = reference[stack_ref_count];
+	const uint64_t duration = reference[stack_ref_tsc_duration];
+	std::copy(definition.begin(), definition.end(), expanded);
+	expanded[stack_ref_tsc_time] = stack_reference_sample_time(reference, sample);
+	expanded[stack_ref_tsc_duration] = duration / count + (sample == 0 ? duration % count : 0);
+}
+
+static void warn_undefined_stack_references (const size_t undefined) {
+	if (undefined) {
+		std::cerr << std::format(
+			"WARNING: {} BTE_STACK_REF entries refer to undefined stacks, their samples are missing.",
+			undefined
+		) << std::endl;
+	}
 }
 
+// returns the offsets of the entries in expanded_stacks, with the number of their BTE_STACK_REF.
+std::vector<std::pair<size_t, size_t>> EntryArray::expand_stack_references (const RawEntryArray & raw_entry_array) {
+	std::map<uint64_t, stack_definition_t> stack_table;
+	std::vector<std::tuple<const uint64_t *, std::span<const uint64_t>, size_t>> references;
+	size_t expanded_words = 0;
+	size_t undefined = 0;
+
+	for (size_t i = 0; i < raw_entry_array.size(); i++) {
+		const uint64_t * const type_ptr = raw_entry_array[i];
+		if (*type_ptr != BTE_STACK_REF)
+			continue;
+
+		const auto definition = resolve_stack_reference(
+			type_ptr, i, raw_entry_array.buffer, *entry_descriptor_map, stack_table
+		);
+		if (!definition) {
+			undefined ++;
+			continue;
+		}
+		references.emplace_back(type_ptr, *definition, i);
+		expanded_words += type_ptr[stack_ref_count] * definition->size();
+	}
+	warn_undefined_stack_references(undefined);
+
+	std::vector<std::pair<size_t, size_t>> offsets;
+	expanded_stacks.reserve(expanded_words);
+	for (const auto & [reference, definition, number] : references) {
+		for (uint64_t sample = 0; sample < reference[stack_ref_count]; sample++) {
+			offsets.emplace_back(expanded_stacks.size(), number);
+			expanded_stacks.resize(expanded_stacks.size() + definition.size());
+			expand_stack_reference_sample(reference, definition, sample, &expanded_stacks[offsets.back().first]);
+		}
+	}
+	return offsets;
+}
+
+EntryStream::EntryStream (
+	const std::span<uint64_t> buffer,
+	const size_t window,
+	const read_more_t & read_more
+) : buffer(buffer),
+	window(std::max<size_t>(window, 1)),
+	read_more(read_more),
+	previous_raw(buffer.data()),
+	next_raw(buffer.data())
+{
+	// the descriptors are needed before any entry, the BTE_INFO is usually the first one
+	const uint64_t * previous = buffer.data();
+	const uint64_t * current = buffer.data();
+	for (size_t number = 0; (current = complete_raw_entry(current, previous, number)); number++) {
+		if (*current == BTE_INFO) {
+			entry_descriptor_map.reset(new EntryDescriptorMap { current, reinterpret_cast<size_t>(*(current + 1)) });
+			break;
+		}
+		previous = current;
+		current += *(current + 1);
+	}
+	if (!entry_descriptor_map) {
+		throw std::runtime_error(
+			"there is no entry descriptor table in the btb. "
+			"but the entry types are not implemented, \n"
+			"they are read from the buffer itself."
+		);
+	}
+}
+
+const uint64_t * EntryStream::complete_raw_entry (
+	const uint64_t * const current,
+	const uint64_t * const previous,
+	const size_t number
+) {
+	if (read_more) {
+		auto is_complete = [&] () {
+			const size_t offset = current - buffer.data();
+			return offset + 2 <= buffer.size() && offset + current[1] <= buffer.size();
+		};
+		while (!is_complete() && read_more(buffer))
+			;
+	}
+	return checked_raw_entry(buffer, current, previous, number);
+}
+
+bool EntryStream::read_one () {
+	const uint64_t * const type_ptr = complete_raw_entry(next_raw, previous_raw, raw_count);
+	if (!type_ptr)
+		return false;
+	previous_raw = type_ptr;
+	next_raw = type_ptr + *(type_ptr + 1);
+	const size_t number = raw_count++;
+
+	if (*type_ptr == BTE_STACK_REF) {
+		auto definition = resolve_stack_reference(
+			type_ptr, number, buffer, *entry_descriptor_map, stack_table
+		);
+		if (!definition) {
+			undefined ++;
+			return true;
+		}
+		const uint64_t stack_id = type_ptr[stack_ref_stack_id];
+		std::shared_ptr<const std::vector<uint64_t>> & words = stack_words[stack_id];
+		if (definition->data() == type_ptr + stack_ref_header_words) {
+			// pending samples of the old definition keep their copy
+			words = std::make_shared<const std::vector<uint64_t>>(definition->begin(), definition->end());
+			definition = stack_table[stack_id].entry = *words;
+		}
+		if (type_ptr[stack_ref_count] == 0)
+			return true;
+		pending.push({
+			stack_reference_sample_time(type_ptr, 0), number, type_ptr,
+			*definition, words, 0, expanded_words
+		});
+		pending_raw.insert(type_ptr);
+		expanded_words += type_ptr[stack_ref_count] * definition->size();
+		return true;
+	}
+
+	const EntryDescriptor * const descriptor = entry_descriptor_map->find(*type_ptr);
+	if (!descriptor) {
+		throw std::runtime_error(std::format(
+			"the entry at {}, {:x} words behind buffer start @{},\n"
+			"has entry type {:x}, which is not recognized by this program.",
+			reinterpret_cast<const void *>(type_ptr),
+			type_ptr - buffer.data(),
+			reinterpret_cast<const void *>(buffer.data()),
+			*type_ptr
+		));
+	}
+	const size_t time_offset = descriptor->offset(BTA_TSC_TIME);
+	if (time_offset == EntryDescriptor::no_offset || time_offset >= *(type_ptr + 1)) {
+		throw std::runtime_error(std::format(
+			"the entry number {} at offset {} has no tsc_time to be sorted by.",
+			number, type_ptr - buffer.data()
+		));
+	}
+	pending.push({ type_ptr[time_offset], number, type_ptr, {}, {}, 0, 0 });
+	pending_raw.insert(type_ptr);
+	return true;
+}
+
+void EntryStream::hand_out (pending_t item) {
+	previous = std::move(current);
+	std::swap(previous_words, current_words);
+
+	if (item.time < last_time)
+		late ++;
+	else
+		last_time = item.time;
+
+	if (*item.raw != BTE_STACK_REF || item.sample + 1 == item.raw[stack_ref_count])
+		pending_raw.erase(pending_raw.find(item.raw));
+
+	if (*item.raw != BTE_STACK_REF) {
+		const size_t entry_length = reinterpret_cast<size_t>(*(item.raw + 1));
+		try {
+			current.emplace(item.raw, buffer, entry_length, *entry_descriptor_map);
+		} catch (std::exception & e) {
+			throw rethrow_error<std::runtime_error>(e, std::format(
+				"there was an error in entry number {},\nfirst bytes {:016x} {:016x} {:016x} {:016x}.",
+				item.sequence, *item.raw,
+				*(item.raw + 1),
+				*(item.raw + 2),
+				*(item.raw + 3)
+			));
+		}
+		return;
+	}
+
+	current_words.resize(item.definition.size());
+	expand_stack_reference_sample(item.raw, item.definition, item.sample, current_words.data());
+	current.emplace(current_words.data(), current_words, current_words.size(), *entry_descriptor_map);
+	// as if it was in EntryArray's expanded_stacks, for btb_lines
+	current->buffer_offset = item.expanded_offset + item.sample * item.definition.size();
+
+	if (item.sample + 1 < item.raw[stack_ref_count]) {
+		item.sample ++;
+		item.time = stack_reference_sample_time(item.raw, item.sample);
+		pending.push(item);
+	}
+}
+
+const uint64_t * EntryStream::oldest_needed () const {
+	const uint64_t * oldest = next_raw;
+	if (!pending_raw.empty())
+		oldest = std::min(oldest, *pending_raw.begin());
+	// the samples of BTE_STACK_REF entries are in current_words and previous_words
+	for (const std::optional<Entry> * entry : { &current, &previous }) {
+		const uint64_t * const raw = *entry ? (*entry)->entry_buffer : nullptr;
+		if (raw >= buffer.data() && raw < buffer.data() + buffer.size())
+			oldest = std::min(oldest, raw);
+	}
+	return oldest;
+}
+
+const Entry * EntryStream::next () {
+	while (pending.size() <= window && read_one())
+		;
+	if (pending.empty()) {
+		if (current) {
+			previous = std::move(current);
+			std::swap(previous_words, current_words);
+			current.reset();
+			warn_undefined_stack_references(undefined);
+		}
+		return nullptr;
+	}
+	const pending_t item = pending.top();
+	pending.pop();
+	hand_out(item);
+	return &*current;
+}
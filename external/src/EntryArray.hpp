@@ -1,10 +1,31 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <set>
+#include <string>
 #include <vector>
 
 #include "Entry.hpp"
 
+// the entry at current, after checking that it lies within buffer. nullptr behind the last entry.
+// previous and number (of entries before it) are only for the errors.
+const uint64_t * checked_raw_entry (
+	const std::span<uint64_t> buffer,
+	const uint64_t * const current,
+	const uint64_t * const previous,
+	const size_t number
+);
+
+// the latest definition of a stack_id of BTE_STACK_REF entries, with the generation it was sent with
+typedef struct stack_definition_s {
+	uint64_t generation;
+	std::span<const uint64_t> entry;
+} stack_definition_t;
+
 class RawEntryArray : public std::vector<const uint64_t *> {
 	using Self  = RawEntryArray;
 	using Super = std::vector<const uint64_t *>;
@@ -22,8 +43,96 @@ class EntryArray : public std::vector<Entry> {
 	Self  & self  () { return *this; }
 	Super & super () { return static_cast<Super &>(*this); }
 	std::unique_ptr<EntryDescriptorMap> entry_descriptor_map;
+	// the BTE_STACK entries that BTE_STACK_REF entries stand for
+	std::vector<uint64_t> expanded_stacks;
+
+	std::vector<std::pair<size_t, size_t>> expand_stack_references (const RawEntryArray & raw_entry_array);
 
 public:
 	EntryArray (const RawEntryArray & raw_entry_array);
+
+	// the names of the binaries in the BTE_MAPPING entries, without reading the other entries.
+	// empty if there is no BTE_INFO entry to read them with.
+	static std::set<std::string> mapped_binaries (const std::span<uint64_t> buffer);
+};
+
+// for a buffer that is still arriving: appends words behind its end (where it is, so entries stay valid)
+// and widens the span. false at the end of the input.
+using read_more_t = std::function<bool (std::span<uint64_t> & buffer)>;
+
+// the entries of a buffer sorted by start time, like EntryArray, without holding all of them.
+// the buffer is read in order, and an entry is handed out once window more entries were read behind it.
+// entries that are further out of order than that come out late, and are counted.
+// the samples of a BTE_STACK_REF are made one at a time, when they are due.
+// with read_more, the buffer is read while it arrives. the words before oldest_needed are not read again,
+// stack definitions are copied, so the reader can release them.
+class EntryStream {
+	typedef struct pending_s {
+		uint64_t time;
+		// position in the buffer, so entries with the same time keep their order
+		uint64_t sequence;
+		const uint64_t * raw;
+		// for a BTE_STACK_REF: the stack it stands for (in definition_words), the next sample,
+		// and where the samples would be in EntryArray's expanded_stacks
+		std::span<const uint64_t> definition;
+		std::shared_ptr<const std::vector<uint64_t>> definition_words;
+		uint64_t sample;
+		uint64_t expanded_offset;
+
+		bool operator> (const struct pending_s & other) const {
+			return time != other.time ? time > other.time : sequence > other.sequence;
+		}
+	} pending_t;
+
+	std::span<uint64_t> buffer;
+	const size_t window;
+	const read_more_t read_more;
+	std::unique_ptr<EntryDescriptorMap> entry_descriptor_map;
+
+	const uint64_t * previous_raw;
+	const uint64_t * next_raw;
+	size_t raw_count = 0;
+	std::priority_queue<pending_t, std::vector<pending_t>, std::greater<pending_t>> pending;
+	// the raw entries of pending, in buffer order
+	std::multiset<const uint64_t *> pending_raw;
+
+	// the entries of stack_table point into stack_words, not into the buffer
+	std::map<uint64_t, stack_definition_t> stack_table;
+	std::map<uint64_t, std::shared_ptr<const std::vector<uint64_t>>> stack_words;
+	uint64_t expanded_words = 0;
+	size_t undefined = 0;
+
+	// the entry handed out last and the one before it, with the words of expanded samples
+	std::optional<Entry> current;
+	std::optional<Entry> previous;
+	std::vector<uint64_t> current_words;
+	std::vector<uint64_t> previous_words;
+	uint64_t last_time = 0;
+	size_t late = 0;
+
+	// checked_raw_entry, after reading more until the entry at current is complete
+	const uint64_t * complete_raw_entry (const uint64_t * current, const uint64_t * previous, const size_t number);
+	// reads the next raw entry into pending, false at the end of the buffer
+	bool read_one ();
+	void hand_out (pending_t item);
+
+public:
+	EntryStream (const std::span<uint64_t> buffer, const size_t window, const read_more_t & read_more = {});
+
+	// the next entry by start time, nullptr at the end.
+	// it stays valid until the call after the next one, so it can be the previous entry.
+	const Entry * next ();
+	const Entry * previous_entry () const {
+		return previous ? &*previous : nullptr;
+	}
+	// the first word of the buffer that is still needed, by the pending, current and previous entries
+	const uint64_t * oldest_needed () const;
+
+	size_t late_entries () const {
+		return late;
+	}
+	size_t undefined_references () const {
+		return undefined;
+	}
 };
 
@@ -60,6 +60,7 @@ void assert_attribute_name (
 }
 
 EntryDescriptor::EntryDescriptor (const uint64_t * const buffer, const uint64_t length_in_words) {
+	known_offsets.fill(no_offset);
 	self().resize(length_in_words / words_per_entry_name);
 	// one attribute_name is stored in several words
 	for (uint64_t index = 0; index < length_in_words / words_per_entry_name; index++) {
@@ -76,31 +77,13 @@ EntryDescriptor::EntryDescriptor (const uint64_t * const buffer, const uint64_t
 		std::string name { attribute_name };
 		self()[index] = name;
 		attribute_offsets[name] = index;
+		for (size_t a = 0; a < entry_attribute_count; a++)
+			if (entry_attribute_names[a] == name)
+				known_offsets[a] = index;
 		if (false) printf("entry type has attribute %ld: '%s'\n", index, attribute_name);
 	}
 }
 
-uint64_t EntryDescriptor::read_in(
-	const uint64_t offset,
-	const uint64_t * const buffer,
-	const uint64_t length_in_words
-) const {
-	if (size() > length_in_words) {
-		throw std::runtime_error(
-			"reading an entry of length " + std::to_string(length_in_words)
-			+ " with an EntryDescriptor for " + std::to_string(size())
-			+ " words."
-		);
-	}
-	if (offset > size()) {
-		throw std::runtime_error(
-			"reading offset " + std::to_string(offset)
-			+ " from an EntryDescriptor for " + std::to_string(size())
-			+ " words."
-		);
-	}
-	return buffer[offset];
-}
 EntryDescriptorMap::EntryDescriptorMap (const uint64_t * const buffer, const size_t length_in_words) {
 	// TODO: use meta-entry for types...
 	// ignore length of entry in buffer+1, that's in length_in_words already,
@@ -121,7 +104,10 @@ EntryDescriptorMap::EntryDescriptorMap (const uint64_t * const buffer, const siz
 		if (current_entry_descriptor_names - buffer > length_in_words)
 			throw std::runtime_error ("entries descriptor names continue after entry??");
 
-		entry_types entry_type = static_cast<entry_types>(1 << i);
+		if (i >= by_type_bit.size())
+			throw std::runtime_error ("more entry types than bits in entry_type??");
+
+		entry_types entry_type = static_cast<entry_types>(1ul << i);
 		size_t entry_descriptor_length = entry_descriptor_lengths[i];
 		if (entry_descriptor_length == 0) {
 			// some entry types are not yet implemented.
@@ -129,9 +115,10 @@ EntryDescriptorMap::EntryDescriptorMap (const uint64_t * const buffer, const siz
 			continue;
 		}
 
-		self().emplace(entry_type, EntryDescriptor (
+		auto const & [descriptor, was_inserted] = self().emplace(entry_type, EntryDescriptor (
 			current_entry_descriptor_names, entry_descriptor_length * words_per_entry_name
 		));
+		by_type_bit[i] = &descriptor->second;
 		current_entry_descriptor_names += entry_descriptor_length * words_per_entry_name;
 	}
 }
@@ -1,4 +1,6 @@
 #pragma once
+#include <array>
+#include <bit>
 #include <cstdint>
 #include <vector>
 #include <string>
@@ -11,14 +13,16 @@ enum entry_types {
 	BTE_INFO     = 1 << 2,    // information about module
 	BTE_CONTROL  = 1 << 3,    // start/stop(/reset) entry
 	BTE_STATS    = 1 << 4,    // histogram of time by stack depth
+	BTE_STACK_REF = 1 << 5,   // repeated stack, written by the server, see stack_intern_section
 };
-static constexpr size_t entry_type_count = 5;
+static constexpr size_t entry_type_count = 6;
 static constexpr std::string entry_type_names [entry_type_count] = {
 	"BTE_STACK",
 	"BTE_MAPPING",
 	"BTE_INFO",
 	"BTE_CONTROL",
 	"BTE_STATS" ,
+	"BTE_STACK_REF",
 };
 static inline constexpr const std::string & entry_type_name (const entry_types type) {
 	for (size_t i = 0; i < entry_type_count; i++)
@@ -48,6 +52,46 @@ struct std::formatter<entry_types> : std::formatter<int>, std::formatter<std::st
     }
 };
 
+enum entry_attributes {
+	// BTA: BackTrace Attribute, the ones the tools use.
+	// EntryDescriptor finds their offsets by name once, entries then look them up by index.
+	BTA_ENTRY_TYPE,
+	BTA_ENTRY_LENGTH,
+	BTA_TSC_TIME,
+	BTA_TSC_DURATION,
+	BTA_CPU_ID,
+	BTA_TASK_ID,
+	BTA_TIMER_STEP,
+	BTA_STACK_DEPTH,
+	BTA_START_INDEX,
+	BTA_MAPPING_TASK_ID,
+	BTA_MAPPING_BASE,
+	BTA_VERSION,
+	BTA_TYPE_COUNT,
+	BTA_CONTROL,
+	BTA_HIST_BIN_COUNT,
+	BTA_HIST_BIN_SIZE,
+};
+static constexpr size_t entry_attribute_count = 16;
+static constexpr std::string entry_attribute_names [entry_attribute_count] = {
+	"entry_type",
+	"entry_length",
+	"tsc_time",
+	"tsc_duration",
+	"cpu_id",
+	"task_id",
+	"timer_step",
+	"stack_depth",
+	"start_index",
+	"mapping_task_id",
+	"mapping_base",
+	"version",
+	"type_count",
+	"control",
+	"hist_bin_count",
+	"hist_bin_size",
+};
+
 // a string like 'tsc_duration' that descibes an entry attribute
 // will have used this many uint64_t to descibe itself
 constexpr uint64_t words_per_entry_name = 2;
@@ -63,24 +107,41 @@ void assert_attribute_name (
 );
 
 class EntryDescriptor : public std::vector<std::string> {
-	map_with_errors<std::string, uint64_t> attribute_offsets;
 	using Self = EntryDescriptor;
 	Self & self () { return *this; }
 
+	// offset of each entry_attributes value, or no_offset if this type does not have it
+	std::array<uint64_t, entry_attribute_count> known_offsets;
+
 public:
+	static constexpr uint64_t no_offset = ~0ul;
+
+	// by name, so iterating gives the attributes in the order Entry::to_string prints them
+	map_with_errors<std::string, uint64_t> attribute_offsets;
+
 	EntryDescriptor (const uint64_t * const buffer, const uint64_t length_in_words);
 
-	uint64_t read_in(
-		const uint64_t offset,
-		const uint64_t * const buffer,
-		const uint64_t length_in_words
-	) const;
+	uint64_t offset (const entry_attributes attribute) const {
+		return known_offsets[attribute];
+	}
 };
 class EntryDescriptorMap : public map_with_errors<entry_types, EntryDescriptor> {
 	using Self = EntryDescriptorMap;
 	Self & self () { return *this; }
 
+	// indexed by the bit of the entry type, so entries find their descriptor without a tree lookup
+	std::array<const EntryDescriptor *, 64> by_type_bit {};
+
 public:
 	EntryDescriptorMap (const uint64_t * const buffer, const size_t length_in_words);
+	// by_type_bit points into this map
+	EntryDescriptorMap (const EntryDescriptorMap &) = delete;
+
+	// nullptr if the type has no descriptor
+	const EntryDescriptor * find (const uint64_t entry_type) const {
+		if (!entry_type || (entry_type & (entry_type - 1)))
+			return nullptr;
+		return by_type_bit[std::countr_zero(entry_type)];
+	}
 };
 
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <format>
+
+#include "FlameGraph.hpp"
+
+// the sizes flamegraph.pl uses, so the graphs look the same
+static constexpr double font_size = 12;
+static constexpr double font_width = 0.59;
+static constexpr double frame_height = 16;
+static constexpr double frame_pad = 1;
+static constexpr double x_pad = 10;
+static constexpr double title_pad = font_size * 3;
+static constexpr double subtitle_pad = font_size * 2;
+static constexpr double bottom_pad = font_size * 2 + 10;
+
+static std::string escape_xml (const std::string_view text) {
+	std::string result;
+	result.reserve(text.size());
+	for (const char c : text) {
+		switch (c) {
+		case '&': result += "&amp;";  break;
+		case '<': result += "&lt;";   break;
+		case '>': result += "&gt;";   break;
+		case '"': result += "&quot;"; break;
+		default:  result += c;        break;
+		}
+	}
+	return result;
+}
+
+// flamegraph.pl's "hot" palette, colored by a hash of the name instead of randomly,
+// so the same function has the same color in every graph and the files are reproducible
+static std::string hot_color (const std::string_view name) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (const char c : name) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 0x100000001b3;
+	}
+	const double v1 = ((hash >>  0) & 0xffff) / 65536.0;
+	const double v2 = ((hash >> 16) & 0xffff) / 65536.0;
+	const double v3 = ((hash >> 32) & 0xffff) / 65536.0;
+	return std::format(
+		"rgb({},{},{})",
+		205 + static_cast<int>(50 * v3),
+		static_cast<int>(230 * v1),
+		static_cast<int>(55 * v2)
+	);
+}
+
+FlameGraph::FlameGraph (const FoldedStacks & folded_stacks) : folded_stacks(folded_stacks) {
+	const std::span<const FoldedStacks::node_t> nodes = folded_stacks.all_nodes();
+
+	// children are always added after their parent, so going backwards sums up the subtrees
+	totals.resize(nodes.size());
+	for (size_t node = nodes.size(); node-- > 0;) {
+		totals[node] += nodes[node].weight;
+		if (nodes[node].parent != FoldedStacks::no_node)
+			totals[nodes[node].parent] += totals[node];
+	}
+
+	children_start.reserve(nodes.size() + 1);
+	sorted_children.reserve(nodes.size());
+	for (uint32_t node = 0; node < nodes.size(); node++) {
+		children_start.push_back(sorted_children.size());
+		for (uint32_t c = nodes[node].first_child; c != FoldedStacks::no_node; c = nodes[c].next_sibling)
+			sorted_children.push_back(c);
+		std::sort(
+			sorted_children.begin() + children_start.back(), sorted_children.end(),
+			[&] (const uint32_t a, const uint32_t b) {
+				return frame_names.name(nodes[a].frame) < frame_names.name(nodes[b].frame);
+			}
+		);
+	}
+	children_start.push_back(sorted_children.size());
+}
+
+size_t FlameGraph::write (std::ostream & stream, const flame_graph_options_t & options) const {
+	return write_nodes(stream, children(0), options);
+}
+
+size_t FlameGraph::write_cpu (std::ostream & stream, const uint64_t cpu_id, const flame_graph_options_t & options) const {
+	const auto found = folded_stacks.cpu_nodes().find(cpu_id);
+	if (found == folded_stacks.cpu_nodes().end())
+		return write_nodes(stream, {}, options);
+	const uint32_t cpu_node = found->second;
+	return write_nodes(stream, std::span(&cpu_node, 1), options);
+}
+
+size_t FlameGraph::write_nodes (
+	std::ostream & stream,
+	const std::span<const uint32_t> bottom_nodes,
+	const flame_graph_options_t & options
+) const {
+	const std::span<const FoldedStacks::node_t> nodes = folded_stacks.all_nodes();
+
+	uint64_t total = 0;
+	for (const uint32_t node : bottom_nodes)
+		total += totals[node];
+
+	const double width_per_weight = total ? (options.width - 2 * x_pad) / total : 0;
+	auto is_drawn = [&] (const uint32_t node) {
+		return totals[node] && totals[node] * width_per_weight >= options.minwidth;
+	};
+
+	// nodes to draw, with their depth ("all" is 0) and the weight left of them
+	typedef struct frame_s {
+		uint32_t node;
+		uint32_t depth;
+		uint64_t start;
+	} frame_t;
+	std::vector<frame_t> frames;
+	std::vector<frame_t> pending;
+	uint64_t start = 0;
+	for (const uint32_t node : bottom_nodes) {
+		if (is_drawn(node))
+			pending.push_back({ node, 1, start });
+		start += totals[node];
+	}
+	std::reverse(pending.begin(), pending.end());
+	while (!pending.empty()) {
+		const frame_t frame = pending.back();
+		pending.pop_back();
+		frames.push_back(frame);
+
+		// what the node's own weight does not cover, is covered by the children
+		const size_t children_pending = pending.size();
+		uint64_t child_start = frame.start;
+		for (const uint32_t child : children(frame.node)) {
+			if (is_drawn(child))
+				pending.push_back({ child, frame.depth + 1, child_start });
+			child_start += totals[child];
+		}
+		std::reverse(pending.begin() + children_pending, pending.end());
+	}
+
+	uint32_t max_depth = 0;
+	for (const frame_t & frame : frames)
+		max_depth = std::max(max_depth, frame.depth);
+
+	const double top_pad = title_pad + (options.subtitle.empty() ? 0 : subtitle_pad);
+	const double height = (max_depth + 1) * frame_height + top_pad + bottom_pad;
+
+	stream << std::format(
+		"<?xml version=\"1.0\" standalone=\"no\"?>\n"
+		"<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n"
+		"<svg version=\"1.1\" width=\"{0}\" height=\"{1}\" viewBox=\"0 0 {0} {1}\" "
+		"xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\">\n"
+		"<defs><linearGradient id=\"background\" y1=\"0\" y2=\"1\" x1=\"0\" x2=\"0\">"
+		"<stop stop-color=\"#eeeeee\" offset=\"5%\"/><stop stop-color=\"#eeeeb0\" offset=\"95%\"/>"
+		"</linearGradient></defs>\n"
+		"<style type=\"text/css\">\n"
+		"\ttext {{ font-family:Verdana; font-size:{2}px; fill:rgb(0,0,0); }}\n"
+		"\t#title {{ text-anchor:middle; font-size:{3}px; }}\n"
+		"\t#subtitle {{ text-anchor:middle; fill:rgb(160,160,160); }}\n"
+		"</style>\n"
+		"<rect x=\"0\" y=\"0\" width=\"{0}\" height=\"{1}\" fill=\"url(#background)\"/>\n"
+		"<text id=\"title\" x=\"{4:.1f}\" y=\"{5}\">{6}</text>\n",
+		options.width, height, font_size, font_size + 5,
+		options.width / 2, font_size * 2, escape_xml(options.title)
+	);
+	if (!options.subtitle.empty()) {
+		stream << std::format(
+			"<text id=\"subtitle\" x=\"{:.1f}\" y=\"{}\">{}</text>\n",
+			options.width / 2, font_size * 4, escape_xml(options.subtitle)
+		);
+	}
+
+	auto draw = [&] (const std::string_view name, const uint64_t weight, const uint32_t depth, const uint64_t start) {
+		const double x = x_pad + start * width_per_weight;
+		const double width = weight * width_per_weight;
+		const double y = height - bottom_pad - (depth + 1) * frame_height + frame_pad;
+		const double percent = total ? 100.0 * weight / total : 0;
+
+		// as many characters as fit, or none if not even three fit
+		std::string label;
+		const size_t fitting = width / (font_size * font_width);
+		if (fitting >= 3)
+			label = name.size() <= fitting ? std::string(name) : std::string(name.substr(0, fitting - 2)) + "..";
+
+		stream << std::format(
+			"<g><title>{} ({} samples, {:.2f}%)</title>"
+			"<rect x=\"{:.1f}\" y=\"{}\" width=\"{:.1f}\" height=\"{}\" fill=\"{}\" rx=\"2\" ry=\"2\"/>"
+			"<text x=\"{:.2f}\" y=\"{:.1f}\">{}</text></g>\n",
+			escape_xml(name), weight, percent,
+			x, y, width, frame_height - frame_pad, hot_color(name),
+			x + 3, y + (frame_height - frame_pad) / 2 + 3, escape_xml(label)
+		);
+	};
+
+	draw("all", total, 0, 0);
+	for (const frame_t & frame : frames)
+		draw(frame_names.name(nodes[frame.node].frame), totals[frame.node], frame.depth, frame.start);
+
+	stream << "</svg>\n";
+	return frames.size() + 1;
+}
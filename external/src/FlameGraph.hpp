@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "FoldedStacks.hpp"
+
+// what flamegraph.pl took as --title, --subtitle, --width and --minwidth.
+// widths are in pixels, frames narrower than minwidth are left out with their callees.
+// interpret names the file in the title if there is none.
+typedef struct flame_graph_options_s {
+	std::string title = "";
+	std::string subtitle = "";
+	double width = 1200;
+	double minwidth = 0.1;
+} flame_graph_options_t;
+
+// the flame graphs the Makefile draws besides the plain one, by the ending before .svg.
+// these set width and minwidth, the plain .svg takes them from the options.
+typedef struct flame_graph_variant_s {
+	std::string_view name;
+	double width;
+	double minwidth;
+} flame_graph_variant_t;
+
+constexpr flame_graph_variant_t flame_graph_variants [] = {
+	{ "fine",      1200, 1 },
+	{ "narrow",     400, 1 },
+	{ "ultrafine", 1200, 0 },
+};
+
+// draws the call tree of FoldedStacks as svg, like flamegraph.pl does for the folded lines:
+// one "all" frame at the bottom, callees above their callers, siblings sorted by name.
+// the weights of the subtrees and the sorted children are worked out once,
+// every svg of the same tree (variants, cpus) only lays out and writes.
+class FlameGraph {
+	const FoldedStacks & folded_stacks;
+	// weight of each node and everything above it
+	std::vector<uint64_t> totals;
+	// the children of node n, sorted by name, are
+	// sorted_children[children_start[n]] up to sorted_children[children_start[n + 1]]
+	std::vector<uint32_t> children_start;
+	std::vector<uint32_t> sorted_children;
+
+	std::span<const uint32_t> children (const uint32_t node) const {
+		return std::span(sorted_children).subspan(
+			children_start[node], children_start[node + 1] - children_start[node]
+		);
+	}
+
+public:
+	FlameGraph (const FoldedStacks & folded_stacks);
+
+	// the whole tree, or the subtree of one cpu. returns how many frames were drawn
+	size_t write (std::ostream & stream, const flame_graph_options_t & options) const;
+	size_t write_cpu (std::ostream & stream, const uint64_t cpu_id, const flame_graph_options_t & options) const;
+	// draws the given nodes side by side on the "all" frame
+	size_t write_nodes (
+		std::ostream & stream,
+		const std::span<const uint32_t> bottom_nodes,
+		const flame_graph_options_t & options
+	) const;
+};
@@ -0,0 +1,115 @@
+#include "FoldedStacks.hpp"
+#include <algorithm>
+#include <mutex>
+
+FrameNames frame_names;
+
+FrameNames::id_t FrameNames::intern (const std::string_view name) {
+	{
+		std::shared_lock guard { lock };
+		const auto found = ids.find(name);
+		if (found != ids.end())
+			return found->second;
+	}
+
+	std::unique_lock guard { lock };
+	// another thread may have added it in between
+	const auto found = ids.find(name);
+	if (found != ids.end())
+		return found->second;
+
+	const id_t id = names.size();
+	const std::string & added = names.emplace_back(name);
+	ids.emplace(added, id);
+	return id;
+}
+
+FoldedStacks::FoldedStacks () : child_slots(1024, no_node) {
+	nodes.push_back({ 0, no_node });
+}
+
+size_t FoldedStacks::child_slot (const uint32_t parent, const FrameNames::id_t frame) const {
+	const size_t mask = child_slots.size() - 1;
+	for (size_t slot = child_hash(parent, frame) & mask; ; slot = (slot + 1) & mask) {
+		const uint32_t node = child_slots[slot];
+		if (node == no_node || (nodes[node].parent == parent && nodes[node].frame == frame))
+			return slot;
+	}
+}
+
+uint32_t FoldedStacks::child (const uint32_t parent, const FrameNames::id_t frame) {
+	size_t slot = child_slot(parent, frame);
+	if (child_slots[slot] != no_node)
+		return child_slots[slot];
+
+	const uint32_t added = nodes.size();
+	nodes.push_back({ frame, parent });
+	child_slots[slot] = added;
+
+	node_t & parent_node = nodes[parent];
+	if (parent_node.last_child == no_node)
+		parent_node.first_child = added;
+	else
+		nodes[parent_node.last_child].next_sibling = added;
+	parent_node.last_child = added;
+
+	// at most half full, every node but the root has a slot
+	if (2 * nodes.size() > child_slots.size()) {
+		child_slots.assign(2 * child_slots.size(), no_node);
+		for (uint32_t node = 1; node < nodes.size(); node++)
+			child_slots[child_slot(nodes[node].parent, nodes[node].frame)] = node;
+	}
+	return added;
+}
+
+void FoldedStacks::add (const uint64_t cpu_id, const folded_stack_t & stack) {
+	uint32_t node = 0;
+	for (size_t i = 0; i < stack.frames.size(); i++) {
+		node = child(node, stack.frames[i]);
+		if (i == 0)
+			first_node_by_cpu.try_emplace(cpu_id, node);
+	}
+	nodes[node].weight += stack.weight;
+	nodes[node].samples ++;
+}
+
+void FoldedStacks::write_subtree (std::ostream & stream, const uint32_t subtree) const {
+	// depth first with an explicit stack, the path is built up in one string
+	std::string path;
+	std::vector<std::pair<uint32_t, size_t>> pending { { subtree, 0 } };
+	while (!pending.empty()) {
+		const auto [node, path_length] = pending.back();
+		pending.pop_back();
+		path.resize(path_length);
+		if (path_length)
+			path += ';';
+		path += frame_names.name(nodes[node].frame);
+
+		if (nodes[node].samples)
+			stream << path << ' ' << nodes[node].weight << '\n';
+
+		// pushed in reverse, so the first child comes out first
+		const size_t children_start = pending.size();
+		for (uint32_t c = nodes[node].first_child; c != no_node; c = nodes[c].next_sibling)
+			pending.emplace_back(c, path.size());
+		std::reverse(pending.begin() + children_start, pending.end());
+	}
+}
+
+void FoldedStacks::write (std::ostream & stream) const {
+	for (uint32_t c = nodes[0].first_child; c != no_node; c = nodes[c].next_sibling)
+		write_subtree(stream, c);
+}
+
+void FoldedStacks::write_cpu (std::ostream & stream, const uint64_t cpu_id) const {
+	const auto found = first_node_by_cpu.find(cpu_id);
+	if (found != first_node_by_cpu.end())
+		write_subtree(stream, found->second);
+}
+
+size_t FoldedStacks::unique_stacks () const {
+	size_t count = 0;
+	for (const node_t & node : nodes)
+		count += node.samples != 0;
+	return count;
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <ostream>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// every frame label of the folded stacks once, for the whole process.
+// the threads of interpret -j intern labels, so lookups take the lock shared
+// and only new labels take it exclusively.
+class FrameNames {
+public:
+	using id_t = uint32_t;
+
+private:
+	// a deque, so the views in ids stay where they are
+	std::deque<std::string> names;
+	std::unordered_map<std::string_view, id_t> ids;
+	mutable std::shared_mutex lock;
+
+public:
+	id_t intern (const std::string_view name);
+
+	const std::string & name (const id_t id) const {
+		std::shared_lock guard { lock };
+		return names[id];
+	}
+};
+
+extern FrameNames frame_names;
+
+// one BTE_STACK sample for the folded output: frame ids from the outermost frame in,
+// with the cpu as first frame if the output is per cpu.
+typedef struct folded_stack_s {
+	std::vector<FrameNames::id_t> frames;
+	uint64_t weight;
+} folded_stack_t;
+
+// the folded stacks of a trace as a call tree: each unique stack is one path,
+// with the sum of the weights and the number of samples that ended there.
+// written out, each unique stack is one line, in call-tree (depth-first) order: a stack comes
+// before the longer stacks that start with it, siblings in the order they were first seen.
+// for A;B, C, A;D that is A;B, A;D, C.
+class FoldedStacks {
+public:
+	static constexpr uint32_t no_node = UINT32_MAX;
+
+	typedef struct node_s {
+		FrameNames::id_t frame;
+		uint32_t parent;
+		uint32_t first_child = no_node;
+		uint32_t last_child  = no_node;
+		uint32_t next_sibling = no_node;
+		// of the samples that ended in this frame
+		uint64_t weight = 0;
+		uint64_t samples = 0;
+	} node_t;
+
+private:
+	// nodes[0] is the root, it has no frame
+	std::vector<node_t> nodes;
+	// open addressing by (parent, frame), the slots hold the child's node, no_node if empty.
+	// a node knows its parent and frame, so the slots need nothing else.
+	std::vector<uint32_t> child_slots;
+	// the node of the first frame of the stacks of each cpu, for the per cpu files.
+	// that is the cpu frame, the stacks of different cpus only share nodes without it.
+	std::map<uint64_t, uint32_t> first_node_by_cpu;
+
+	static size_t child_hash (const uint32_t parent, const FrameNames::id_t frame) {
+		uint64_t key = static_cast<uint64_t>(parent) << 32 | frame;
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccd;
+		key ^= key >> 33;
+		return key;
+	}
+	// the slot of (parent, frame), or the empty slot where it belongs
+	size_t child_slot (const uint32_t parent, const FrameNames::id_t frame) const;
+	uint32_t child (const uint32_t parent, const FrameNames::id_t frame);
+
+public:
+	FoldedStacks ();
+
+	void add (const uint64_t cpu_id, const folded_stack_t & stack);
+
+	// all stacks, or those of one cpu
+	void write (std::ostream & stream) const;
+	void write_cpu (std::ostream & stream, const uint64_t cpu_id) const;
+	void write_subtree (std::ostream & stream, const uint32_t node) const;
+
+	std::span<const node_t> all_nodes () const {
+		return nodes;
+	}
+	const std::map<uint64_t, uint32_t> & cpu_nodes () const {
+		return first_node_by_cpu;
+	}
+	size_t unique_stacks () const;
+};
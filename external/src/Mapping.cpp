@@ -1,12 +1,15 @@
 #include <iostream>
 #include <format>
+#include <utility>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "Entry.hpp"
 #include "Mapping.hpp"
 
-Mapping::Mapping (const Entry & entry) : lifetime(Range<>::open_end(0)) {
+std::string Mapping::name_from_payload (const std::span<const uint64_t> payload) {
 	// read the unsigned ints of the raw data as a character array
-	const std::vector<unsigned long> & payload = entry.get_payload();
 	const char * name_chars = reinterpret_cast<const char *>(payload.data());
 	assert_attribute_name(
 		name_chars,
@@ -15,17 +18,22 @@ Mapping::Mapping (const Entry & entry) : lifetime(Range<>::open_end(0)) {
 		0,
 		&is_mapping_name_char
 	);
-	name = std::string(name_chars);
+	std::string name { name_chars };
 
 	if (name.find('/') == std::string::npos)
 		name = "rom/" + name;
+	return name;
+}
+
+Mapping::Mapping (const Entry & entry) : lifetime(Range<>::open_end(0)) {
+	name = name_from_payload(entry.get_payload());
 
-	base = entry.attribute("mapping_base");
-	task_id = entry.attribute("mapping_task_id");
+	base = entry.attribute(BTA_MAPPING_BASE);
+	task_id = entry.attribute(BTA_MAPPING_TASK_ID);
 
 	// TODO: implement dlclose entry types and respect here
 	lifetime = Range<>::open_end(
-		entry.attribute("tsc_time")
+		entry.attribute(BTA_TSC_TIME)
 	);
 
 	// dbg();
@@ -61,11 +69,19 @@ bool Mappings::has_mapping (unsigned long task_id, const std::string & name) con
 	return std::find(binaries.begin(), binaries.end(), name) != binaries.end();
 }
 
+static void add_lifetime_boundaries (std::vector<unsigned long> & boundaries, const Range<> & lifetime) {
+	boundaries.insert(std::upper_bound(boundaries.begin(), boundaries.end(), lifetime.start()), lifetime.start());
+	if (lifetime.stop() != Range<>::max_stop())
+		boundaries.insert(std::upper_bound(boundaries.begin(), boundaries.end(), lifetime.stop()), lifetime.stop());
+}
+
 void Mappings::append (const Entry & entry) {
 	super().emplace_back(entry);
 	Mapping & mapping = self().at(super().size() - 1);
 	by_task_and_binary[std::make_pair(mapping.name, mapping.task_id)] = super().size() - 1;
 	binaries_by_task[mapping.task_id].emplace_back(mapping.name);
+	add_lifetime_boundaries(lifetime_boundaries_by_task[mapping.task_id], mapping.lifetime);
+	generation ++;
 
 	if (!has_mapping(mapping.task_id, "KERNEL")) {
 		add_kernel_mapping(mapping.task_id);
@@ -76,13 +92,15 @@ void Mappings::add_kernel_mapping (const unsigned long task_id) {
 	Mapping & mapping = super().emplace_back("KERNEL", 0, task_id, Range<>::open_end(0));
 	by_task_and_binary[std::make_pair(mapping.name, mapping.task_id)] = super().size() - 1;
 	binaries_by_task[mapping.task_id].emplace_back(mapping.name);
+	add_lifetime_boundaries(lifetime_boundaries_by_task[mapping.task_id], mapping.lifetime);
+	generation ++;
 }
 
-std::string Mappings::task_binaries (unsigned long task_id) {
+std::string Mappings::task_binaries (unsigned long task_id) const {
 	if (!binaries_by_task.contains(task_id)) {
 		return "<task " + std::to_string(task_id) + " has no binaries>";
 	}
-	std::vector<std::string> & binaries = binaries_by_task.at(task_id);
+	const std::vector<std::string> & binaries = binaries_by_task.at(task_id);
 	std::string result = "";
 	for (int i = 0; i < binaries.size() - 1; i++) {
 		result += binaries[i] + ", ";
@@ -95,20 +113,129 @@ std::string Mappings::task_binaries (unsigned long task_id) {
 	return result;
 }
 
-std::string Mappings::lookup_symbol (
+size_t Mappings::epoch (unsigned long task_id, unsigned long time_in_ns) const {
+	if (!lifetime_boundaries_by_task.contains(task_id))
+		return 0;
+	const std::vector<unsigned long> & boundaries = lifetime_boundaries_by_task.at(task_id);
+	return std::upper_bound(boundaries.begin(), boundaries.end(), time_in_ns) - boundaries.begin();
+}
+
+typedef struct symbol_cache_key_s {
+	unsigned long task_id;
+	unsigned long virtual_address;
+	size_t epoch;
+
+	bool operator== (const struct symbol_cache_key_s & other) const = default;
+} symbol_cache_key_t;
+
+struct symbol_cache_key_hash {
+	size_t operator() (const symbol_cache_key_t & key) const {
+		size_t hash = std::hash<unsigned long>{}(key.virtual_address);
+		hash ^= std::hash<unsigned long>{}(key.task_id) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+		hash ^= std::hash<size_t>{}(key.epoch)          + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+		return hash;
+	}
+};
+
+// counts of the threads whose caches are gone
+static std::atomic<uint64_t> symbol_cache_hits_of_ended_threads = 0;
+static std::atomic<uint64_t> symbol_cache_misses_of_ended_threads = 0;
+
+// one per thread, so the threads of interpret -j don't have to lock
+class SymbolCache {
+public:
+	const Mappings * mappings = nullptr;
+	uint64_t generation = 0;
+	typedef struct cached_s {
+		std::string_view label;
+		// interned in frame_names on the first lookup_frame
+		FrameNames::id_t frame = no_frame;
+	} cached_t;
+	static constexpr FrameNames::id_t no_frame = UINT32_MAX;
+
+	std::unordered_map<symbol_cache_key_t, cached_t, symbol_cache_key_hash> labels_by_key;
+	// every label once, the string_views point in here. the nodes of a set don't move.
+	std::unordered_set<std::string> labels;
+
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+
+	~SymbolCache () {
+		symbol_cache_hits_of_ended_threads   += hits;
+		symbol_cache_misses_of_ended_threads += misses;
+	}
+};
+static thread_local SymbolCache symbol_cache;
+
+static SymbolCache::cached_t & cached_symbol (
+	const Mappings & mappings,
 	unsigned long task_id,
 	unsigned long virtual_address,
 	unsigned long time_in_ns
 ) {
+	SymbolCache & cache = symbol_cache;
+	if (cache.mappings != &mappings || cache.generation != mappings.generation) {
+		cache.labels_by_key.clear();
+		cache.labels.clear();
+		cache.mappings = &mappings;
+		cache.generation = mappings.generation;
+	}
+
+	const symbol_cache_key_t key { task_id, virtual_address, mappings.epoch(task_id, time_in_ns) };
+	const auto found = cache.labels_by_key.find(key);
+	if (found != cache.labels_by_key.end()) {
+		cache.hits ++;
+		return found->second;
+	}
+
+	cache.misses ++;
+	const std::string & label = *cache.labels.insert(mappings.find_label(task_id, virtual_address, time_in_ns)).first;
+	return cache.labels_by_key.emplace(key, SymbolCache::cached_t { label }).first->second;
+}
+
+std::string_view Mappings::lookup_symbol (
+	unsigned long task_id,
+	unsigned long virtual_address,
+	unsigned long time_in_ns
+) const {
+	return cached_symbol(*this, task_id, virtual_address, time_in_ns).label;
+}
+
+FrameNames::id_t Mappings::lookup_frame (
+	unsigned long task_id,
+	unsigned long virtual_address,
+	unsigned long time_in_ns
+) const {
+	SymbolCache::cached_t & cached = cached_symbol(*this, task_id, virtual_address, time_in_ns);
+	if (cached.frame == SymbolCache::no_frame)
+		cached.frame = frame_names.intern(cached.label);
+	return cached.frame;
+}
+
+Mappings::symbol_cache_statistics_t Mappings::symbol_cache_statistics () const {
+	return {
+		symbol_cache_hits_of_ended_threads   + symbol_cache.hits,
+		symbol_cache_misses_of_ended_threads + symbol_cache.misses,
+	};
+}
+
+std::string Mappings::find_label (
+	unsigned long task_id,
+	unsigned long virtual_address,
+	unsigned long time_in_ns
+) const {
+	// only reads, so interpret can look up symbols from several threads
 	std::optional<Symbol> result;
-	for (const auto & binary : binaries_by_task[task_id]) {
-		unsigned int mapping_index = by_task_and_binary[std::make_pair(binary, task_id)];
-		const Mapping & mapping = super()[mapping_index];
-		if (mapping_index >= super().size()) {
+	if (!binaries_by_task.contains(task_id))
+		return std::format("{:x}/{:016x}", task_id, virtual_address);
+	for (const auto & binary : binaries_by_task.at(task_id)) {
+		const auto found_mapping = by_task_and_binary.find(std::make_pair(binary, task_id));
+		if (found_mapping == by_task_and_binary.end() || found_mapping->second >= super().size()) {
 			throw std::runtime_error(
 				"mapping of '" + binary + "', task " + std::to_string(task_id) + " is invalid?"
 			);
 		}
+		const Mapping & mapping = super()[found_mapping->second];
 		if (!binary_symbols.contains(binary)) {
 			throw std::runtime_error(
 				"binary_symbols has no entry for '" + binary + "', "
@@ -116,7 +243,7 @@ std::string Mappings::lookup_symbol (
 			);
 		}
 
-		SymbolTable & symbol_table = binary_symbols.at(binary);
+		const SymbolTable & symbol_table = std::as_const(binary_symbols).at(binary);
 		std::optional<Symbol> looked_up = mapping.find_symbol(symbol_table, virtual_address, time_in_ns);
 		if (!looked_up)
 			continue;
@@ -124,7 +251,7 @@ std::string Mappings::lookup_symbol (
 		if (result) {
 			throw std::runtime_error(std::format(
 				"both '{}' and '{}' map {:16x} ({} and {})",
-				result->binary, binary, virtual_address,
+				result->binary(), binary, virtual_address,
 				result->label(), looked_up->label()
 			));
 		}
@@ -6,6 +6,7 @@
 #include <memory>
 #include <format>
 #include <regex>
+#include <string_view>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <fcntl.h>
@@ -13,6 +14,7 @@
 #include "map_with_errors.hpp"
 #include "Entry.hpp"
 #include "SymbolTable.hpp"
+#include "FoldedStacks.hpp"
 
 class Mapping {
 public:
@@ -40,6 +42,9 @@ public:
 
 	Mapping (const Entry & entry);
 
+	// the binary name in the payload of a BTE_MAPPING, as binaries.list has it
+	static std::string name_from_payload (const std::span<const uint64_t> payload);
+
 	std::optional<Symbol> find_symbol (
 		const SymbolTable & symbol_table,
 		unsigned long virtual_address,
@@ -59,6 +64,16 @@ public:
 	Mappings ();
 	map_with_errors<std::pair<std::string, unsigned long>, unsigned int> by_task_and_binary;
 	map_with_errors<unsigned long, std::vector<std::string>> binaries_by_task;
+	// sorted starts and stops of the lifetimes of each task's mappings.
+	// between two of them (in one epoch), an address always looks up the same symbol.
+	map_with_errors<unsigned long, std::vector<unsigned long>> lifetime_boundaries_by_task;
+	// counts appended mappings, the symbol caches are dropped when it changes
+	uint64_t generation = 0;
+
+	typedef struct symbol_cache_statistics_s {
+		uint64_t hits;
+		uint64_t misses;
+	} symbol_cache_statistics_t;
 
 	bool has_mapping (unsigned long task_id, const std::string & name) const;
 
@@ -66,13 +81,34 @@ public:
 
 	void add_kernel_mapping (const unsigned long task_id);
 
-	std::string task_binaries (unsigned long task_id);
+	std::string task_binaries (unsigned long task_id) const;
+
+	size_t epoch (unsigned long task_id, unsigned long time_in_ns) const;
+
+	// without the cache
+	std::string find_label (
+		unsigned long task_id,
+		unsigned long virtual_address,
+		unsigned long time_in_ns
+	) const;
 
-	std::string lookup_symbol (
+	// cached per thread by task, address and epoch. the label is interned in the cache,
+	// it stays valid until the thread ends or a mapping is appended.
+	std::string_view lookup_symbol (
 		unsigned long task_id,
 		unsigned long virtual_address,
 		unsigned long time_in_ns
-	);
+	) const;
+
+	// the same, as the id of the label in frame_names
+	FrameNames::id_t lookup_frame (
+		unsigned long task_id,
+		unsigned long virtual_address,
+		unsigned long time_in_ns
+	) const;
+
+	// of all threads that ended, and the calling one
+	symbol_cache_statistics_t symbol_cache_statistics () const;
 
 	void dbg () const;
 };
@@ -0,0 +1,154 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include "SectionDecoder.hpp"
+
+static std::vector<uint64_t> decode_raw_words (std::span<const uint8_t> data) {
+	if (data.size() % sizeof(uint64_t) != 0) {
+		printf("data is supposedly not compressed, but length is not multiple of word length??\n");
+		exit(1);
+	}
+
+	const uint64_t * words = reinterpret_cast<const uint64_t *> (data.data());
+	return std::vector<uint64_t> (words, words + data.size() / sizeof(uint64_t));
+}
+
+// returns false if the dictionary delta does not fit the dictionary of the previous section
+static bool decode_dictionary_words (
+	decoder_state_t                 & state,
+	const compression_header_t      * header,
+	std::span<const uint64_t> const & dictionary,
+	std::span<const uint8_t>  const & data,
+	std::vector<uint64_t>           & words
+) {
+	const unsigned long flags = compression_header_get_flags(header);
+	if (!(flags & compression_flag_dictionary_delta)) {
+		state.current_dictionary.assign(dictionary.begin(), dictionary.end());
+		state.current_dictionary.resize(dictionary_capacity, 0);
+	} else if (!apply_dictionary_delta(state.current_dictionary, dictionary)) {
+		state.current_dictionary.clear();
+		return false;
+	}
+
+	if (flags & compression_flag_entropy) {
+		std::vector<uint8_t> entropy_decoded = entropy_decode(data);
+		words = decompress(std::span { entropy_decoded }, std::span { state.current_dictionary });
+	} else {
+		words = decompress(data, std::span { state.current_dictionary });
+	}
+	return true;
+}
+
+bool decode_section (
+	decoder_state_t                 & state,
+	const compression_header_t      * header,
+	std::span<const uint64_t> const & dictionary,
+	std::span<const uint8_t>  const & data,
+	std::vector<uint64_t>           & words
+) {
+	const unsigned long encoder = compression_header_get_encoder(header);
+	switch (encoder) {
+	case section_encoder_raw:
+		words = decode_raw_words(data);
+		return true;
+	case section_encoder_dictionary:
+		return decode_dictionary_words(state, header, dictionary, data, words);
+	case section_encoder_stack_delta:
+		words = stack_delta_decode(decode_raw_words(data));
+		return true;
+	case section_encoder_stack_delta_dictionary: {
+		std::vector<uint64_t> delta_words;
+		if (!decode_dictionary_words(state, header, dictionary, data, delta_words))
+			return false;
+		words = stack_delta_decode(delta_words);
+		return true;
+	}
+	default:
+		printf(
+			"section encoder %ld (header version %ld) is unknown, is this decompress older than the backtracer?\n",
+			encoder, compression_header_get_version(header)
+		);
+		exit(1);
+	}
+}
+
+bool is_uncompressed (std::span<const uint64_t> words) {
+	return (
+		words.size() >= 4
+		&& (
+			words[0] == 0x1 || // BTE_STACK
+			words[0] == 0x2 || // BTE_MAPPING
+			words[0] == 0x4 || // BTE_CONTROL
+			words[0] == 0x8 || // BTE_INFO
+			words[0] == 0x10   // BTE_STATS
+		)
+		&& (8 <= words[1] && words[1] <= 100) // Entry length
+		&& (words[2] > 0x10000)
+	);
+}
+
+void SectionDecoder::add (std::span<const uint64_t> words, std::vector<uint64_t> & output) {
+	if (format == uncompressed) {
+		output.insert(output.end(), words.begin(), words.end());
+		return;
+	}
+	pending.insert(pending.end(), words.begin(), words.end());
+
+	if (format == undecided) {
+		if (pending.size() < 4)
+			return;
+		if (is_uncompressed(pending)) {
+			fprintf(stderr, "WARNING: the data starts with a Backtrace Buffer Entry, not a compression header. it is not compressed.\n");
+			format = uncompressed;
+			output.insert(output.end(), pending.begin(), pending.end());
+			pending.clear();
+			return;
+		}
+		format = compressed;
+	}
+
+	// the sections that are complete, as decompress walks them
+	size_t start = 0;
+	while (pending.size() - start >= compression_header_words) {
+		const compression_header_t * header = reinterpret_cast<const compression_header_t *>(&pending[start]);
+		const size_t dictionary_length_in_words = header->dictionary_length;
+		const size_t compressed_length_in_bytes = header->data_length_in_bytes;
+		const size_t compressed_words = (compressed_length_in_bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+		const size_t section_words = compression_header_words + dictionary_length_in_words + compressed_words;
+		if (pending.size() - start < section_words)
+			break;
+
+		const uint64_t * dictionary_raw = &pending[start] + header->dictionary_offset;
+		const uint64_t * compressed_raw = dictionary_raw + dictionary_length_in_words;
+		if (compressed_raw + compressed_words > pending.data() + pending.size()) {
+			printf("section %ld (dictionary or data) overflows its length!\n", section_counter);
+			exit(1);
+		}
+		const std::span dictionary { dictionary_raw, dictionary_length_in_words };
+		const std::span compressed { reinterpret_cast<const uint8_t*>(compressed_raw), compressed_length_in_bytes };
+
+		std::vector<uint64_t> decompressed;
+		if (!decode_section(state, header, dictionary, compressed, decompressed)) {
+			fprintf(stderr,
+				"WARNING: section %ld only has a dictionary delta, "
+				"but not against the dictionary of the previous section. skipping it.\n",
+				section_counter
+			);
+		}
+		output.insert(output.end(), decompressed.begin(), decompressed.end());
+
+		start += section_words;
+		section_counter ++;
+	}
+	pending.erase(pending.begin(), pending.begin() + start);
+}
+
+void SectionDecoder::finish () {
+	if (!pending.empty()) {
+		fprintf(stderr,
+			"WARNING: the data ends in an incomplete section (%ld words), after %ld sections. dropping it.\n",
+			pending.size(), section_counter
+		);
+		pending.clear();
+	}
+}
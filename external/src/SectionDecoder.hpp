@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "compress.hpp"
+
+// what decoding a section may need from the sections before it
+typedef struct decoder_state_s {
+	// sections with compression_flag_dictionary_delta change the dictionary of the previous one
+	std::vector<uint64_t> current_dictionary;
+} decoder_state_t;
+
+// dispatches on the encoder compress_smart chose for the section.
+// returns false if the section can't be decoded without a missing section before it.
+bool decode_section (
+	decoder_state_t                 & state,
+	const compression_header_t      * header,
+	std::span<const uint64_t> const & dictionary,
+	std::span<const uint8_t>  const & data,
+	std::vector<uint64_t>           & words
+);
+
+// true if the words start with a backtrace buffer entry instead of a compression header,
+// then the data was not compressed
+bool is_uncompressed (std::span<const uint64_t> words);
+
+static constexpr size_t compression_header_words = (sizeof(compression_header_t) - 1) / sizeof(uint64_t) + 1;
+
+// decodes the sections of a .compressed stream as its words arrive, like decompress does with the whole file
+class SectionDecoder {
+	decoder_state_t state;
+	// the start of the next section, until it is complete
+	std::vector<uint64_t> pending;
+	enum { undecided, compressed, uncompressed } format = undecided;
+	size_t section_counter = 0;
+
+public:
+	// appends what the words complete to output
+	void add (std::span<const uint64_t> words, std::vector<uint64_t> & output);
+	// after the last words, the rest can only be an incomplete section, which is dropped
+	void finish ();
+
+	size_t sections () const {
+		return section_counter;
+	}
+};
@@ -1,17 +1,60 @@
 #include "SymbolTable.hpp"
+#include <algorithm>
+#include <chrono>
 #include <format>
+#include <fstream>
+#include "mmap_file.hpp"
+
+SymbolNames symbol_names;
+
+SymbolNames::id_t SymbolNames::intern (const std::string_view name) {
+	std::unique_lock guard { lock };
+	const auto found = ids.find(name);
+	if (found != ids.end())
+		return found->second;
+
+	const id_t id = names.size();
+	name_t & added = names.emplace_back();
+	added.mangled = name;
+	ids.emplace(added.mangled, id);
+	return id;
+}
+
+const std::string & SymbolNames::demangled (const id_t id) {
+	name_t & name = [&] () -> name_t & {
+		std::shared_lock guard { lock };
+		return names[id];
+	} ();
+	requests ++;
+	std::call_once(name.demangled_once, [&] () {
+		const auto start = std::chrono::steady_clock::now();
+		name.demangled = demangle(name.mangled);
+		const auto stop  = std::chrono::steady_clock::now();
+		demangled_count ++;
+		ns_demangling += std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count();
+	});
+	return name.demangled;
+}
 
 const std::string Symbol::file_line_regex_string { "([^\t]+)\t([0-9a-f]{16})\t([0-9a-f]{16})\t(.+)" };
 const std::regex  Symbol::file_line_regex { Symbol::file_line_regex_string };
 
-bool Symbol::starts_in_page(const size_t page_address) const {
-	return instruction_addresses.rounded(0x1000).start() == page_address;
+symbol_source_t symbol_source_t::of_file (const std::filesystem::path & elf_filename) {
+	std::error_code error;
+	const uint64_t size = std::filesystem::file_size(elf_filename, error);
+	if (error)
+		return {};
+	const auto mtime = std::filesystem::last_write_time(elf_filename, error);
+	if (error)
+		return {};
+	return { size, static_cast<uint64_t>(mtime.time_since_epoch().count()) };
 }
 
 SymbolTable::SymbolTable (
 	const std::string & binary,
-	const ELFIO::elfio & reader
-) : binary(binary) {
+	const ELFIO::elfio & reader,
+	const symbol_source_t & source
+) : binary(binary), source(source) {
 	using namespace ELFIO;
 
 	// ELF file sections info
@@ -37,10 +80,15 @@ SymbolTable::SymbolTable (
 					type, section_index, other
 				);
 
-				// symbols with length 0 are currently not used by our consumers
-				// despite the facte that e.g. interrupt handlers of fiasco have length 0
-				// and maybe should get a default length so they can be shown
-				if (size == 0)
+				// symbols with length 0, like the interrupt handlers of fiasco,
+				// are found for the addresses behind them if no other symbol has them.
+				// only code labels though, not undefined or absolute ones or sections and files.
+				if (size == 0 && (
+					name.empty()
+					|| (type != STT_FUNC && type != STT_NOTYPE)
+					|| section_index == SHN_UNDEF
+					|| section_index >= SHN_LORESERVE
+				))
 					continue;
 
 				const Range instruction_addresses { value, size };
@@ -48,17 +96,140 @@ SymbolTable::SymbolTable (
 			}
 		}
 	}
+	build_index();
 }
 void SymbolTable::insert_symbol (
 	const Symbol & symbol
 ) {
-	const Range pages = symbol.instruction_addresses.rounded(0x1000);
+	inserted.push_back(symbol);
+}
+
+void SymbolTable::build_index () {
+	const size_t count = inserted.size();
+	std::vector<uint32_t> order (count);
+	for (uint32_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&] (uint32_t a, uint32_t b) {
+		return inserted[a].instruction_addresses.start() < inserted[b].instruction_addresses.start();
+	});
+
+	std::string names = binary;
+	std::vector<uint64_t> offsets;
+	offsets.reserve(count + 1);
+	for (const uint32_t i : order) {
+		offsets.push_back(names.size());
+		names += inserted[i].name();
+	}
+	offsets.push_back(names.size());
+
+	const size_t blob_words = (names.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	image.assign(SYMT_HEADER_WORDS + 4 * count + (count + 1) + blob_words, 0);
+	image[SYMT_MAGIC]         = symt_magic;
+	image[SYMT_VERSION]       = symt_version;
+	image[SYMT_SYMBOL_COUNT]  = count;
+	image[SYMT_BLOB_BYTES]    = names.size();
+	image[SYMT_BINARY_BYTES]  = binary.size();
+	image[SYMT_SOURCE_SIZE]   = source.size;
+	image[SYMT_SOURCE_MTIME]  = source.mtime;
+
+	uint64_t * starts_out     = image.data() + SYMT_HEADER_WORDS;
+	uint64_t * ends_out       = starts_out   + count;
+	uint64_t * max_ends_out   = ends_out     + count;
+	uint64_t * read_order_out = max_ends_out + count;
+	uint64_t * offsets_out    = read_order_out + count;
+	for (size_t i = 0; i < count; i++) {
+		const Symbol & symbol = inserted[order[i]];
+		starts_out[i]     = symbol.instruction_addresses.start();
+		ends_out[i]       = symbol.instruction_addresses.stop();
+		max_ends_out[i]   = i ? std::max(max_ends_out[i - 1], ends_out[i]) : ends_out[i];
+		read_order_out[i] = order[i];
+	}
+	std::copy(offsets.begin(), offsets.end(), offsets_out);
+	std::copy(names.begin(), names.end(), reinterpret_cast<char *>(offsets_out + count + 1));
+
+	inserted.clear();
+	inserted.shrink_to_fit();
+	use_image(image, binary);
+}
+
+void SymbolTable::use_image (const std::span<const uint64_t> words, const std::string & origin) {
+	if (words.size() < SYMT_HEADER_WORDS || words[SYMT_MAGIC] != symt_magic) {
+		throw std::runtime_error(std::format(
+			"symbol table '{}' is not in the binary .symt format.", origin
+		));
+	}
+	if (words[SYMT_VERSION] != symt_version) {
+		throw std::runtime_error(std::format(
+			"symbol table '{}' has version {}, only version {} can be read.",
+			origin, words[SYMT_VERSION], symt_version
+		));
+	}
 
-	for (const auto & page : pages) {
-		super()[page].push_back(symbol);
+	const size_t count = words[SYMT_SYMBOL_COUNT];
+	const size_t blob_bytes = words[SYMT_BLOB_BYTES];
+	const size_t array_words = SYMT_HEADER_WORDS + 4 * count + (count + 1);
+	if (
+		count > words.size() || array_words > words.size()
+		|| blob_bytes > (words.size() - array_words) * sizeof(uint64_t)
+		|| words[SYMT_BINARY_BYTES] > blob_bytes
+	) {
+		throw std::runtime_error(std::format(
+			"symbol table '{}' is truncated: {} symbols and {} bytes of names do not fit in {} words.",
+			origin, count, blob_bytes, words.size()
+		));
 	}
+
+	starts       = words.subspan(SYMT_HEADER_WORDS, count);
+	ends         = words.subspan(SYMT_HEADER_WORDS + count, count);
+	max_ends     = words.subspan(SYMT_HEADER_WORDS + 2 * count, count);
+	read_order   = words.subspan(SYMT_HEADER_WORDS + 3 * count, count);
+	name_offsets = words.subspan(SYMT_HEADER_WORDS + 4 * count, count + 1);
+	blob = std::string_view { reinterpret_cast<const char *>(words.data() + array_words), blob_bytes };
+	source = { words[SYMT_SOURCE_SIZE], words[SYMT_SOURCE_MTIME] };
+
+	binary = blob.substr(0, words[SYMT_BINARY_BYTES]);
+	binary_id = symbol_names.intern(binary);
+	name_ids.resize(count);
+	for (size_t i = 0; i < count; i++) {
+		if (name_offsets[i] > name_offsets[i + 1] || name_offsets[i + 1] > blob_bytes) {
+			throw std::runtime_error(std::format(
+				"symbol table '{}' has a broken name offset for symbol {}.", origin, i
+			));
+		}
+		name_ids[i] = symbol_names.intern(blob.substr(name_offsets[i], name_offsets[i + 1] - name_offsets[i]));
+	}
+}
+
+ssize_t SymbolTable::last_starting_at_or_before (const uint64_t address) const {
+	if (starts.empty() || address < starts[0])
+		return -1;
+
+	// the range [base, base + length) always has starts[base] <= address,
+	// the halving compiles to a conditional move instead of a branch
+	const uint64_t * base = starts.data();
+	size_t length = starts.size();
+	while (length > 1) {
+		const size_t half = length / 2;
+		base = (base[half] <= address) ? base + half : base;
+		length -= half;
+	}
+	return base - starts.data();
+}
+bool SymbolTable::is_binary_file (const std::filesystem::path & symbol_table_filename) {
+	std::ifstream file { symbol_table_filename, std::ios::binary };
+	uint64_t magic = 0;
+	file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+	return file.good() && magic == symt_magic;
 }
+
 SymbolTable::SymbolTable (const std::string & symbol_table_filename) {
+	if (is_binary_file(symbol_table_filename)) {
+		// the file stays mapped for as long as the process runs, like the trace buffer
+		use_image(mmap_file(symbol_table_filename), symbol_table_filename);
+		return;
+	}
+
+	// the text format of older versions, one "binary\tstart\tend\tname" line per symbol
 	std::ifstream file { symbol_table_filename };
 	std::array<char, 4096> buf;
 	while (!file.eof()) {
@@ -67,28 +238,56 @@ SymbolTable::SymbolTable (const std::string & symbol_table_filename) {
 		if (line.size())
 			insert_symbol(Symbol::from_file_line(line));
 	}
+	if (inserted.size())
+		binary = inserted.front().binary();
+	build_index();
 }
 
 void SymbolTable::export_to_file (const std::filesystem::path & symbol_table_filename) const {
-	std::filesystem::create_directories(symbol_table_filename.parent_path());
-	std::ofstream file { symbol_table_filename };
-	for (const auto & [page_address, page] : super()) {
-		for (const auto & symbol : page) {
-			if (!symbol.starts_in_page(page_address))
-				continue;
-
-			file << symbol.to_file_line() << "\n";
+	if (symbol_table_filename.has_parent_path())
+		std::filesystem::create_directories(symbol_table_filename.parent_path());
+
+	// the header, arrays and blob are contiguous in image, or in the mmap'ed file
+	const uint64_t * first = starts.data() - SYMT_HEADER_WORDS;
+	const size_t words = SYMT_HEADER_WORDS + 4 * size() + (size() + 1)
+		+ (blob.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+	// written next to it and renamed, so a reader never maps a half written file
+	std::filesystem::path temporary = symbol_table_filename;
+	temporary += ".tmp";
+	{
+		std::ofstream file { temporary, std::ios::binary | std::ios::trunc };
+		file.write(reinterpret_cast<const char *>(first), words * sizeof(uint64_t));
+		if (!file.good()) {
+			throw std::runtime_error(std::format(
+				"could not write symbol table to '{}'.", std::string(temporary)
+			));
 		}
 	}
+	std::filesystem::rename(temporary, symbol_table_filename);
 }
 
 std::optional<Symbol> SymbolTable::find_symbol (const uint64_t instruction_pointer) const {
-	uint64_t page_address = (instruction_pointer / 0x1000) * 0x1000;
-
-	if (!super().contains(page_address))
+	const ssize_t last = last_starting_at_or_before(instruction_pointer);
+	if (last < 0)
 		return std::optional<Symbol> ();
 
-	const SymbolPage & symbol_page = super().at(page_address);
-	return symbol_page.find_symbol(instruction_pointer);
-}
+	// symbols before last may be long enough to contain the address, too
+	ssize_t found = -1;
+	for (ssize_t i = last; i >= 0 && max_ends[i] > instruction_pointer; i--) {
+		if (ends[i] > instruction_pointer && (found < 0 || read_order[i] < read_order[found]))
+			found = i;
+	}
+	if (found >= 0)
+		return symbol_at(found);
 
+	// nothing contains it, but it may be behind a symbol of size 0.
+	// of those starting at the same address, take the one read first.
+	ssize_t nearest = last;
+	while (nearest > 0 && starts[nearest - 1] == starts[last])
+		nearest --;
+	for (ssize_t i = nearest; i <= last; i++)
+		if (starts[i] == ends[i])
+			return symbol_at(i);
+	return std::optional<Symbol> ();
+}
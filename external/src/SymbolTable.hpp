@@ -1,17 +1,73 @@
 #pragma once
+#include <atomic>
+#include <deque>
 #include <filesystem>
+#include <mutex>
 #include <optional>
 #include <regex>
+#include <shared_mutex>
+#include <span>
+#include <string_view>
+#include <unordered_map>
 
 #include "map_with_errors.hpp"
 #include "elfi.hpp"
 #include "Range.hpp"
 
-class SymbolPage;
+// every symbol and binary name once, for the whole process.
+// the demangled form of a name is made on first use, and only once.
+// names are interned while the symbol tables are read, which may happen on several threads,
+// so interning takes the lock exclusively and reading a name takes it shared.
+class SymbolNames {
+public:
+	using id_t = uint32_t;
+
+	typedef struct demangle_statistics_s {
+		uint64_t requests;
+		uint64_t demangled;
+		uint64_t ns_demangling;
+	} demangle_statistics_t;
+
+private:
+	typedef struct name_s {
+		std::string mangled;
+		std::string demangled;
+		std::once_flag demangled_once;
+	} name_t;
+
+	// a deque, so the views in ids and the once_flags stay where they are
+	std::deque<name_t> names;
+	std::unordered_map<std::string_view, id_t> ids;
+	mutable std::shared_mutex lock;
+
+	std::atomic<uint64_t> requests = 0;
+	std::atomic<uint64_t> demangled_count = 0;
+	std::atomic<uint64_t> ns_demangling = 0;
+
+public:
+	id_t intern (const std::string_view name);
+
+	const std::string & mangled (const id_t id) const {
+		std::shared_lock guard { lock };
+		return names[id].mangled;
+	}
+	const std::string & demangled (const id_t id);
+
+	size_t size () const {
+		std::shared_lock guard { lock };
+		return names.size();
+	}
+	demangle_statistics_t demangle_statistics () const {
+		return { requests, demangled_count, ns_demangling };
+	}
+};
+
+extern SymbolNames symbol_names;
+
 class Symbol {
 public:
-	std::string name;
-	std::string binary;
+	SymbolNames::id_t name_id;
+	SymbolNames::id_t binary_id;
 
 	Range<> instruction_addresses;
 
@@ -19,10 +75,25 @@ public:
 		const std::string & name,
 		const std::string & binary,
 		const Range<> & instruction_addresses
-	) : name(name),
-		binary(binary),
+	) : name_id(symbol_names.intern(name)),
+		binary_id(symbol_names.intern(binary)),
 		instruction_addresses(instruction_addresses)
 	{}
+	Symbol (
+		const SymbolNames::id_t name_id,
+		const SymbolNames::id_t binary_id,
+		const Range<> & instruction_addresses
+	) : name_id(name_id),
+		binary_id(binary_id),
+		instruction_addresses(instruction_addresses)
+	{}
+
+	const std::string & name () const {
+		return symbol_names.mangled(name_id);
+	}
+	const std::string & binary () const {
+		return symbol_names.mangled(binary_id);
+	}
 
 	static const std::string file_line_regex_string;
 	static const std::regex  file_line_regex;
@@ -56,72 +127,125 @@ public:
 	std::string to_file_line () const {
 		return std::format(
 			"{}\t{:016x}\t{:016x}\t{}",
-			binary,
+			binary(),
 			instruction_addresses.start(),
 			instruction_addresses.stop(),
-			name
+			name()
 		);
 	}
 
-	bool starts_in_page(const size_t page_address) const;
-
 	std::string label () const {
-		return binary + "`" + demangle(name);
+		return binary() + "`" + symbol_names.demangled(name_id);
 	}
 
 	std::string dbg () const {
-		return binary + "`" + demangle(name) + ":" + instruction_addresses.to_string(std::hex);
+		return label() + ":" + instruction_addresses.to_string(std::hex);
 	}
 };
 
-class SymbolPage : public std::vector<Symbol> {
-public:
-	using Super = std::vector<Symbol>;
-	using Self = SymbolPage;
-	Self        & self  ()       { return *this; }
-	Self  const & self  () const { return *this; }
-	Super       & super ()       { return static_cast<      Super &>(*this); }
-	Super const & super () const { return static_cast<const Super &>(*this); }
-
-	SymbolPage () = default;
-	SymbolPage (const std::vector<Symbol> & symbols) : Super(symbols) {}
-
-	std::optional<Symbol> find_symbol (const uint64_t instruction_pointer) const {
-		auto found = std::find_if (super().cbegin(), super().cend(),
-			[instruction_pointer] (const Symbol & symbol) {
-				return symbol.instruction_addresses.contains(instruction_pointer);
-			}
-		);
-		if (found == super().cend())
-			return std::optional<Symbol>();
-		return std::optional<Symbol>(*found);
-	}
+// the binary .symt format, all words little endian:
+// SYMT_HEADER_WORDS header words, then starts, ends, max_ends and read_order with one word per symbol,
+// name_offsets with one more (symbol i is blob[name_offsets[i], name_offsets[i + 1])),
+// then the string blob, padded to whole words. the blob starts with the binary name.
+// the arrays are used in place from the mmap'ed file.
+enum symbol_file_header : size_t {
+	SYMT_MAGIC,
+	SYMT_VERSION,
+	SYMT_SYMBOL_COUNT,
+	SYMT_BLOB_BYTES,
+	SYMT_BINARY_BYTES,
+	// size and mtime of the ELF file the table was read from, 0 if unknown
+	SYMT_SOURCE_SIZE,
+	SYMT_SOURCE_MTIME,
+	SYMT_HEADER_WORDS = 8,
 };
+// "BTBSYMT" and a 0 byte, as it appears in the file
+constexpr uint64_t symt_magic   = 0x00544d5953425442;
+constexpr uint64_t symt_version = 1;
+
+// which ELF file a symbol table was read from. an ELF file that changes size or mtime
+// was rebuilt, so a symbol table written for the old one is stale.
+typedef struct symbol_source_s {
+	uint64_t size;
+	uint64_t mtime;
+
+	bool known () const {
+		return size || mtime;
+	}
+	bool operator== (const struct symbol_source_s &) const = default;
 
-class SymbolTable : public map_with_errors<uint64_t, SymbolPage> {
-public:
-	using Super = map_with_errors<uint64_t, SymbolPage>;
-	using Self = SymbolTable;
-	Self        & self  ()       { return *this; }
-	Self  const & self  () const { return *this; }
-	Super       & super ()       { return static_cast<      Super &>(*this); }
-	Super const & super () const { return static_cast<const Super &>(*this); }
+	static struct symbol_source_s of_file (const std::filesystem::path & elf_filename);
+} symbol_source_t;
 
+// symbols sorted by start address, searched with a branchless binary search.
+// where symbols overlap, the one read first wins.
+class SymbolTable {
 private:
 	std::string binary;
+	SymbolNames::id_t binary_id = 0;
+	symbol_source_t source {};
+
+	// symbols are collected here until build_index, then only the arrays below are used
+	std::vector<Symbol> inserted;
+	// the file image, if the table was not mmap'ed from a binary .symt file
+	std::vector<uint64_t> image;
+
+	// sorted by start address, then by the order they were read in.
+	// these view either image or the mmap'ed file.
+	std::span<const uint64_t> starts;
+	std::span<const uint64_t> ends;
+	// the largest end of symbols 0 to i, how far back a symbol may still contain an address
+	std::span<const uint64_t> max_ends;
+	// the position in which each symbol was read, to break ties between overlapping symbols
+	std::span<const uint64_t> read_order;
+	std::span<const uint64_t> name_offsets;
+	std::string_view blob;
+	// the interned names, these are not in the file
+	std::vector<SymbolNames::id_t> name_ids;
+
+	// sorts the inserted symbols and writes them to image, then uses that
+	void build_index ();
+	// points the arrays into a file image after checking its header
+	void use_image (const std::span<const uint64_t> words, const std::string & origin);
+	// the last symbol starting at or before address, or -1
+	ssize_t last_starting_at_or_before (const uint64_t address) const;
+
+	Symbol symbol_at (const size_t i) const {
+		return Symbol(name_ids[i], binary_id, Range<>::with_end(starts[i], ends[i]));
+	}
 
 public:
 	SymbolTable (
 		const std::string & binary,
-		const ELFIO::elfio & reader
+		const ELFIO::elfio & reader,
+		const symbol_source_t & source = {}
 	);
 
+	// a binary .symt file is mmap'ed, the old text format is still read line by line
 	SymbolTable (const std::string & symbol_table_filename);
 
+	// the views point into this table's image, a moved image keeps its buffer
+	SymbolTable (const SymbolTable &) = delete;
+	SymbolTable & operator= (const SymbolTable &) = delete;
+	SymbolTable (SymbolTable &&) = default;
+
+	static bool is_binary_file (const std::filesystem::path & symbol_table_filename);
+
+	// always writes the binary format
 	void export_to_file (const std::filesystem::path & symbol_table_filename) const;
 
 	void insert_symbol(const Symbol & symbol);
 
+	size_t size () const {
+		return starts.size();
+	}
+
+	const symbol_source_t & read_from () const {
+		return source;
+	}
+
+	// the symbol containing the instruction pointer. if there is none, and the nearest symbol
+	// before it has size 0 (like fiasco's interrupt entry points), that one.
 	std::optional<Symbol> find_symbol (const uint64_t instruction_pointer) const;
 };
 
@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 
+#include "SectionDecoder.hpp"
 #include "compress.hpp"
 #include "mmap_file.hpp"
 
@@ -65,18 +66,7 @@ int main(int argc, char * argv []) {
 	};
 
 	// check if this data might actually be raw uncompressed
-	if (
-		input.size() >= 4
-		&& (
-			input_buffer[0] == 0x1 || // BTE_STACK
-			input_buffer[0] == 0x2 || // BTE_MAPPING
-			input_buffer[0] == 0x4 || // BTE_CONTROL
-			input_buffer[0] == 0x8 || // BTE_INFO
-			input_buffer[0] == 0x10   // BTE_STATS
-		)
-		&& (8 <= input_buffer[1] && input_buffer[1] <= 100) // Entry length
-		&& (input_buffer[2] > 0x10000)
-	) {
+	if (is_uncompressed(input)) {
 		fprintf(stderr,
 			"WARNING: input_buffer starts with words 0x%lx, 8<= 0x%lx <=12, 0x%lx>0x10000, 0x%lx. \n\t"
 			"That's not a compression header, that's a Backtrace Buffer Entry. \n\t"
@@ -93,10 +83,11 @@ int main(int argc, char * argv []) {
 	// there are usually several (probably) compressed sections of data,
 	// each with header, dictionary (if compressed) and (compressed) data
 	int section_counter = 0;
+	decoder_state_t decoder_state;
 	size_t remaining_input = input.size() - (input_buffer - fixed_start);
 	do {
 		// parse the compression_header
-		const size_t header_capacity_in_words = (sizeof(compression_header_t) - 1) / sizeof(uint64_t) + 1;
+		const size_t header_capacity_in_words = compression_header_words;
 		if (remaining_input < header_capacity_in_words) {
 			printf(
 				"remaining input (%lx - %lx = %lx w) file '%s' is smaller than even the compression header??\n",
@@ -124,25 +115,25 @@ int main(int argc, char * argv []) {
 		const std::span dictionary { dictionary_raw, dictionary_length_in_words };
 		const std::span compressed { reinterpret_cast<const uint8_t*>(compressed_raw), compressed_length_in_bytes };
 
-		if (!compression_header->is_compressed) {
-			if (compressed_length_in_bytes % sizeof(uint64_t) != 0) {
-				printf("data is supposedly not compressed, but length is not multiple of word length??\n");
-				exit(1);
-			}
-
-			size_t compressed_words = compressed_length_in_bytes / sizeof(uint64_t);
-			printf("data was not compressed, writing %ld words to '%s'\n", compressed_words, output_filename.c_str());
-			const std::span decompressed { compressed_raw, compressed_words };
-			write_out(output_stream, decompressed);
-			return 0;
+		std::vector<uint64_t> decompressed;
+		if (!decode_section(decoder_state, compression_header, dictionary, compressed, decompressed)) {
+			// the section with the previous dictionary is missing and was not recovered.
+			// following sections can only be decompressed again after the next full dictionary.
+			fprintf(stderr,
+				"WARNING: section %d only has a dictionary delta, "
+				"but not against the dictionary of the previous section. skipping it.\n",
+				section_counter
+			);
 		}
-
-		auto decompressed = decompress(compressed, dictionary);
-
 		printf(
-			"data decompressed from %ld B, writing %ld words to '%s'\n",
-			compressed_length_in_bytes, decompressed.size(), output_filename.c_str()
+			"section %d: %s (header version %ld), %ld B of data\n",
+			section_counter,
+			section_encoder_name(compression_header_get_encoder(compression_header)),
+			compression_header_get_version(compression_header),
+			compressed_length_in_bytes
 		);
+
+		printf("writing %ld words to '%s'\n", decompressed.size(), output_filename.c_str());
 		write_out(output_stream, std::span { decompressed });
 
 		// a few bytes of padding to get to the next word
@@ -180,6 +171,7 @@ int main(int argc, char * argv []) {
 
 		input_buffer = next_input_buffer;
 		remaining_input = input.size() - (input_buffer - fixed_start);
+		section_counter ++;
 	} while (remaining_input > 0);
 
 	printf("done.\n");
@@ -1,9 +1,19 @@
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <filesystem>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
 
 #include "Mapping.hpp"
 #include "BinariesList.hpp"
 #include "EntryArray.hpp"
+#include "FoldedStacks.hpp"
+#include "FlameGraph.hpp"
+#include "CaptureReader.hpp"
 #include "SymbolTable.hpp"
 #include "mmap_file.hpp"
 #include "rethrow_error.hpp"
@@ -20,20 +30,23 @@ public:
 		folded,
 		histogram,
 		durations,
+		flame_graph,
 	};
-	constexpr static size_t output_mode_count = 5;
+	constexpr static size_t output_mode_count = 6;
 	constexpr static std::string output_mode_endings [output_mode_count] = {
 		"interpreted",
 		"btb_lines",
 		"folded",
 		"histogram",
 		"durations",
+		"svg",
 	};
 	static_assert(output_mode_endings[raw]       == "interpreted");
 	static_assert(output_mode_endings[btb_lines] == "btb_lines");
 	static_assert(output_mode_endings[folded]    == "folded");
 	static_assert(output_mode_endings[histogram] == "histogram");
 	static_assert(output_mode_endings[durations] == "durations");
+	static_assert(output_mode_endings[flame_graph] == "svg");
 	constexpr static std::string output_mode_endings_joined (const std::string sep) {
 		std::string result = "";
 		for (size_t i = 0; i < output_mode_count; i++) {
@@ -46,59 +59,155 @@ public:
 
 	using cpu_id_t = uint64_t;
 
-	const struct constructed_s {
-		std::string base_name;
-		std::string ending;
-		output_mode_e output_mode;
-	} constructed;
-	const std::string   & base_name   = constructed.base_name;
-	const std::string   & ending      = constructed.ending;
-	const output_mode_e & output_mode = constructed.output_mode;
+	// one output file, and with do_multi_processor one more per cpu
+	class Output {
+	public:
+		const struct constructed_s {
+			std::string base_name;
+			std::string ending;
+			output_mode_e output_mode;
+		} constructed;
+		const std::string   & base_name   = constructed.base_name;
+		const std::string   & ending      = constructed.ending;
+		const output_mode_e & output_mode = constructed.output_mode;
+
+	private:
+		std::map<cpu_id_t, std::ofstream> streams;
+		std::ofstream common_stream;
+
+	public:
+		Output (const std::filesystem::path & output_filename)
+		  : constructed(split_filename(output_filename)),
+			common_stream(base_name + "." + ending)
+		{}
+
+		std::ofstream & common () {
+			return common_stream;
+		}
+
+		std::ofstream & operator [] (const cpu_id_t cpu_id) {
+			if (!streams.contains(cpu_id))
+				streams.emplace(
+					cpu_id,
+					std::ofstream {
+						base_name + "-" + std::to_string(cpu_id) + "." + ending,
+						std::ios::out
+						| std::ios::trunc
+						| std::ios::binary
+					}
+				);
+
+			return streams.at(cpu_id);
+		}
+	};
 
 private:
-	std::map<cpu_id_t, std::ofstream> streams;
-	std::ofstream common_stream;
+	// a deque, because an Output refers to its own members
+	std::deque<Output> outputs;
 	bool do_multi_processor;
+	flame_graph_options_t flame_graph_options;
+	// the stacks of all folded and flame graph outputs are summed up here, once,
+	// and written by finish. the first of these outputs is the one that adds them
+	std::unique_ptr<FoldedStacks> folded_stacks;
+	size_t stacks_output = 0;
 
 public:
+	// all outputs are written in one pass over the entries
 	OutputStreams (
-		const std::filesystem::path & output_filename,
-		const bool do_multi_processor
-	) : constructed(split_filename(output_filename)),
-		common_stream(base_name + "." + ending),
-		do_multi_processor(do_multi_processor)
-	{}
+		const std::vector<std::filesystem::path> & output_filenames,
+		const bool do_multi_processor,
+		const flame_graph_options_t & flame_graph_options = {}
+	) : do_multi_processor(do_multi_processor), flame_graph_options(flame_graph_options) {
+		for (const std::filesystem::path & output_filename : output_filenames) {
+			const Output & output = outputs.emplace_back(output_filename);
+			if (!folded_stacks && (output.output_mode == folded || output.output_mode == flame_graph)) {
+				folded_stacks = std::make_unique<FoldedStacks>();
+				stacks_output = outputs.size() - 1;
+			}
+		}
+	}
+
+	size_t size () const {
+		return outputs.size();
+	}
 
-	std::ofstream & common () {
-		return common_stream;
+	output_mode_e output_mode (const size_t output) const {
+		return outputs[output].output_mode;
 	}
 
 	bool does_multi_processor () const {
 		return do_multi_processor;
 	}
 
-	std::ofstream & operator [] (const cpu_id_t cpu_id) {
-		if (!streams.contains(cpu_id))
-			streams.emplace(
-				cpu_id,
-				std::ofstream {
-					base_name + "-" + std::to_string(cpu_id) + "." + ending,
-					std::ios::out
-					| std::ios::trunc
-					| std::ios::binary
-				}
-			);
+	void line (const size_t output, const std::string & text, uint64_t cpu_id, bool also_to_multi_processor_stream = true) {
+		outputs[output].common() << text << std::endl;
+		if (do_multi_processor && also_to_multi_processor_stream)
+			outputs[output][cpu_id] << text << std::endl;
+	}
 
-		return streams.at(cpu_id);
+	bool is_stacks_output (const size_t output) const {
+		return folded_stacks && output == stacks_output;
 	}
 
-	void line (const std::string & text, uint64_t cpu_id, bool also_to_multi_processor_stream = true) {
-		common() << text << std::endl;
-		if (do_multi_processor && also_to_multi_processor_stream)
-			(*this)[cpu_id] << text << std::endl;
+	void stack (const folded_stack_t & stack, uint64_t cpu_id) {
+		folded_stacks->add(cpu_id, stack);
+	}
+
+	// the flame graph options of one output: its variant sets the width,
+	// and without a --title the title names the file, like the Makefile did
+	flame_graph_options_t flame_graph_options_for (const Output & output, const std::string & file_stem) const {
+		flame_graph_options_t options = flame_graph_options;
+		if (options.title.empty())
+			options.title = "Flame Graph " + file_stem;
+		for (const flame_graph_variant_t & variant : flame_graph_variants) {
+			if (output.ending == std::string(variant.name) + ".svg") {
+				options.width = variant.width;
+				options.minwidth = variant.minwidth;
+			}
+		}
+		return options;
 	}
 
-	static struct constructed_s split_filename (
+	// writes what was summed up, after the last entry
+	void finish () {
+		if (!folded_stacks)
+			return;
+		std::cerr << std::format(
+			"folded: {} unique stacks in {} nodes",
+			folded_stacks->unique_stacks(), folded_stacks->all_nodes().size()
+		) << std::endl;
+
+		// all flame graphs share the subtree weights and sorted children
+		std::optional<FlameGraph> graph;
+		for (Output & output : outputs) {
+			if (output.output_mode == folded) {
+				folded_stacks->write(output.common());
+				output.common().flush();
+				if (!do_multi_processor)
+					continue;
+				for (const auto & [cpu_id, _] : folded_stacks->cpu_nodes()) {
+					folded_stacks->write_cpu(output[cpu_id], cpu_id);
+					output[cpu_id].flush();
+				}
+			} else if (output.output_mode == flame_graph) {
+				if (!graph)
+					graph.emplace(*folded_stacks);
+				const std::string file_stem = std::filesystem::path(output.base_name).filename();
+				const size_t frames = graph->write(output.common(), flame_graph_options_for(output, file_stem));
+				output.common().flush();
+				std::cerr << std::format("{}: {} frames drawn", output.base_name + "." + output.ending, frames) << std::endl;
+				if (!do_multi_processor)
+					continue;
+				for (const auto & [cpu_id, _] : folded_stacks->cpu_nodes()) {
+					const std::string cpu_stem = file_stem + "-" + std::to_string(cpu_id);
+					graph->write_cpu(output[cpu_id], cpu_id, flame_graph_options_for(output, cpu_stem));
+					output[cpu_id].flush();
+				}
+			}
+		}
+	}
+
+	static struct Output::constructed_s split_filename (
 		const std::string & output_filename
 	) {
 		static const std::string output_filename_regex_string { "(.+)\\.(" + output_mode_endings_joined("|") + ")" };
@@ -130,6 +239,18 @@ public:
 			);
 		}
 
+		// a.fine.svg is the fine variant of a.svg, its per cpu files are a-0.fine.svg, ...
+		if (output_mode == flame_graph) {
+			for (const flame_graph_variant_t & variant : flame_graph_variants) {
+				const std::string variant_ending = "." + std::string(variant.name);
+				if (base_name.ends_with(variant_ending)) {
+					base_name.resize(base_name.size() - variant_ending.size());
+					ending = std::string(variant.name) + "." + ending;
+					break;
+				}
+			}
+		}
+
 		return {
 			base_name,
 			ending,
@@ -141,50 +262,252 @@ public:
 Mappings mappings;
 map_with_errors<std::string, SymbolTable> binary_symbols;
 
-void interpret(
-	const std::span<uint64_t> buffer,
-	const BinariesList & binaries_list,
-	OutputStreams & output_streams
+// a saved symbol table is stale if its binary was changed and is not newer than the trace.
+// tables without a known source (the old text format) count as changed.
+// if the binary is gone, the saved table is all there is.
+bool symbol_table_is_stale (
+	const SymbolTable & symbol_table,
+	const std::string & elf_filename,
+	const std::string & tracebuffer_filename
 ) {
-	EntryArray entry_array { RawEntryArray { buffer } };
+	const symbol_source_t current = symbol_source_t::of_file(elf_filename);
+	if (!current.known() || symbol_table.read_from() == current)
+		return false;
+
+	std::error_code error;
+	const auto elf_time   = std::filesystem::last_write_time(elf_filename, error);
+	const auto trace_time = std::filesystem::last_write_time(tracebuffer_filename, error);
+	if (error)
+		return true;
+	return elf_time <= trace_time;
+}
 
-	std::cerr << "successfully read raw data" << std::endl;
+// reads the symbols of one binary from its saved table, or from its ELF file and saves them
+SymbolTable load_symbol_table (
+	const std::string & name,
+	const std::string & elf_filename,
+	const std::optional<std::filesystem::path> & symbol_table_directory,
+	const std::string & tracebuffer_filename,
+	const std::function<void (const std::string &)> & print_line
+) {
+	std::filesystem::path symbol_table_filename;
+	if (symbol_table_directory.has_value()) {
+		symbol_table_filename = symbol_table_directory.value() / (name + ".symt");
+		if (std::filesystem::is_regular_file(symbol_table_filename)) {
+			print_line(std::format("reading symbols for '{}' from '{}'.", name, std::string(symbol_table_filename)));
+
+			SymbolTable saved { symbol_table_filename };
+			// if we read it in, we do not want to write it back. that's redundant.
+			// unless the binary changed and the trace was taken with the changed one.
+			// a binary rebuilt after the trace was taken is newer than the trace,
+			// then the saved table is the one that matches the trace.
+			if (!symbol_table_is_stale(saved, elf_filename, tracebuffer_filename))
+				return saved;
+
+			print_line(std::format("symbols for '{}' in '{}' are stale, '{}' changed.", name, std::string(symbol_table_filename), elf_filename));
+		} else {
+			print_line(std::format("couldn't read symbols for '{}' from '{}', doesn't exist.", name, std::string(symbol_table_filename)));
+		}
+	}
+
+	// not saved (or stale), so we need to read it in with ELFIO
+	SymbolTable symbol_table { name, get_elfio_reader(elf_filename), symbol_source_t::of_file(elf_filename) };
+	if (symbol_table_directory.has_value()) {
+		// we couln't read it from the file, so let's write it there for next time
+		print_line(std::format("exporting symbol table for binary '{}' to '{}'.", name, std::string(symbol_table_filename)));
+		symbol_table.export_to_file(symbol_table_filename);
+	}
+	return symbol_table;
+}
 
-	const Entry * previous_entry = nullptr;
+// loads the symbol tables of the binaries the trace maps (and the kernel's), not all of binaries.list.
+// they are loaded on background threads while the trace is parsed, join waits for binary_symbols to be complete.
+// a trace that is still arriving can only say what it maps as it goes, require loads those.
+class SymbolLoader {
+	const BinariesList & binaries_list;
+	const std::optional<std::filesystem::path> symbol_table_directory;
+	const std::string tracebuffer_filename;
+	std::set<std::string> required;
+	std::vector<std::pair<std::string, std::string>> pending;
+	std::atomic<size_t> next = 0;
+	std::mutex lock;
+	std::exception_ptr error;
+	std::vector<std::thread> threads;
+
+	void print_line (const std::string & line) {
+		std::unique_lock guard { lock };
+		std::cout << line << std::endl;
+	}
 
-	for (const auto & entry : entry_array) {
-		switch (output_streams.output_mode) {
+	void load (
+		const std::optional<std::filesystem::path> & symbol_table_directory,
+		const std::string & tracebuffer_filename
+	) {
+		for (size_t i = next++; i < pending.size(); i = next++) {
+			const auto & [name, elf_filename] = pending[i];
+			try {
+				SymbolTable symbol_table = load_symbol_table(
+					name, elf_filename, symbol_table_directory, tracebuffer_filename,
+					[this] (const std::string & line) { print_line(line); }
+				);
+				std::unique_lock guard { lock };
+				const bool was_inserted = binary_symbols.emplace(name, std::move(symbol_table)).second;
+				if (!was_inserted) {
+					throw std::runtime_error(std::format(
+						"could not store a symbol table for binary '{}', probably a binary name clash or duplication?",
+						name
+					));
+				}
+			} catch (...) {
+				std::unique_lock guard { lock };
+				if (!error)
+					error = std::current_exception();
+				next = pending.size();
+			}
+		}
+	}
+
+public:
+	SymbolLoader (
+		const std::set<std::string> & mapped_binaries,
+		const BinariesList & binaries_list,
+		const std::optional<std::filesystem::path> & symbol_table_directory,
+		const std::string & tracebuffer_filename,
+		const size_t jobs
+	) : binaries_list(binaries_list),
+		symbol_table_directory(symbol_table_directory),
+		tracebuffer_filename(tracebuffer_filename)
+	{
+		for (const auto &[name, path] : binaries_list) {
+			if (name == "KERNEL" || mapped_binaries.contains(name))
+				pending.emplace_back(name, path);
+		}
+		for (const std::string & name : mapped_binaries) {
+			if (!binaries_list.contains(name))
+				std::cerr << std::format("WARNING: the trace maps '{}', which is not in binaries.list.", name) << std::endl;
+		}
+		std::cout << std::format(
+			"loading symbols for {} of {} binaries in binaries.list.",
+			pending.size(), binaries_list.size()
+		) << std::endl;
+
+		// at least one thread, so loading overlaps with parsing the trace
+		const size_t thread_count = std::min(std::max<size_t>(jobs, 1), pending.size());
+		for (size_t t = 0; t < thread_count; t++) {
+			threads.emplace_back([this, symbol_table_directory, tracebuffer_filename] () {
+				load(symbol_table_directory, tracebuffer_filename);
+			});
+		}
+	}
+
+	~SymbolLoader () {
+		next = pending.size();
+		for (std::thread & thread : threads)
+			if (thread.joinable())
+				thread.join();
+	}
+
+	void join () {
+		for (std::thread & thread : threads)
+			thread.join();
+		threads.clear();
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	// after join: loads the symbols of a binary the trace maps, if they are not loaded yet
+	void require (const std::string & name) {
+		if (binary_symbols.contains(name) || !required.insert(name).second)
+			return;
+		if (!binaries_list.contains(name)) {
+			std::cerr << std::format("WARNING: the trace maps '{}', which is not in binaries.list.", name) << std::endl;
+			return;
+		}
+		binary_symbols.emplace(name, load_symbol_table(
+			name, binaries_list.at(name), symbol_table_directory, tracebuffer_filename,
+			[this] (const std::string & line) { print_line(line); }
+		));
+	}
+};
+
+// one line for OutputStreams::line, so entries can be formatted on other threads and written in order
+typedef struct output_line_s {
+	size_t output;
+	std::string text;
+	uint64_t cpu_id;
+	bool also_to_multi_processor_stream;
+	// for the folded and flame graph outputs, instead of text
+	std::optional<folded_stack_t> stack = {};
+
+	void write_to (OutputStreams & output_streams) const {
+		if (stack)
+			output_streams.stack(*stack, cpu_id);
+		else
+			output_streams.line(output, text, cpu_id, also_to_multi_processor_stream);
+	}
+} output_line_t;
+
+// what the output of an entry depends on, besides the entry itself and the one before it
+typedef struct interpret_counters_s {
+	size_t hist_counter = 0;
+	size_t durations_counter = 0;
+} interpret_counters_t;
+
+// entries are formatted in chunks of this many, with -j on several threads
+static constexpr size_t interpret_chunk_entries = 4096;
+// how many chunks per thread may wait to be written
+static constexpr size_t interpret_chunks_per_job = 4;
+
+void interpret_entry(
+	const Entry & entry,
+	const Entry * previous_entry,
+	const OutputStreams & output_streams,
+	interpret_counters_t & counters,
+	std::vector<output_line_t> & lines
+) {
+	for (size_t output_index = 0; output_index < output_streams.size(); output_index++) {
+		auto line = [&] (const std::string & text, uint64_t cpu_id, bool also_to_multi_processor_stream = true) {
+			lines.push_back({ output_index, text, cpu_id, also_to_multi_processor_stream });
+		};
+
+		switch (output_streams.output_mode(output_index)) {
 		case OutputStreams::raw: {
 			std::string output = "read entry: \n" + entry.to_string();
-			output_streams.line(output, entry.attribute("cpu_id"), entry.attribute("entry_type") == BTE_STACK);
+			line(output, entry.attribute(BTA_CPU_ID), entry.type() == BTE_STACK);
 		}
 			break;
 		case OutputStreams::btb_lines: {
 			std::string output = std::format("btb @{:16x}: {}", entry.buffer_offset, entry.to_hex_string());
-			output_streams.line(output, entry.attribute("cpu_id"), entry.attribute("entry_type") == BTE_STACK);
+			line(output, entry.attribute(BTA_CPU_ID), entry.type() == BTE_STACK);
 		}
 			break;
 		case OutputStreams::folded:
-			if (entry.attribute("entry_type") == BTE_STACK) {
-				std::string output = entry.folded(previous_entry, output_streams.does_multi_processor());
-				output_streams.line(output, entry.attribute("cpu_id"));
+		case OutputStreams::flame_graph:
+			// all of them share one call tree, each stack goes in once
+			if (entry.type() == BTE_STACK && output_streams.is_stacks_output(output_index)) {
+				lines.push_back({
+					output_index, {}, entry.attribute(BTA_CPU_ID), true,
+					entry.folded_stack(previous_entry, output_streams.does_multi_processor())
+				});
 			}
 			break;
 		case OutputStreams::histogram:
-			if (entry.attribute("entry_type") == BTE_STATS) {
-				static size_t hist_counter = 0;
+			if (entry.type() == BTE_STATS) {
+				const size_t hist_counter = counters.hist_counter;
 				if (hist_counter == 0) {
 					std::string output = "hist_counter,depth_min,depth_max,count,average_time_in_ns";
-					output_streams.line(output, entry.attribute("cpu_id"));
+					line(output, entry.attribute(BTA_CPU_ID));
 				}
-				const size_t hist_bin_count = entry.attribute("hist_bin_count");
-				const size_t hist_bin_size  = entry.attribute("hist_bin_size");
+				const size_t hist_bin_count = entry.attribute(BTA_HIST_BIN_COUNT);
+				const size_t hist_bin_size  = entry.attribute(BTA_HIST_BIN_SIZE);
+				const auto payload = entry.get_payload();
+				if (payload.size() < 2 * hist_bin_count)
+					throw std::out_of_range("BTE_STATS payload is shorter than its hist_bin_count says.");
 				for (size_t bin_index = 0; bin_index < hist_bin_count; bin_index++) {
 					size_t depth_min =  bin_index      * hist_bin_size;
 					size_t depth_max = (bin_index + 1) * hist_bin_size;
-					const auto payload = entry.get_payload();
-					size_t count = payload.at(bin_index);
-					size_t time_in_ns = payload.at(hist_bin_count + bin_index);
+					size_t count = payload[bin_index];
+					size_t time_in_ns = payload[hist_bin_count + bin_index];
 					double average_time_in_ns = count ? static_cast<double>(time_in_ns) / count : 0;
 					std::string output = (
 						std::to_string(hist_counter) + "," +
@@ -193,61 +516,273 @@ void interpret(
 						std::to_string(count)        + "," +
 						std::to_string(average_time_in_ns)
 					);
-					output_streams.line(output, entry.attribute("cpu_id"));
+					line(output, entry.attribute(BTA_CPU_ID));
 				}
-				hist_counter ++;
 			}
 			break;
 		case OutputStreams::durations:
-			if (entry.attribute("entry_type") == BTE_STACK) {
-				static size_t durations_counter = 0;
+			if (entry.type() == BTE_STACK) {
+				const size_t durations_counter = counters.durations_counter;
 				if (durations_counter == 0) {
 					std::string output = "timer_step,stack_depth,ns_duration,ns_interval";
-					output_streams.line(output, entry.attribute("cpu_id"));
+					line(output, entry.attribute(BTA_CPU_ID));
 				}
 				uint64_t interval_ns = (
 					previous_entry
-					? entry.attribute("tsc_time") - previous_entry->attribute("tsc_time")
+					? entry.attribute(BTA_TSC_TIME) - previous_entry->attribute(BTA_TSC_TIME)
 					: 0
 				);
 				std::string output = (
-					std::to_string(entry.attribute("timer_step"))   + "," +
-					std::to_string(entry.attribute("stack_depth"))  + "," +
-					std::to_string(entry.attribute("tsc_duration")) + "," +
+					std::to_string(entry.attribute(BTA_TIMER_STEP))   + "," +
+					std::to_string(entry.attribute(BTA_STACK_DEPTH))  + "," +
+					std::to_string(entry.attribute(BTA_TSC_DURATION)) + "," +
 					std::to_string(interval_ns)
 				);
-				output_streams.line(output, entry.attribute("cpu_id"));
-				durations_counter ++;
+				line(output, entry.attribute(BTA_CPU_ID));
 			}
 			break;
 		}
-		previous_entry = &entry;
+	}
+
+	// after all outputs, they all see the same counts
+	if (entry.type() == BTE_STATS)
+		counters.hist_counter ++;
+	if (entry.type() == BTE_STACK)
+		counters.durations_counter ++;
+}
+
+void interpret_chunk(
+	const EntryArray & entry_array,
+	const size_t chunk,
+	const OutputStreams & output_streams,
+	interpret_counters_t counters,
+	std::vector<output_line_t> & lines
+) {
+	const size_t begin = chunk * interpret_chunk_entries;
+	const size_t end = std::min(begin + interpret_chunk_entries, entry_array.size());
+	for (size_t i = begin; i < end; i++) {
+		const Entry * previous_entry = i ? &entry_array[i - 1] : nullptr;
+		interpret_entry(entry_array[i], previous_entry, output_streams, counters, lines);
+	}
+}
+
+void interpret(
+	const RawEntryArray & raw_entry_array,
+	SymbolLoader & symbol_loader,
+	OutputStreams & output_streams,
+	const size_t jobs
+) {
+	EntryArray entry_array { raw_entry_array };
+
+	std::cerr << "successfully read raw data" << std::endl;
+
+	// the symbols were loaded while the entries were read
+	symbol_loader.join();
+
+	// all mappings are known now, from here on mappings and binary_symbols are only read.
+	// the counters at the start of each chunk are cheap to know beforehand,
+	// then the chunks can be formatted in any order and on any thread.
+	const size_t chunk_count = (entry_array.size() + interpret_chunk_entries - 1) / interpret_chunk_entries;
+	std::vector<interpret_counters_t> chunk_counters (chunk_count);
+	interpret_counters_t counters;
+	for (size_t i = 0; i < entry_array.size(); i++) {
+		if (i % interpret_chunk_entries == 0)
+			chunk_counters[i / interpret_chunk_entries] = counters;
+		const uint64_t entry_type = entry_array[i].type();
+		if (entry_type == BTE_STATS)
+			counters.hist_counter ++;
+		if (entry_type == BTE_STACK)
+			counters.durations_counter ++;
+	}
+
+	auto write_lines = [&] (const std::vector<output_line_t> & lines) {
+		for (const output_line_t & line : lines)
+			line.write_to(output_streams);
+	};
+
+	if (jobs <= 1) {
+		for (size_t chunk = 0; chunk < chunk_count; chunk++) {
+			std::vector<output_line_t> lines;
+			interpret_chunk(entry_array, chunk, output_streams, chunk_counters[chunk], lines);
+			write_lines(lines);
+		}
+		return;
+	}
+
+	// the workers format chunks ahead, this thread writes them in order
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<std::vector<output_line_t>> chunk_lines (chunk_count);
+	std::vector<std::exception_ptr> chunk_errors (chunk_count);
+	std::vector<bool> chunk_done (chunk_count, false);
+	size_t next_chunk = 0;
+	size_t written_chunks = 0;
+	bool stopping = false;
+	const size_t window = jobs * interpret_chunks_per_job;
+
+	auto worker = [&] () {
+		std::unique_lock guard { lock };
+		while (true) {
+			changed.wait(guard, [&] () {
+				return stopping || next_chunk == chunk_count || next_chunk < written_chunks + window;
+			});
+			if (stopping || next_chunk == chunk_count)
+				return;
+			const size_t chunk = next_chunk ++;
+			guard.unlock();
+
+			std::vector<output_line_t> lines;
+			std::exception_ptr error;
+			try {
+				interpret_chunk(entry_array, chunk, output_streams, chunk_counters[chunk], lines);
+			} catch (...) {
+				error = std::current_exception();
+			}
+
+			guard.lock();
+			chunk_lines[chunk] = std::move(lines);
+			chunk_errors[chunk] = error;
+			chunk_done[chunk] = true;
+			changed.notify_all();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (size_t j = 0; j < jobs; j++)
+		workers.emplace_back(worker);
+
+	std::exception_ptr error;
+	for (size_t chunk = 0; chunk < chunk_count && !error; chunk++) {
+		std::vector<output_line_t> lines;
+		{
+			std::unique_lock guard { lock };
+			changed.wait(guard, [&] () { return chunk_done[chunk]; });
+			lines = std::move(chunk_lines[chunk]);
+			error = chunk_errors[chunk];
+		}
+		// the first error in entry order, as without -j
+		if (!error)
+			write_lines(lines);
+
+		std::unique_lock guard { lock };
+		written_chunks ++;
+		stopping = error != nullptr;
+		changed.notify_all();
+	}
+	{
+		std::unique_lock guard { lock };
+		stopping = true;
+		changed.notify_all();
+	}
+	for (std::thread & thread : workers)
+		thread.join();
+	if (error)
+		std::rethrow_exception(error);
+}
+
+// like interpret, but the entries are sorted in a window while the buffer is read,
+// so memory is bounded by the window and output is written as it goes.
+// mappings are added when their entry is due, so this formats on one thread.
+// release is told which words of an arriving buffer are not needed anymore.
+void interpret_streaming(
+	const std::span<uint64_t> buffer,
+	const size_t window,
+	SymbolLoader & symbol_loader,
+	OutputStreams & output_streams,
+	const read_more_t & read_more = {},
+	const std::function<void (const uint64_t * needed)> & release = {}
+) {
+	EntryStream entry_stream { buffer, window, read_more };
+	interpret_counters_t counters;
+	std::vector<output_line_t> lines;
+
+	// the first entry fills the window, while the symbols are loaded
+	const Entry * entry = entry_stream.next();
+	symbol_loader.join();
+	for (; entry; entry = entry_stream.next()) {
+		if (entry->type() == BTE_MAPPING)
+			symbol_loader.require(Mapping::name_from_payload(entry->get_payload()));
+		interpret_entry(*entry, entry_stream.previous_entry(), output_streams, counters, lines);
+		for (const output_line_t & line : lines)
+			line.write_to(output_streams);
+		lines.clear();
+		if (release)
+			release(entry_stream.oldest_needed());
+	}
+
+	if (entry_stream.late_entries()) {
+		std::cerr << std::format(
+			"WARNING: {} entries were more than {} entries out of order and are written late, "
+			"use a larger window.",
+			entry_stream.late_entries(), window
+		) << std::endl;
 	}
 }
 
 int main(int argc, char * argv []) {
 	// TODO: use argp / similar
 
+	// -j N formats the output on N threads, -j 0 on one per core. the output is the same.
+	// -w N streams the buffer through a window of N entries instead of sorting all of them,
+	// for traces too large to hold. the output is the same if no entry is further out of order.
+	// the input can also be the serial capture (.traced, .cleaned, or - for stdin), it is then unpacked
+	// and decompressed here, without the files in between. with -w, the output is written while it arrives.
+	// --title, --subtitle, --width and --minwidth are for the .svg flame graphs, as with flamegraph.pl.
+	// width and minwidth are those of the plain .svg, the .fine/.narrow/.ultrafine.svg set their own.
+	size_t jobs = 1;
+	size_t window = 0;
+	flame_graph_options_t flame_graph_options;
+	int positional_count = 1;
+	for (int a = 1; a < argc; a++) {
+		const std::string arg = argv[a];
+		if (arg == "-j" && a + 1 < argc)
+			jobs = std::stoul(argv[++a]);
+		else if (arg.starts_with("-j"))
+			jobs = std::stoul(arg.substr(2));
+		else if (arg == "-w" && a + 1 < argc)
+			window = std::stoul(argv[++a]);
+		else if (arg.starts_with("-w"))
+			window = std::stoul(arg.substr(2));
+		else if (arg == "--title" && a + 1 < argc)
+			flame_graph_options.title = argv[++a];
+		else if (arg == "--subtitle" && a + 1 < argc)
+			flame_graph_options.subtitle = argv[++a];
+		else if (arg == "--width" && a + 1 < argc)
+			flame_graph_options.width = std::stod(argv[++a]);
+		else if (arg == "--minwidth" && a + 1 < argc)
+			flame_graph_options.minwidth = std::stod(argv[++a]);
+		else
+			argv[positional_count++] = argv[a];
+	}
+	argc = positional_count;
+	if (jobs == 0)
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+
 	if (argc < 2) {
-		throw std::runtime_error("missing args: need input file (.btb)");
+		throw std::runtime_error("missing args: need input file (.btb, or .traced/.cleaned/- for a capture)");
 	}
 	std::string tracebuffer_filename { argv[1] };
 
 	if (argc < 3) {
 		throw std::runtime_error(std::format(
-			"missing args: needs output file (.{})",
+			"missing args: needs output file (.{}), or several separated by commas",
 			OutputStreams::output_mode_endings_joined("/.")
 		));
 	}
-	std::filesystem::path output_path = argv[2];
-	if (!std::filesystem::is_directory(output_path.parent_path())) {
-		throw std::runtime_error(std::format(
-			"wrong arg: parent {} of output_path '{}' is not a directory!",
-			std::string(output_path.parent_path()),
-			std::string(output_path)
-		));
+	// several outputs are separated by commas, they are all written from one pass
+	std::vector<std::filesystem::path> output_paths;
+	std::stringstream output_list { argv[2] };
+	for (std::string output_path; std::getline(output_list, output_path, ',');) {
+		if (!std::filesystem::is_directory(std::filesystem::path(output_path).parent_path())) {
+			throw std::runtime_error(std::format(
+				"wrong arg: parent {} of output_path '{}' is not a directory!",
+				std::string(std::filesystem::path(output_path).parent_path()),
+				output_path
+			));
+		}
+		output_paths.push_back(output_path);
 	}
-	OutputStreams output_streams { output_path, true };
+	OutputStreams output_streams { output_paths, true, flame_graph_options };
 
 	std::optional<std::filesystem::path> symbol_table_directory {};
 	if (argc < 4) {
@@ -269,50 +804,21 @@ int main(int argc, char * argv []) {
 	std::string binaries_list_filename = "./data/binaries.list";
 	BinariesList binaries_list { binaries_list_filename };
 
-	for (const auto &[name, path] : binaries_list) {
-		std::filesystem::path symbol_table_filename;
-		if (symbol_table_directory.has_value()) {
-			symbol_table_filename = symbol_table_directory.value() / (name + ".symt");
-			if (std::filesystem::is_regular_file(symbol_table_filename)) {
-				std::cout << std::format("reading symbols for '{}' from '{}'.", name, std::string(symbol_table_filename)) << std::endl;
-
-				binary_symbols.emplace(
-					std::piecewise_construct,
-					std::forward_as_tuple(name),
-					std::forward_as_tuple(symbol_table_filename)
-				);
-				// if we read it in, we do not want to write it back. that's redundant
-				continue;
-			}
-			std::cout << std::format("couldn't read symbols for '{}' from '{}', doesn't exist.", name, std::string(symbol_table_filename)) << std::endl;
-		}
-
-		// we did not hit the continue above, so we need to read it in with ELFIO
-		auto const & [new_table_it, was_inserted] = binary_symbols.emplace(
-			std::piecewise_construct,
-			std::forward_as_tuple(name),
-			std::forward_as_tuple(
-				name,
-				get_elfio_reader(path)
-			)
-		);
-		if (!was_inserted) {
-			throw std::runtime_error(std::format(
-				"could not store a symbol table for binary '{}', probably a binary name clash or duplication?",
-				name
-			));
-		}
-		if (symbol_table_directory.has_value()) {
-			// we couln't read it from the file, so let's write it there for next time
-			SymbolTable & symbol_table = new_table_it->second;
-			std::cout << std::format("exporting symbol table for binary '{}' to '{}'.", name, std::string(symbol_table_filename)) << std::endl;
-			symbol_table.export_to_file(symbol_table_filename);
-		}
+	std::unique_ptr<CaptureReader> capture;
+	std::span<uint64_t> buffer;
+	if (CaptureReader::is_capture(tracebuffer_filename)) {
+		capture = std::make_unique<CaptureReader>(tracebuffer_filename);
+		// without a window, all entries are sorted, so all of them are needed first
+		if (!window)
+			capture->read_all();
+		buffer = capture->buffer();
+	} else {
+		buffer = mmap_file(tracebuffer_filename);
 	}
-
-	const std::span<uint64_t> buffer = mmap_file(tracebuffer_filename);
+	// what is still arriving is read by the stream
+	const bool is_arriving = capture && window;
 	printf("buffer: %p\n", buffer.data());
-	if (buffer.size() == 0) {
+	if (buffer.size() == 0 && !is_arriving) {
 		throw std::runtime_error(std::format(
 			"file '{}' seems to be empty.",
 			tracebuffer_filename
@@ -320,12 +826,49 @@ int main(int argc, char * argv []) {
 	}
 
 	try {
-		interpret(buffer, binaries_list, output_streams);
+		// only the binaries the trace maps need their symbols.
+		// if it is still arriving, they are loaded when their mapping comes
+		SymbolLoader symbol_loader {
+			is_arriving ? std::set<std::string> {} : EntryArray::mapped_binaries(buffer),
+			binaries_list,
+			symbol_table_directory,
+			tracebuffer_filename,
+			jobs
+		};
+		if (is_arriving) {
+			interpret_streaming(buffer, window, symbol_loader, output_streams, [&] (std::span<uint64_t> & buffer) {
+				return capture->read_more(buffer);
+			}, [&] (const uint64_t * needed) {
+				capture->release(needed);
+			});
+		} else if (window) {
+			interpret_streaming(buffer, window, symbol_loader, output_streams);
+		} else {
+			const RawEntryArray raw_entry_array { buffer };
+			interpret(raw_entry_array, symbol_loader, output_streams, jobs);
+		}
+		output_streams.finish();
 	} catch (std::exception & e) {
 		throw rethrow_error<std::runtime_error>(e, std::format(
 			"there was an error in interpreting the data @{}.",
 			reinterpret_cast<void *>(buffer.data())
 		));
 	}
+
+	const Mappings::symbol_cache_statistics_t cache = mappings.symbol_cache_statistics();
+	std::cerr << std::format(
+		"symbol cache: {} hits, {} misses ({:.1f} % hits)",
+		cache.hits, cache.misses,
+		cache.hits + cache.misses ? 100.0 * cache.hits / (cache.hits + cache.misses) : 0.0
+	) << std::endl;
+	// every other request would have demangled again
+	const SymbolNames::demangle_statistics_t demangling = symbol_names.demangle_statistics();
+	const double ns_per_demangle = demangling.demangled ? static_cast<double>(demangling.ns_demangling) / demangling.demangled : 0.0;
+	std::cerr << std::format(
+		"demangle: {} of {} names for {} labels in {:.3f} ms, saved about {:.3f} ms",
+		demangling.demangled, symbol_names.size(), demangling.requests,
+		demangling.ns_demangling / 1000000.0,
+		(demangling.requests - demangling.demangled) * ns_per_demangle / 1000000.0
+	) << std::endl;
 	return 0;
 }
@@ -0,0 +1,196 @@
+// runs the server's export path (server/src/btb_export.h, compress.cpp, include/block.h)
+// on a linux host: the kernel side of l4_debugger_get_backtrace_buffer_section
+// is played by host_invoke_debugger, which hands out a recorded .btb section by section.
+// built with the stub headers in ../host_l4, see the Makefile's simulate_export target.
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "btb_export.h"
+#include "mmap_file.hpp"
+
+// the recorded buffer, as if it was still inside the kernel
+static std::span<const uint64_t> recorded_buffer;
+static size_t recorded_position = 0;
+
+l4_msgtag_t host_invoke_debugger (l4_cap_idx_t cap, l4_msgtag_t tag, l4_utcb_t * utcb) {
+	(void) cap;
+	l4_umword_t * mr = l4_utcb_mr_u(utcb)->mr;
+	const size_t remaining = recorded_buffer.size() - recorded_position;
+
+	if (mr[0] == L4_DEBUGGER_GET_BTB_SECTION) {
+		unsigned long * kumem = reinterpret_cast<unsigned long *> (mr[1]);
+		const size_t capacity_in_words = mr[2] - mr[3];
+		const bool full_section_only = mr[4] & FULL_SECTION_ONLY;
+
+		size_t returned = std::min(capacity_in_words, remaining);
+		if (full_section_only && returned < capacity_in_words)
+			returned = 0;
+
+		memcpy(kumem + mr[3], recorded_buffer.data() + recorded_position, returned * sizeof(uint64_t));
+		recorded_position += returned;
+		mr[0] = returned;
+		mr[1] = recorded_buffer.size() - recorded_position;
+	} else {
+		// backtracing control: nothing is running, all words are written already
+		mr[0] = recorded_buffer.size();
+		mr[1] = 0;
+	}
+	return tag;
+}
+
+// everything the export prints goes through this, so we know how much went over the serial line
+typedef struct counting_output_s {
+	FILE * forward_to;
+	size_t bytes;
+} counting_output_t;
+
+// what the calling thread wrote, stdout is line buffered for the pipelined export so lines are written by their thread
+static thread_local size_t thread_bytes = 0;
+
+static ssize_t counting_output_write (void * cookie, const char * buffer, size_t size) {
+	counting_output_t * output = (counting_output_t *) cookie;
+	output->bytes += size;
+	thread_bytes += size;
+	if (output->forward_to)
+		return fwrite(buffer, 1, size, output->forward_to);
+	return size;
+}
+
+static l4_uint64_t us_now () {
+	return l4_tsc_to_us(l4_rdtsc());
+}
+
+static void print_section_header (FILE * report, const char * us_name) {
+	fprintf(report, "%8s %10s %10s %12s %10s %10s\n",
+		"section", "words", "out words", "ratio", "B/word", us_name
+	);
+}
+
+static void print_section_line (
+	FILE * report,
+	unsigned long section,
+	const export_slot_t * slot,
+	size_t bytes,
+	l4_uint64_t us_section
+) {
+	fprintf(report, "%8ld %10ld %10ld %10.2f %% %10.3f %10lld\n",
+		section,
+		slot->returned_words,
+		slot->result_words,
+		100.0 * slot->result_words / slot->returned_words,
+		(double) bytes / slot->returned_words,
+		us_section
+	);
+}
+
+// the per-section report of the pipelined export, from the printer thread.
+// the bytes are what that thread printed, the line of compress_smart comes from the fetching thread.
+typedef struct pipelined_report_s {
+	FILE * report;
+	unsigned long sections;
+	size_t bytes_before;
+} pipelined_report_t;
+
+static void report_pipelined_section (const export_slot_t * slot, l4_uint64_t us_printing, void * context) {
+	pipelined_report_t * pipelined_report = (pipelined_report_t *) context;
+	fflush(stdout);
+	print_section_line(
+		pipelined_report->report, pipelined_report->sections, slot,
+		thread_bytes - pipelined_report->bytes_before, us_printing
+	);
+	pipelined_report->bytes_before = thread_bytes;
+	pipelined_report->sections ++;
+}
+
+int main (int argc, char * argv []) {
+	if (argc < 2) {
+		printf(
+			"usage: simulate_export <input.btb> [<output.traced> [pipelined]]\n"
+			"exports the recorded backtrace buffer like the backtracer server would,\n"
+			"prints sections/s, bytes printed per input word and the compression ratio per section.\n"
+			"the printed export goes to output (which unpack can read), or nowhere.\n"
+		);
+		exit(1);
+	}
+
+	std::string input_filename { argv[1] };
+	recorded_buffer = mmap_file(input_filename);
+
+	counting_output_t output = { NULL, 0 };
+	if (argc > 2) {
+		output.forward_to = fopen(argv[2], "w");
+		if (!output.forward_to) {
+			printf("could not open output '%s'\n", argv[2]);
+			exit(1);
+		}
+	}
+	const bool pipelined = argc > 3 && std::string(argv[3]) == "pipelined";
+
+	// the export code prints to stdout, the report goes where stdout was
+	fflush(stdout);
+	FILE * report = fdopen(dup(fileno(stdout)), "w");
+	cookie_io_functions_t counting_functions = { NULL, counting_output_write, NULL, NULL };
+	stdout = fopencookie(&output, "w", counting_functions);
+	if (pipelined)
+		setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+
+	fprintf(report,
+		"exporting %s: %ld words, %s, %s encoding\n",
+		input_filename.c_str(), recorded_buffer.size(),
+		pipelined ? "pipelined" : "single buffer",
+		export_block_encoding == BLOCK_ENCODING_BASE64 ? "base64" : "hex"
+	);
+
+	unsigned long sections = 0;
+	const l4_uint64_t us_start = us_now();
+	if (pipelined) {
+		print_section_header(report, "print us");
+		pipelined_report_t pipelined_report = { report, 0, 0 };
+		export_statistics_t statistics;
+		if (!export_backtrace_buffer_pipelined(
+			L4_BASE_DEBUGGER_CAP, false, true, &statistics, report_pipelined_section, &pipelined_report
+		)) {
+			fprintf(report, "could not set up the export pipeline\n");
+			exit(1);
+		}
+		sections = statistics.sections;
+		fprintf(report,
+			"fetch+compress %12.6f s, print %12.6f s\n",
+			(double) statistics.us_fetching / 1000000.0,
+			(double) statistics.us_printing / 1000000.0
+		);
+	} else {
+		print_section_header(report, "us");
+		unsigned long remaining_words = 1;
+		while (remaining_words) {
+			const size_t bytes_before = output.bytes;
+			const l4_uint64_t us_section_start = us_now();
+			remaining_words = export_backtrace_buffer_section(L4_BASE_DEBUGGER_CAP, false, true);
+			fflush(stdout);
+			const l4_uint64_t us_section = us_now() - us_section_start;
+
+			const export_slot_t * slot = single_export_slot();
+			if (!slot->returned_words)
+				continue;
+			print_section_line(report, sections, slot, output.bytes - bytes_before, us_section);
+			sections ++;
+		}
+	}
+	fflush(stdout);
+	const double s_total = (double) (us_now() - us_start) / 1000000.0;
+
+	fprintf(report,
+		"%ld sections in %.6f s: %.1f sections/s, %.1f input MB/s\n"
+		"printed %ld B for %ld words: %.3f B/word (raw binary would be 8)\n",
+		sections, s_total, sections / s_total,
+		recorded_buffer.size() * sizeof(uint64_t) / s_total / 1000000.0,
+		output.bytes, recorded_buffer.size(), (double) output.bytes / recorded_buffer.size()
+	);
+
+	fclose(stdout);
+	if (output.forward_to)
+		fclose(output.forward_to);
+	fclose(report);
+}
@@ -1,6 +1,12 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <format>
+#include <map>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -88,7 +94,7 @@ double run_experiment(double mixing_factor) {
 	if (raw_data.size() != decompressed.size()) {
 		std::cout << "raw_data and decompressed differ in length, "
 			"therefore cannot be equal" << std::endl;
-		return 1;
+		exit(1);
 	}
 	auto [raw_mismatch, decomp_mismatch] = std::mismatch(raw_data.begin(), raw_data.end(), decompressed.begin());
 	if (raw_mismatch != raw_data.end()) {
@@ -98,6 +104,7 @@ double run_experiment(double mixing_factor) {
 			<< ", raw_data: " << raw_data[index]
 			<< ", decompressed: " << decompressed[index]
 			<< std::endl;
+		exit(1);
 	} else {
 		if (do_dumps) std::cout << "no difference found, decompression works!" << std::endl;
 	}
@@ -105,8 +112,419 @@ double run_experiment(double mixing_factor) {
 	return ratio;
 }
 
-int main() {
+// the round trips of the other codecs in compress.cpp exit with a message if something differs
+void check (const bool ok, const std::string & what) {
+	if (!ok) {
+		std::cout << "FAILED: " << what << std::endl;
+		exit(1);
+	}
+}
+
+// a trace as the kernel writes it: the BTE_INFO entry, then BTE_STACK entries of a few distinct stacks
+// (some with another start_index), sometimes another entry in between.
+static constexpr uint64_t test_bte_stack = 1 << 0;
+static constexpr uint64_t test_bte_info  = 1 << 2;
+static constexpr uint64_t test_bte_other = 1 << 3;
+static constexpr size_t test_words_per_name = 2;
+static const std::vector<std::string> test_stack_names {
+	"entry_type", "entry_length", "tsc_time", "tsc_duration",
+	"cpu_id", "task_id", "timer_step", "stack_depth", "start_index",
+};
+enum test_stack_offsets_e {
+	test_cpu_id = 4,
+	test_task_id = 5,
+	test_start_index = 8,
+	test_stack_header_length = 9,
+};
+
+std::vector<uint64_t> get_stack_data (const size_t stack_count) {
+	std::mt19937_64 random { 42 };
+	std::vector<uint64_t> data;
+
+	// version, type_count, then the header length of each type and the names of the stack header
+	const size_t type_count = 4;
+	data.insert(data.end(), { test_bte_info, 0, 1000, 0, 3, type_count, test_stack_header_length, 0, 0, 0 });
+	for (const std::string & name : test_stack_names) {
+		uint64_t words [test_words_per_name] = {};
+		memcpy(words, name.data(), std::min(name.size(), sizeof(words)));
+		data.insert(data.end(), words, words + test_words_per_name);
+	}
+	data[1] = data.size();
+
+	uint64_t tsc_time = 2000;
+	for (size_t i = 0; i < stack_count; i++) {
+		tsc_time += 1000 + random() % 50;
+		if (i % 100 == 99)
+			data.insert(data.end(), { test_bte_other, 6, tsc_time, 0, i, random() });
+
+		// the outer frames are shared by all stacks, the inner ones by the stacks of a template
+		const uint64_t stack = random() % 12;
+		const size_t depth = 4 + stack;
+		const uint64_t start_index = random() % 5 == 0 ? 1 : 0;
+		data.insert(data.end(), {
+			test_bte_stack, test_stack_header_length + depth, tsc_time, 10 + random() % 5,
+			i % 2, 10 + (i / 7) % 3, 1, depth, start_index
+		});
+		for (size_t frame = 0; frame < depth; frame++)
+			data.push_back(frame + 3 < depth ? 0x1000000 + stack * 0x100 + frame : 0x400000 + depth - frame);
+	}
+	return data;
+}
+
+// cuts data into sections of some hundred words, wherever that is in the entries.
+// one cut is right behind an entry_type, so the next section has to start with its entry_length.
+std::vector<std::span<const uint64_t>> get_sections (const std::vector<uint64_t> & data) {
+	std::mt19937_64 random { 7 };
+	std::vector<std::span<const uint64_t>> sections;
+	size_t begin = 0;
+	size_t entry = 0;
+	while (begin < data.size()) {
+		size_t end = std::min(begin + 300 + random() % 500, data.size());
+		while (entry + data[entry + 1] <= end && entry + data[entry + 1] < data.size())
+			entry += data[entry + 1];
+		if (sections.size() == 3)
+			end = entry + 1;
+		sections.emplace_back(data.data() + begin, end - begin);
+		begin = end;
+	}
+	return sections;
+}
+
+void check_entropy (const std::vector<uint64_t> & raw_data, const std::string & name) {
+	std::vector<uint8_t> compressed (raw_data.size() * sizeof(uint64_t) * 2);
+	std::array<uint64_t, dictionary_capacity> dictionary;
+	create_dictionary(dictionary, raw_data);
+	const ssize_t compressed_size = compress(compressed, raw_data, dictionary);
+	check(compressed_size >= 0, name + ": compress");
+	compressed.resize(compressed_size);
+
+	std::vector<uint8_t> coded (compressed.size() * 2 + 1024);
+	const ssize_t coded_size = entropy_encode(coded, compressed);
+	check(coded_size >= 0, name + ": entropy_encode");
+	const std::vector<uint8_t> decoded = entropy_decode(std::span { coded.data(), static_cast<size_t>(coded_size) });
+	check(decoded == compressed, name + ": entropy_decode does not give the output of compress");
+	const std::vector<uint64_t> decompressed = decompress(decoded, dictionary);
+	check(decompressed == raw_data, name + ": entropy coded words do not decompress");
+
+	std::cout << std::format(
+		"entropy {}: {} B of keys and raw words coded into {} B",
+		name, compressed.size(), coded_size
+	) << std::endl;
+}
+
+void check_dictionary_delta (const std::vector<uint64_t> & previous_data, const std::vector<uint64_t> & fresh_data) {
+	std::array<uint64_t, dictionary_capacity> previous;
+	std::array<uint64_t, dictionary_capacity> fresh;
+	create_dictionary(previous, previous_data);
+	create_dictionary(fresh, fresh_data);
+
+	std::vector<uint64_t> evolved;
+	std::vector<uint64_t> delta;
+	make_dictionary_delta(previous, fresh, evolved, delta);
+	for (const uint64_t word : fresh)
+		check(!word || std::find(evolved.begin(), evolved.end(), word) != evolved.end(), "dictionary delta loses a fresh word");
+
+	std::vector<uint64_t> applied (previous.begin(), previous.end());
+	check(apply_dictionary_delta(applied, delta), "dictionary delta does not apply to its previous dictionary");
+	check(applied == evolved, "applied dictionary delta differs from the evolved dictionary");
+
+	std::vector<uint8_t> compressed (fresh_data.size() * sizeof(uint64_t) * 2);
+	const ssize_t compressed_size = compress(compressed, fresh_data, applied);
+	check(compressed_size >= 0, "compress with the evolved dictionary");
+	check(
+		decompress(std::span { compressed.data(), static_cast<size_t>(compressed_size) }, applied) == fresh_data,
+		"words do not decompress with the evolved dictionary"
+	);
+
+	// a receiver that missed a section has another dictionary, it must not use the delta
+	std::vector<uint64_t> missed (previous.begin(), previous.end());
+	missed[dictionary_capacity - 1] ^= 1;
+	check(!apply_dictionary_delta(missed, delta), "dictionary delta applies to the wrong dictionary");
+	std::vector<uint64_t> cut (previous.begin(), previous.end());
+	check(!apply_dictionary_delta(cut, std::span { delta }.first(2)), "cut off dictionary delta applies");
+
+	std::cout << std::format(
+		"dictionary delta: {} words instead of {}",
+		delta.size(), dictionary_capacity
+	) << std::endl;
+}
+
+void check_stack_delta (const std::vector<uint64_t> & data) {
+	size_t words_in = 0;
+	size_t words_encoded = 0;
+	size_t sections_encoded = 0;
+	std::vector<uint64_t> encoded;
+	for (const std::span<const uint64_t> section : get_sections(data)) {
+		if (!stack_delta_encode(encoded, section))
+			continue;
+		const std::vector<uint64_t> decoded = stack_delta_decode(encoded);
+		check(
+			std::equal(decoded.begin(), decoded.end(), section.begin(), section.end()),
+			std::format("stack delta section at word {} does not decode", section.data() - data.data())
+		);
+		words_in += section.size();
+		words_encoded += encoded.size();
+		sections_encoded ++;
+	}
+	check(sections_encoded > 0, "stack delta did not encode any section");
+
+	std::cout << std::format(
+		"stack delta: {} sections, {} words into {}",
+		sections_encoded, words_in, words_encoded
+	) << std::endl;
+}
+
+// the samples of one stack: cpu_id, task_id, start_index and payload
+typedef struct stack_samples_s {
+	uint64_t count = 0;
+	uint64_t tsc_duration_sum = 0;
+	uint64_t tsc_first = ~0ul;
+	uint64_t tsc_last = 0;
+
+	void add (uint64_t count, uint64_t tsc_duration, uint64_t tsc_first, uint64_t tsc_last) {
+		this->count += count;
+		tsc_duration_sum += tsc_duration;
+		this->tsc_first = std::min(this->tsc_first, tsc_first);
+		this->tsc_last = std::max(this->tsc_last, tsc_last);
+	}
+	bool operator== (const struct stack_samples_s &) const = default;
+} stack_samples_t;
+
+static std::vector<uint64_t> stack_key (std::span<const uint64_t> entry) {
+	std::vector<uint64_t> key { entry[test_cpu_id], entry[test_task_id], entry[test_start_index] };
+	key.insert(key.end(), entry.begin() + test_stack_header_length, entry.end());
+	return key;
+}
+
+// the samples of each stack and the other entries, with BTE_STACK_REF entries expanded as interpret does
+static void collect_samples (
+	std::span<const uint64_t> data,
+	std::map<std::vector<uint64_t>, stack_samples_t> & samples,
+	std::vector<uint64_t> & others
+) {
+	std::map<uint64_t, std::pair<uint64_t, std::vector<uint64_t>>> definitions;
+	for (size_t position = 0; position < data.size(); position += data[position + 1]) {
+		std::span const entry = data.subspan(position, data[position + 1]);
+		if (entry[0] == test_bte_stack) {
+			samples[stack_key(entry)].add(1, entry[stack_ref_tsc_duration], entry[stack_ref_tsc_time], entry[stack_ref_tsc_time]);
+		} else if (entry[0] == stack_ref_entry_type) {
+			const uint64_t stack_id = entry[stack_ref_stack_id];
+			const uint64_t generation = entry[stack_ref_generation];
+			if (entry.size() > stack_ref_header_words)
+				definitions[stack_id] = { generation, { entry.begin() + stack_ref_header_words, entry.end() } };
+			const auto found = definitions.find(stack_id);
+			check(
+				found != definitions.end() && found->second.first == generation,
+				std::format("BTE_STACK_REF at word {} refers to an undefined stack", position)
+			);
+			samples[stack_key(found->second.second)].add(
+				entry[stack_ref_count], entry[stack_ref_tsc_duration], entry[stack_ref_tsc_first], entry[stack_ref_tsc_time]
+			);
+		} else {
+			others.insert(others.end(), entry.begin(), entry.end());
+		}
+	}
+}
+
+void check_stack_intern (const std::vector<uint64_t> & data) {
+	std::vector<uint64_t> interned;
+	for (const std::span<const uint64_t> section : get_sections(data)) {
+		std::vector<uint64_t> words (section.begin(), section.end());
+		const size_t length = stack_intern_section(words);
+		check(length <= section.size(), "interned section is longer than the section");
+		interned.insert(interned.end(), words.begin(), words.begin() + length);
+	}
+
+	std::map<std::vector<uint64_t>, stack_samples_t> expected;
+	std::map<std::vector<uint64_t>, stack_samples_t> expanded;
+	std::vector<uint64_t> expected_others;
+	std::vector<uint64_t> expanded_others;
+	collect_samples(data, expected, expected_others);
+	collect_samples(interned, expanded, expanded_others);
+	check(expanded_others == expected_others, "interning changed the entries that are no stacks");
+	check(expanded == expected, "interned stacks expand to other samples");
+
+	std::cout << std::format(
+		"stack intern: {} distinct stacks, {} words into {}",
+		expected.size(), data.size(), interned.size()
+	) << std::endl;
+}
+
+// the dictionary coder as it was before the hashed tables in compress.cpp:
+// linear search of the candidates per raw word and of the dictionary per key.
+// it produces the same wire format and only serves as reference for the benchmark.
+namespace linear {
+	static constexpr uint8_t zero_marker = 0x00;
+	static constexpr uint8_t  raw_marker = 0x01;
+
+	class dict_node {
+	public:
+		uint64_t raw = 0;
+		uint64_t occurrences = 0;
+
+		dict_node () = default;
+		dict_node (uint64_t raw) : raw(raw), occurrences(1) {}
+
+		bool operator < (const dict_node & other) {
+			return occurrences < other.occurrences;
+		}
+	};
+
+	size_t create_dictionary (
+		std::span<      uint64_t> const & dictionary,
+		std::span<const uint64_t> const & raw_data
+	) {
+		std::vector<dict_node> dict_heap;
+		dict_heap.reserve(dictionary.size());
+
+		for (const auto & raw : raw_data) {
+			const auto node_ptr = std::find_if(dict_heap.begin(), dict_heap.end(),
+				[&raw] (const dict_node & node) {
+					return node.raw == raw;
+				}
+			);
+			if (node_ptr != dict_heap.end()) {
+				node_ptr->occurrences ++;
+				std::make_heap(dict_heap.begin(), dict_heap.end());
+			} else {
+				dict_heap.emplace_back(raw);
+				std::push_heap(dict_heap.begin(), dict_heap.end());
+			}
+
+			if (dict_heap.size() >= 2 * dictionary.size()) {
+				dict_heap.resize(dictionary.size());
+			}
+		}
+
+		size_t actual_dictionary_used = 0;
+		for (auto entry = dictionary.begin(); entry < dictionary.end(); ++entry) {
+			uint8_t key = entry - dictionary.begin();
+			if (key == zero_marker || key == raw_marker) {
+				*entry = 0;
+				continue;
+			}
+			if (dict_heap.empty()) {
+				if (actual_dictionary_used == 0) {
+					actual_dictionary_used = entry - dictionary.begin();
+				}
+				*entry = 0;
+				continue;
+			}
+
+			std::pop_heap(dict_heap.begin(), dict_heap.end());
+			*entry = dict_heap.back().raw;
+			dict_heap.pop_back();
+		}
+		if (actual_dictionary_used == 0) {
+			actual_dictionary_used = dictionary.size();
+		}
+
+		return actual_dictionary_used;
+	}
+
+	ssize_t compress (
+		std::span<uint8_t>        const   compressed,
+		std::span<const uint64_t> const & raw_data,
+		std::span<const uint64_t> const & dictionary
+	) {
+		auto comp = compressed.begin();
+		for (const auto & raw : raw_data) {
+			auto key = std::find(dictionary.begin(), dictionary.end(), raw);
+			if (key == dictionary.end()) {
+				if (comp + sizeof(uint64_t) + 1 > compressed.end())
+					return -1;
+				*comp = raw_marker;
+				++comp;
+				std::copy_n(reinterpret_cast<const uint8_t *>(&raw), sizeof(uint64_t), comp);
+				comp += sizeof(uint64_t);
+			} else {
+				if (comp + 1 > compressed.end())
+					return -1;
+				*comp = static_cast<uint8_t> (key - dictionary.begin());
+				++comp;
+			}
+		}
+		return comp - compressed.begin();
+	}
+}
+
+// words per second of create_dictionary + compress,
+// checks that the result decompresses to raw_data again.
+template <typename CreateDictionary, typename Compress>
+double words_per_second (
+	const std::vector<uint64_t> & raw_data,
+	CreateDictionary create_dictionary_function,
+	Compress compress_function
+) {
+	std::vector<uint8_t> compressed;
+	compressed.resize(raw_data.size() * sizeof(uint64_t) * 2);
+	std::array<uint64_t, dictionary_capacity> dictionary;
+
+	using clock = std::chrono::steady_clock;
+	const auto minimum_duration = std::chrono::milliseconds(200);
+	size_t repetitions = 0;
+	ssize_t compressed_size = 0;
+	const auto start = clock::now();
+	auto stop = start;
+	do {
+		create_dictionary_function(std::span { dictionary }, std::span<const uint64_t> { raw_data });
+		compressed_size = compress_function(compressed, raw_data, dictionary);
+		repetitions ++;
+		stop = clock::now();
+	} while (stop - start < minimum_duration);
+
+	if (compressed_size < 0) {
+		std::cout << "could not compress into result array!" << std::endl;
+		exit(1);
+	}
+	auto decompressed = decompress(
+		std::span { compressed.data(), static_cast<size_t>(compressed_size) },
+		dictionary
+	);
+	if (!std::equal(raw_data.begin(), raw_data.end(), decompressed.begin(), decompressed.end())) {
+		std::cout << "benchmarked compression does not decompress to raw_data!" << std::endl;
+		exit(1);
+	}
+
+	const double seconds = std::chrono::duration<double>(stop - start).count();
+	return static_cast<double>(repetitions * raw_data.size()) / seconds;
+}
+
+void run_benchmark () {
+	std::cout << std::format(
+		"{:>13} {:>16} {:>16} {:>8}",
+		"mixing_factor", "linear [w/s]", "hashed [w/s]", "speedup"
+	) << std::endl;
+	for (double mixing_factor = 0; mixing_factor <= 1; mixing_factor += .1) {
+		auto raw_data = get_raw_data(1 << 12, mixing_factor);
+		double linear_words_per_second = words_per_second(raw_data, linear::create_dictionary, linear::compress);
+		double hashed_words_per_second = words_per_second(raw_data, create_dictionary, compress);
+		std::cout << std::format(
+			"{:13.3f} {:16.0f} {:16.0f} {:7.1f}x",
+			mixing_factor,
+			linear_words_per_second,
+			hashed_words_per_second,
+			hashed_words_per_second / linear_words_per_second
+		) << std::endl;
+	}
+}
+
+int main(int argc, char * argv []) {
+	if (argc > 1 && std::string(argv[1]) == "bench") {
+		run_benchmark();
+		return 0;
+	}
+
 	for (double mixing_factor = 0; mixing_factor <= 1; mixing_factor += .1) {
 		run_experiment(mixing_factor);
 	}
+
+	const std::vector<uint64_t> stack_data = get_stack_data(4000);
+	for (double mixing_factor = 0; mixing_factor <= 1; mixing_factor += .25)
+		check_entropy(get_raw_data(1 << 12, mixing_factor), std::format("mixing_factor {:1.3f}", mixing_factor));
+	check_entropy(stack_data, "stacks");
+	check_dictionary_delta(get_raw_data(1 << 12, .25), get_raw_data(1 << 12, .75));
+	check_dictionary_delta(std::vector<uint64_t> (stack_data.begin(), stack_data.begin() + 4096), stack_data);
+	check_stack_delta(stack_data);
+	check_stack_intern(stack_data);
 }
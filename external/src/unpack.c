@@ -1,14 +1,95 @@
+// for memmem
+#define _GNU_SOURCE
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#include <block.h>
+#include "unpack.h"
 
-#define BLOCK_ARRAY_CAPACITY 64
 const bool dbg = false;
 
+const char * find_block_marker (
+	const char * line_buffer,
+	unsigned long line_buffer_filled,
+	const char * block_marker
+) {
+	const unsigned long marker_length = strlen(block_marker);
+	if (line_buffer_filled <= marker_length)
+		return 0;
+
+	// the marker has to end before the line's '\0'
+	return (const char *) memmem(line_buffer, line_buffer_filled - 1, block_marker, marker_length);
+}
+
+// cat -v shows control characters as ^X, those with the high bit set as M-X (M-^X),
+// all but tab and newline
+static unsigned long show_nonprinting (char * target, unsigned char c) {
+	unsigned long t = 0;
+	if (c >= 128) {
+		target[t++] = 'M';
+		target[t++] = '-';
+		c -= 128;
+		if (c < 32 || c == 127) {
+			target[t++] = '^';
+			target[t++] = c == 127 ? '?' : c + 64;
+		} else {
+			target[t++] = c;
+		}
+	} else if (c == 127) {
+		target[t++] = '^';
+		target[t++] = '?';
+	} else if (c < 32 && c != '\t' && c != '\n') {
+		target[t++] = '^';
+		target[t++] = c + 64;
+	} else {
+		target[t++] = c;
+	}
+	return t;
+}
+
+unsigned long clean_line (char * target, const char * source, unsigned long length) {
+	unsigned long filled = 0;
+	for (unsigned long i = 0; i < length; i++)
+		filled += show_nonprinting(target + filled, source[i]);
+
+	// sed 's/\^\[\[[0-9]*m//g', in place, left to right
+	unsigned long kept = 0;
+	for (unsigned long i = 0; i < filled;) {
+		if (i + 3 <= filled && 0 == strncmp(target + i, "^[[", 3)) {
+			unsigned long end = i + 3;
+			while (end < filled && '0' <= target[end] && target[end] <= '9')
+				end++;
+			if (end < filled && target[end] == 'm') {
+				i = end + 1;
+				continue;
+			}
+		}
+		target[kept++] = target[i++];
+	}
+	filled = kept;
+
+	// sed 's/\^M//g'
+	kept = 0;
+	for (unsigned long i = 0; i < filled;) {
+		if (i + 2 <= filled && target[i] == '^' && target[i + 1] == 'M') {
+			i += 2;
+			continue;
+		}
+		target[kept++] = target[i++];
+	}
+	target[kept] = '\0';
+	return kept;
+}
+
+#ifndef UNPACK_LIBRARY
 unsigned long get_block_line (
 	char ** block_line,
 	FILE * file,
@@ -41,20 +122,94 @@ unsigned long get_block_line (
 		line_buffer[line_buffer_filled - 1] = '\0';
 		(*line_number) ++;
 
-		if (line_buffer_filled < strlen(block_marker))
+		const char * marker = find_block_marker(line_buffer, line_buffer_filled, block_marker);
+		if (marker) {
+			// we found the block
+			*block_line = (char *) marker;
+			return line_buffer_filled - (marker - line_buffer);
+		}
+	} while (line_buffer_filled); // while we still get bytes
+	if (dbg) printf("no line after line number %4ld\n", *line_number);
+}
+
+// a regular input file, mapped as a whole. lines are found with memchr and markers with memmem,
+// only the lines with a marker are copied out of it.
+typedef struct mapped_input_s {
+	const char * data;
+	unsigned long size;
+	unsigned long position;
+	char * line_buffer;
+	unsigned long line_buffer_capacity;
+} mapped_input_t;
+
+// false if the input is not a regular file or can't be mapped, then it is read with getline
+bool map_input (mapped_input_t * input, int input_fd) {
+	struct stat status;
+	if (fstat(input_fd, &status) < 0 || !S_ISREG(status.st_mode) || status.st_size == 0)
+		return false;
+
+	void * data = mmap(0, status.st_size, PROT_READ, MAP_PRIVATE, input_fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap input");
+		return false;
+	}
+	madvise(data, status.st_size, MADV_SEQUENTIAL);
+
+	input->data = (const char *) data;
+	input->size = status.st_size;
+	input->position = 0;
+	input->line_buffer_capacity = 1024;
+	input->line_buffer = (char *) malloc(input->line_buffer_capacity);
+	if (!input->line_buffer) {
+		perror("malloc line_buffer");
+		exit(1);
+	}
+	return true;
+}
+
+void unmap_input (mapped_input_t * input) {
+	munmap((void *) input->data, input->size);
+	free(input->line_buffer);
+}
+
+// get_block_line for a mapped input, with the same line numbers and lines.
+// like there, a last line without '\n' loses its last character to the '\0'.
+unsigned long get_mapped_block_line (
+	char ** block_line,
+	mapped_input_t * input,
+	unsigned long * line_number,
+	const char * block_marker
+) {
+	while (input->position < input->size) {
+		const char * line = input->data + input->position;
+		const unsigned long rest = input->size - input->position;
+		const char * newline = (const char *) memchr(line, '\n', rest);
+		const unsigned long line_filled = newline ? (unsigned long) (newline - line) + 1 : rest;
+		input->position += line_filled;
+		(*line_number) ++;
+
+		const char * marker = find_block_marker(line, line_filled, block_marker);
+		if (!marker)
 			continue;
 
-		for (unsigned long i = 0; i < line_buffer_filled - strlen(block_marker); i++) {
-			// if (dbg) printf("i == %3ld / %3ld!\n", i, line_buffer_filled);
-			if (0 == strncmp(line_buffer + i, block_marker, strlen(block_marker))) {
-				// we found the block
-				*block_line = line_buffer + i;
-				return line_buffer_filled - i;
+		const unsigned long block_line_filled = line_filled - (marker - line);
+		if (block_line_filled > input->line_buffer_capacity) {
+			input->line_buffer_capacity = block_line_filled;
+			input->line_buffer = (char *) realloc(input->line_buffer, input->line_buffer_capacity);
+			if (!input->line_buffer) {
+				perror("realloc line_buffer");
+				exit(1);
 			}
 		}
-	} while (line_buffer_filled); // while we still get bytes
+		memcpy(input->line_buffer, marker, block_line_filled - 1);
+		input->line_buffer[block_line_filled - 1] = '\0';
+		*block_line = input->line_buffer;
+		return block_line_filled;
+	}
 	if (dbg) printf("no line after line number %4ld\n", *line_number);
+	return 0;
 }
+#endif
 
 bool is_hex(char c) {
 	return (
@@ -84,7 +239,217 @@ bool to_mword(const char * buffer, unsigned long * result, unsigned long * to_sk
 	return true;
 }
 
-void add_to_raw_block_data(
+// set by unpack --scalar: decode data character by character with from_hex and from_base64,
+// and read the input with getline
+static bool scalar_only = false;
+
+// the value of each character from_hex accepts, 0xff for all others
+static const unsigned char hex_values [256] = {
+	/* 0x00 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x10 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x20 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x30 */    0,    1,    2,    3,    4,    5,    6,    7,    8,    9, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x40 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x50 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x60 */ 0xff,   10,   11,   12,   13,   14,   15, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x70 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x80 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x90 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xa0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xb0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xc0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xd0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xe0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xf0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+// the 16 digits of a data word by table lookup, without a branch per character.
+// false if any of them is not a digit, then result is not written.
+static bool hex_word_table (const char * buffer, unsigned long * result) {
+	unsigned long value = 0;
+	unsigned char invalid = 0;
+	for (unsigned long i = 0; i < 16; i++) {
+		const unsigned char nibble = hex_values[(unsigned char) buffer[i]];
+		invalid |= nibble;
+		value = (value << 4) | (nibble & 0xf);
+	}
+	if (invalid & 0xf0)
+		return false;
+	*result = value;
+	return true;
+}
+
+#ifdef __SSE2__
+// the same with all 16 digits in one vector
+static bool hex_word_vector (const char * buffer, unsigned long * result) {
+	const __m128i chars = _mm_loadu_si128((const __m128i *) buffer);
+	// signed compares, characters from 128 up are below '0'
+	const __m128i is_digit = _mm_and_si128(
+		_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+		_mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1))
+	);
+	const __m128i is_letter = _mm_and_si128(
+		_mm_cmpgt_epi8(chars, _mm_set1_epi8('a' - 1)),
+		_mm_cmplt_epi8(chars, _mm_set1_epi8('f' + 1))
+	);
+	if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xffff)
+		return false;
+
+	const __m128i nibbles = _mm_sub_epi8(chars, _mm_or_si128(
+		_mm_and_si128(is_digit,  _mm_set1_epi8('0')),
+		_mm_and_si128(is_letter, _mm_set1_epi8('a' - 10))
+	));
+	// each 16 bit lane has the higher digit of a byte in its low half
+	const __m128i pairs = _mm_or_si128(
+		_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0xff)), 4),
+		_mm_srli_epi16(nibbles, 8)
+	);
+	// the bytes in the order they were printed, most significant first
+	const __m128i bytes = _mm_packus_epi16(pairs, pairs);
+	*result = __builtin_bswap64((unsigned long) _mm_cvtsi128_si64(bytes));
+	return true;
+}
+#define hex_word_fast hex_word_vector
+#else
+#define hex_word_fast hex_word_table
+#endif
+
+// to_mword for the 16 digits of a data word. buffer needs 16 readable chars.
+// only if they are not all digits, to_mword finds where to try again.
+bool to_data_word (const char * buffer, unsigned long * result, unsigned long * to_skip) {
+	if (!scalar_only && hex_word_fast(buffer, result)) {
+		*to_skip = 16;
+		return true;
+	}
+	return to_mword(buffer, result, to_skip, 16);
+}
+
+int from_base64(char c) {
+	if ('A' <= c && c <= 'Z') return c - 'A';
+	if ('a' <= c && c <= 'z') return c - 'a' + 26;
+	if ('0' <= c && c <= '9') return c - '0' + 52;
+	if (c == '+') return 62;
+	if (c == '/') return 63;
+	return -1;
+}
+
+// the value of each character from_base64 accepts, 0xff for all others
+static const unsigned char base64_values [256] = {
+	/* 0x00 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x10 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x20 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,   62, 0xff, 0xff, 0xff,   63,
+	/* 0x30 */   52,   53,   54,   55,   56,   57,   58,   59,   60,   61, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x40 */ 0xff,    0,    1,    2,    3,    4,    5,    6,    7,    8,    9,   10,   11,   12,   13,   14,
+	/* 0x50 */   15,   16,   17,   18,   19,   20,   21,   22,   23,   24,   25, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x60 */ 0xff,   26,   27,   28,   29,   30,   31,   32,   33,   34,   35,   36,   37,   38,   39,   40,
+	/* 0x70 */   41,   42,   43,   44,   45,   46,   47,   48,   49,   50,   51, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x80 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0x90 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xa0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xb0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xc0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xd0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xe0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	/* 0xf0 */ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
+
+// decodes unpadded base64 as written by encode_base64 in block.h.
+// returns the number of bytes written to target or -1 if source is not valid.
+long decode_base64(unsigned char * target, unsigned long capacity, const char * source, unsigned long chars) {
+	if (chars % 4 == 1 || chars / 4 * 3 + (chars % 4 ? chars % 4 - 1 : 0) > capacity)
+		return -1;
+
+	unsigned long t = 0;
+	unsigned long c = 0;
+	if (!scalar_only) {
+		// whole quads by table lookup, checked for invalid characters once per quad
+		for (; c + 4 <= chars; c += 4) {
+			const unsigned char a = base64_values[(unsigned char) source[c    ]];
+			const unsigned char b = base64_values[(unsigned char) source[c + 1]];
+			const unsigned char d = base64_values[(unsigned char) source[c + 2]];
+			const unsigned char e = base64_values[(unsigned char) source[c + 3]];
+			if ((a | b | d | e) & 0xc0)
+				return -1;
+
+			const unsigned long quad = (a << 18) | (b << 12) | (d << 6) | e;
+			target[t++] = (quad >> 16) & 0xff;
+			target[t++] = (quad >>  8) & 0xff;
+			target[t++] =  quad        & 0xff;
+		}
+	}
+
+	unsigned long quad = 0;
+	for (; c < chars; c++) {
+		int value = from_base64(source[c]);
+		if (value < 0)
+			return -1;
+
+		quad = (quad << 6) | value;
+		if (c % 4 == 3) {
+			target[t++] = (quad >> 16) & 0xff;
+			target[t++] = (quad >>  8) & 0xff;
+			target[t++] =  quad        & 0xff;
+			quad = 0;
+		}
+	}
+	if (chars % 4 == 2) {
+		target[t++] = (quad >> 4) & 0xff;
+	} else if (chars % 4 == 3) {
+		target[t++] = (quad >> 10) & 0xff;
+		target[t++] = (quad >>  2) & 0xff;
+	}
+	return t;
+}
+
+// reads the words and checksum of a BLOCK_ENCODING_BASE64 line into the block buffer.
+bool add_base64_line(
+	unsigned long * block_buffer,
+	unsigned long * block_buffer_filled,
+	const char * line_buffer,
+	unsigned long data_start_index
+) {
+	const char * data = line_buffer + data_start_index;
+	while (*data == ' ')
+		data++;
+
+	unsigned long chars = 0;
+	while (data[chars] && data[chars] != ' ')
+		chars++;
+
+	unsigned char bytes [BLOCK_BASE64_WORD_COLUMNS * sizeof(unsigned long)];
+	long length = decode_base64(bytes, sizeof(bytes), data, chars);
+	if (length < 0 || length % sizeof(unsigned long)) {
+		printf("could not decode base64 data in '%s'!\n", line_buffer);
+		return false;
+	}
+
+	unsigned long checksum;
+	unsigned long to_skip;
+	if (data[chars] != ' ' || !to_mword(data + chars + 1, &checksum, &to_skip, block_base64_checksum_chars)) {
+		printf("could not read checksum in '%s'!\n", line_buffer);
+		return false;
+	}
+	if (checksum != block_line_checksum(bytes, length)) {
+		printf(
+			"checksum %04lx of line does not match data (%04x) in '%s'!\n",
+			checksum, block_line_checksum(bytes, length), line_buffer
+		);
+		return false;
+	}
+
+	unsigned long words = length / sizeof(unsigned long);
+	if (*block_buffer_filled + words > sizeof(block_t) / sizeof(unsigned long)) {
+		printf("line has %ld words, more than fit into the block in '%s'!\n", words, line_buffer);
+		return false;
+	}
+	memcpy(block_buffer + *block_buffer_filled, bytes, length);
+	*block_buffer_filled += words;
+	return true;
+}
+
+// returns false if the line could not be read.
+// then the block it belongs to is incomplete and should be dropped.
+bool add_to_raw_block_data(
 	unsigned long * block_buffer,
 	unsigned long * block_buffer_filled,
 	const char * line_buffer,
@@ -134,61 +499,177 @@ void add_to_raw_block_data(
 			printf("could not read offset in line markers starting at %ld in '%s'!\n", offset_start_index, line_buffer);
 			exit(1);
 		}
+		if (*block_buffer_filled == 0 && offset != 0) {
+			printf("skipping line at offset %ld of a dropped block.\n", offset);
+			return false;
+		}
 		if (*block_buffer_filled != offset) {
 			printf("have offset in block %ld, but offset in line markers %ld!\n", *block_buffer_filled, offset);
 			exit(1);
 		}
 	}
 
+	// the header words are always hex, after them we know how the block is encoded
+	const block_t * block = (const block_t *) block_buffer;
+	if (*block_buffer_filled >= block_header_words && block->encoding == BLOCK_ENCODING_BASE64) {
+		return add_base64_line(block_buffer, block_buffer_filled, line_buffer, data_start_index);
+	}
+
 	unsigned long i = data_start_index;
 	for (; i < line_buffer_filled - 16; ) {
-		bool got_word = to_mword(
+		bool got_word = to_data_word(
 			line_buffer + i,
 			block_buffer + *block_buffer_filled,
-			&to_skip,
-			16
+			&to_skip
 		);
 		if (got_word) {
 			(*block_buffer_filled) ++;
 		}
 		i += to_skip;
 	}
+	return true;
 }
 
-block_t * get_free_block(
-	block_t * blocks,
-	bool * block_used,
-	unsigned long block_array_capacity
-) {
-	for (unsigned long b = 0; b < block_array_capacity; b++) {
-		if (!block_used[b])
-			return blocks + b;
+static void block_pool_init (block_pool_t * pool) {
+	pool->chunks_filled = 0;
+	pool->capacity = 0;
+	pool->free_blocks = 0;
+	pool->free_blocks_filled = 0;
+}
+
+static void block_pool_free (block_pool_t * pool) {
+	for (unsigned long c = 0; c < pool->chunks_filled; c++)
+		free(pool->chunks[c]);
+	free(pool->free_blocks);
+	block_pool_init(pool);
+}
+
+// takes a block from the free ones. if there are none, the pool doubles
+block_t * get_free_block (block_pool_t * pool) {
+	if (!pool->free_blocks_filled) {
+		const unsigned long added = pool->capacity ? pool->capacity : BLOCK_POOL_INITIAL_CAPACITY;
+		if (pool->chunks_filled == BLOCK_POOL_CHUNKS) {
+			printf("there is no capacity for more blocks in the pool!\n");
+			exit(1);
+		}
+		block_t * chunk = (block_t *) malloc(added * sizeof(block_t));
+		block_t ** free_blocks = (block_t **) realloc(
+			pool->free_blocks, (pool->capacity + added) * sizeof(block_t *)
+		);
+		if (!chunk || !free_blocks) {
+			perror("malloc block pool");
+			exit(1);
+		}
+		pool->chunks[pool->chunks_filled++] = chunk;
+		pool->free_blocks = free_blocks;
+		pool->capacity += added;
+		// the chunk is handed out from its start
+		for (unsigned long b = added; b > 0; b--)
+			pool->free_blocks[pool->free_blocks_filled++] = chunk + b - 1;
 	}
+	return pool->free_blocks[--pool->free_blocks_filled];
+}
 
-	return 0;
+void release_block (block_pool_t * pool, block_t * block) {
+	pool->free_blocks[pool->free_blocks_filled++] = block;
+}
+
+// makes section_blocks hold the ids from base_id up to at least end_id.
+// there must be no blocks before base_id in it.
+static void reserve_section_blocks (unpacker_t * unpacker, unsigned long base_id, unsigned long end_id) {
+	if (!unpacker->section_blocks_filled) {
+		// all entries are null, nothing to move
+		unpacker->base_id = base_id;
+		unpacker->end_id = base_id;
+	}
+	if (end_id < unpacker->end_id)
+		end_id = unpacker->end_id;
+
+	const unsigned long needed = end_id - base_id;
+	if (needed > unpacker->section_blocks_capacity) {
+		unsigned long capacity = unpacker->section_blocks_capacity;
+		while (capacity < needed)
+			capacity *= 2;
+		block_t ** section_blocks = (block_t **) realloc(
+			unpacker->section_blocks, capacity * sizeof(block_t *)
+		);
+		if (!section_blocks) {
+			perror("realloc section_blocks");
+			exit(1);
+		}
+		for (unsigned long s = unpacker->section_blocks_capacity; s < capacity; s++)
+			section_blocks[s] = 0;
+		unpacker->section_blocks = section_blocks;
+		unpacker->section_blocks_capacity = capacity;
+	}
+
+	block_t ** section_blocks = unpacker->section_blocks;
+	const unsigned long filled = unpacker->end_id - unpacker->base_id;
+	if (base_id < unpacker->base_id) {
+		// a block before the others, they move up
+		const unsigned long shift = unpacker->base_id - base_id;
+		memmove(section_blocks + shift, section_blocks, filled * sizeof(block_t *));
+		for (unsigned long s = 0; s < shift && s < filled; s++)
+			section_blocks[s] = 0;
+	} else if (base_id > unpacker->base_id) {
+		const unsigned long shift = base_id - unpacker->base_id;
+		if (shift < filled)
+			memmove(section_blocks, section_blocks + shift, (filled - shift) * sizeof(block_t *));
+		for (unsigned long s = shift < filled ? filled - shift : 0; s < filled; s++)
+			section_blocks[s] = 0;
+	}
+	unpacker->base_id = base_id;
+	unpacker->end_id = end_id;
+}
+
+// files a completed data block under its id, until the redundancy block of its section comes
+static void add_section_block (unpacker_t * unpacker, block_t * block) {
+	const unsigned long id = block->id;
+	if (id < unpacker->next_section_id) {
+		printf(
+			"ignoring block with id %ld from old section "
+			"(start of current section is %ld)!\n",
+			id, unpacker->next_section_id
+		);
+		release_block(&unpacker->pool, block);
+		return;
+	}
+
+	reserve_section_blocks(
+		unpacker,
+		unpacker->section_blocks_filled && unpacker->base_id < id ? unpacker->base_id : id,
+		id + 1
+	);
+	block_t ** slot = &unpacker->section_blocks[id - unpacker->base_id];
+	if (*slot) {
+		printf("error: non-redundancy block (id = %ld) has same id as previous block\n", id);
+		release_block(&unpacker->pool, block);
+		return;
+	}
+	*slot = block;
+	unpacker->section_blocks_filled++;
+	if (dbg) printf("section block id %ld at %p\n", id, block);
 }
 
 void recover_block(
-	block_t * blocks,
-	bool * block_used,
-	unsigned long block_array_capacity,
-	const block_t ** reorder,
-	unsigned long reorder_capacity,
+	block_pool_t * pool,
+	block_t ** section_blocks,
+	unsigned long section_length,
 	const block_t * redundancy_block,
 	unsigned long block_id_start
 ) {
-	block_t * recovered_block = get_free_block(blocks, block_used, block_array_capacity);
-	if (!recovered_block) {
-		printf("there is no capacity for the missing block to be recovered!\n");
-		exit(1);
-	}
+	block_t * recovered_block = get_free_block(pool);
 	recovered_block->id = -1; // start with invalid id
+	// every block is padded with zeros, so xor all of the data
+	recovered_block->data_length_in_words = block_data_capacity_in_words;
+	recovered_block->flags = 0;
+	recovered_block->encoding = 0;
 	for (unsigned long d = 0; d < block_data_capacity_in_words; d++) {
 		recovered_block->data[d] = 0;
 	}
-	for (unsigned long r = 0; r < reorder_capacity; r++) {
+	for (unsigned long r = 0; r < section_length; r++) {
 		unsigned long id = r + block_id_start;
-		if (reorder[r]) {
+		if (section_blocks[r]) {
 			printf (
 				"recovered_block: id %016lx, len %016lx, flags %016lx, data:\n"
 				"%016lx %016lx %016lx %016lx\n%016lx %016lx %016lx %016lx\n",
@@ -196,7 +677,7 @@ void recover_block(
 				recovered_block->data[0], recovered_block->data[1], recovered_block->data[2], recovered_block->data[3],
 				recovered_block->data[4], recovered_block->data[5], recovered_block->data[6], recovered_block->data[7]
 			);
-			xor_blocks(recovered_block, reorder[r]);
+			xor_blocks(recovered_block, section_blocks[r]);
 			continue;
 		}
 		if (recovered_block->id != -1) {
@@ -208,12 +689,9 @@ void recover_block(
 			exit(1);
 		}
 
-		printf(
-			"recovering block (r = %ld, id = %ld, idx = %ld)\n",
-			r, id, recovered_block - blocks
-		);
+		printf("recovering block (r = %ld, id = %ld)\n", r, id);
 		recovered_block->id = id;
-		reorder[r] = recovered_block;
+		section_blocks[r] = recovered_block;
 		recovered_block->data_length_in_words = block_data_capacity_in_words;
 		// free guess. TODO?
 		// maybe some 0-detection for the end of the block?
@@ -236,81 +714,50 @@ void recover_block(
 	);
 }
 
-unsigned long make_reorder(
-	const block_t *** reorder,
-	unsigned long * reorder_capacity,
-	block_t * blocks,
-	bool * block_used,
-	unsigned long block_array_capacity,
-	unsigned long block_id_start
-) {
-	unsigned long max_id = 0;
-	unsigned long block_use_count = 0;
-	for (unsigned long b = 0; b < block_array_capacity; b++) {
-		if (!block_used[b])
-			continue;
-
-		block_use_count++;
-		if (blocks[b].id > max_id) {
-			max_id = blocks[b].id;
-		}
-	}
-	unsigned long rel_max_id = max_id - block_id_start;
-	unsigned long reorder_capacity_needed = rel_max_id + 1;
-
-	printf("max_id %ld among %ld blocks, %ld read blocks\n", max_id, reorder_capacity_needed, block_use_count);
-	if (reorder_capacity_needed > *reorder_capacity) {
-		*reorder = (const block_t **) realloc((void *) reorder, reorder_capacity_needed * sizeof(block_t *));
-		*reorder_capacity = reorder_capacity_needed;
-		if (!*reorder) {
-			perror("realloc reorder");
-			exit(1);
-		}
-	}
-
-	for (unsigned long r = 0; r <= rel_max_id; r++) {
-		(*reorder)[r] = 0;
+// the section of the redundancy block goes from its id to the highest id filed since.
+// recovers a missing block and returns how many blocks of section_blocks make up the section,
+// 0 if the redundancy block belongs to a section that is done already.
+unsigned long complete_section(unpacker_t * unpacker, const block_t * redundancy_block) {
+	const unsigned long block_id_start = redundancy_block->id;
+	if (block_id_start < unpacker->next_section_id) {
+		printf(
+			"ignoring redundancy block with id %ld from old section "
+			"(start of current section is %ld)!\n",
+			block_id_start, unpacker->next_section_id
+		);
+		return 0;
 	}
 
-	block_t * redundancy_block = 0;
-	unsigned long missing = reorder_capacity_needed; // -- for each found block
-	for (unsigned long b = 0; b < block_array_capacity; b++) {
-		if (!block_used[b])
-			continue;
-
-		unsigned long id = blocks[b].id;
-		if (id < block_id_start) {
-			printf(
-				"ignoring block with id %ld from old section "
-				"(start of current section is %ld)!\n",
-				id, block_id_start
-			);
-			continue;
-		}
-		if (blocks[b].flags & BLOCK_REDUNDANCY) {
-			printf("redundancy block (id = %ld, idx = %ld).\n", id, b);
-			if (blocks[b].id == block_id_start)
-				redundancy_block = &(blocks[b]);
+	// blocks of a section before, whose redundancy block did not arrive
+	for (unsigned long id = unpacker->base_id; id < block_id_start && id < unpacker->end_id; id++) {
+		block_t ** slot = &unpacker->section_blocks[id - unpacker->base_id];
+		if (!*slot)
 			continue;
-		}
-
-		if ((*reorder)[id - block_id_start]) {
-			printf(
-				"error: non-redundancy block (id = %ld, idx = %ld) has same id as previous block (idx = %ld)\n",
-				id, b, (*reorder)[id - block_id_start] - blocks
-			);
-			continue;
-		}
-
-		missing--;
-		(*reorder)[id - block_id_start] = &(blocks[b]);
-		if (dbg) printf("reorder id %ld -> idx %ld\n", id, b);
+		printf(
+			"ignoring block with id %ld from old section "
+			"(start of current section is %ld)!\n",
+			id, block_id_start
+		);
+		release_block(&unpacker->pool, *slot);
+		*slot = 0;
+		unpacker->section_blocks_filled--;
 	}
+	reserve_section_blocks(unpacker, block_id_start, block_id_start + 1);
 
+	const unsigned long section_length = unpacker->end_id - block_id_start;
+	// the redundancy block counts as read
+	const unsigned long block_use_count = unpacker->section_blocks_filled + 1;
+	printf(
+		"max_id %ld among %ld blocks, %ld read blocks\n",
+		unpacker->end_id - 1, section_length, block_use_count
+	);
+	printf("redundancy block (id = %ld).\n", block_id_start);
+
+	unsigned long missing = section_length - unpacker->section_blocks_filled;
 	printf(
 		"%ld blocks missing from section of %ld blocks among %ld noted blocks "
 		"(the latter including the redundancy block)!\n",
-		missing, reorder_capacity_needed, block_use_count
+		missing, section_length, block_use_count
 	);
 
 	if (missing > 1) {
@@ -319,25 +766,32 @@ unsigned long make_reorder(
 	}
 
 	if (missing == 1) {
-		if (!redundancy_block) {
-			printf("we want to recover, but have no redundancy block?\n");
-			exit(1);
-		}
 		recover_block(
-			blocks, block_used, block_array_capacity,
-			*reorder, *reorder_capacity,
+			&unpacker->pool,
+			unpacker->section_blocks, section_length,
 			redundancy_block, block_id_start
 		);
-		block_use_count++;
+		unpacker->section_blocks_filled++;
 	}
 
-	block_used[redundancy_block - blocks] = false;
+	return section_length;
+}
 
-	return reorder_capacity_needed;
+// after the section is written, its blocks go back to the pool and the next section starts after it
+static void release_section (unpacker_t * unpacker, unsigned long section_length) {
+	for (unsigned long s = 0; s < section_length; s++) {
+		release_block(&unpacker->pool, unpacker->section_blocks[s]);
+		unpacker->section_blocks[s] = 0;
+	}
+	unpacker->section_blocks_filled = 0;
+	unpacker->next_section_id = unpacker->base_id + section_length;
+	unpacker->base_id = unpacker->next_section_id;
+	unpacker->end_id = unpacker->next_section_id;
 }
 
 void write_block_data(
-	FILE * output_file,
+	write_words_t write_words,
+	void * context,
 	const block_t ** blocks,
 	unsigned long blocks_filled
 ) {
@@ -358,25 +812,309 @@ void write_block_data(
 				blocks[r]->data[i + 3]
 			);
 		}
-		unsigned int output_written = fwrite(
-			blocks[r]->data,
-			sizeof(unsigned long),
-			blocks[r]->data_length_in_words,
-			output_file
-		);
-		if (!output_written) {
-			if (ferror(output_file)) {
-				perror("writing block to output_file");
-				exit(1);
-			} else {
-				perror("no output written to output_file?");
-			}
+		write_words(context, blocks[r]->data, blocks[r]->data_length_in_words);
+	}
+}
+
+void unpacker_init (unpacker_t * unpacker) {
+	block_pool_init(&unpacker->pool);
+	unpacker->current_block = get_free_block(&unpacker->pool);
+	unpacker->block_buffer_filled = 0;
+	// reserve_section_blocks will realloc and change the capacity
+	unpacker->section_blocks_capacity = BLOCK_POOL_INITIAL_CAPACITY;
+	unpacker->section_blocks = (block_t **) calloc(unpacker->section_blocks_capacity, sizeof(block_t *));
+	if (!unpacker->section_blocks) {
+		perror("calloc section_blocks");
+		exit(1);
+	}
+	unpacker->section_blocks_filled = 0;
+	unpacker->base_id = 0;
+	unpacker->end_id = 0;
+	unpacker->next_section_id = 0;
+}
+
+void unpacker_free (unpacker_t * unpacker) {
+	block_pool_free(&unpacker->pool);
+	free(unpacker->section_blocks);
+	unpacker->section_blocks = 0;
+}
+
+void unpacker_add_line (
+	unpacker_t * unpacker,
+	const char * line_buffer,
+	unsigned long line_buffer_filled,
+	unsigned long line_number,
+	write_words_t write_words,
+	void * context
+) {
+	bool line_added = add_to_raw_block_data(
+		(unsigned long *) unpacker->current_block,
+		&unpacker->block_buffer_filled,
+		line_buffer,
+		line_buffer_filled
+	);
+	if (!line_added) {
+		if (unpacker->block_buffer_filled > 0) {
+			// the redundancy block of its section can recover it
+			printf("dropping incomplete block %ld in line %ld.\n", unpacker->current_block->id, line_number);
+			unpacker->block_buffer_filled = 0;
+		}
+		return;
+	}
+
+	if (unpacker->block_buffer_filled < sizeof(block_t) / sizeof(unsigned long))
+		return;
+
+	if (dbg) printf(
+		"filled block id = %ld (@%p) with %ld words\n",
+		unpacker->current_block->id, unpacker->current_block, unpacker->block_buffer_filled
+	);
+
+	for (
+		unsigned long d = unpacker->block_buffer_filled -
+			(sizeof(block_t) / sizeof(unsigned long) - block_data_capacity_in_words);
+		d < block_data_capacity_in_words;
+		d++
+	) {
+		unpacker->current_block->data[d] = 0;
+	}
+
+	// the block we just completed
+	block_t * block = unpacker->current_block;
+	unpacker->current_block = get_free_block(&unpacker->pool);
+	unpacker->block_buffer_filled = 0;
+
+	if (!(block->flags & BLOCK_REDUNDANCY)) {
+		// get next block, we are not at the checking stage yet.
+		add_section_block(unpacker, block);
+		return;
+	}
+
+	// the redundancy block has the index of the first block its redundancy covers
+	unsigned long section_length = complete_section(unpacker, block);
+	release_block(&unpacker->pool, block);
+	if (!section_length)
+		return;
+
+	printf("write blocks\n");
+	write_block_data(write_words, context, (const block_t **) unpacker->section_blocks, section_length);
+	release_section(unpacker, section_length);
+	printf("done\n");
+}
+
+#ifndef UNPACK_LIBRARY
+static void write_to_file (void * context, const unsigned long * words, unsigned long count) {
+	FILE * output_file = (FILE *) context;
+	unsigned int output_written = fwrite(
+		words,
+		sizeof(unsigned long),
+		count,
+		output_file
+	);
+	if (!output_written) {
+		if (ferror(output_file)) {
+			perror("writing block to output_file");
+			exit(1);
+		} else {
+			perror("no output written to output_file?");
 		}
 	}
 }
 
+// unpacks the lines with the block marker. regular files are mapped, unless scalar_only,
+// other inputs (stdin) are read with getline.
+static void unpack_input (int input_fd, FILE * input_file, FILE * output_file) {
+	char * line_buffer;
+	unsigned long line_buffer_filled;
+	unsigned long line_number = 0;
+
+	mapped_input_t mapped_input;
+	const bool mapped = !scalar_only && map_input(&mapped_input, input_fd);
+
+	unpacker_t unpacker;
+	unpacker_init(&unpacker);
+
+	while (true) {
+		// find a line with the specified marker in the input. replace \n by \0
+		if (mapped) {
+			line_buffer_filled = get_mapped_block_line(
+				&line_buffer,
+				&mapped_input,
+				&line_number,
+				block_marker_default
+			);
+		} else {
+			line_buffer_filled = get_block_line(
+				&line_buffer,
+				input_file,
+				&line_number,
+				block_marker_default
+			);
+		}
+		if (!line_buffer_filled)
+			// we got no data from input, no more input exists
+			// TODO: does this handle incomplete blocks?
+			// => they should not exist, I believe
+			break;
+
+		unpacker_add_line(&unpacker, line_buffer, line_buffer_filled, line_number, &write_to_file, output_file);
+	}
+	unpacker_free(&unpacker);
+	if (mapped)
+		unmap_input(&mapped_input);
+}
+
+static double seconds_since (const struct timespec * start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static const double minimum_seconds = 0.2;
+
+static bool hex_word_scalar (const char * buffer, unsigned long * result) {
+	unsigned long to_skip;
+	return to_mword(buffer, result, &to_skip, 16);
+}
+
+// MB/s of hex digits a kernel reads, checked against the words they were printed from
+static double hex_megabytes_per_second (
+	bool (* hex_word) (const char *, unsigned long *),
+	const char * digits,
+	const unsigned long * words,
+	unsigned long word_count
+) {
+	unsigned long repetitions = 0;
+	unsigned long mismatches = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	double seconds;
+	do {
+		for (unsigned long w = 0; w < word_count; w++) {
+			unsigned long word;
+			if (!hex_word(digits + 17 * w, &word) || word != words[w])
+				mismatches++;
+		}
+		repetitions++;
+		seconds = seconds_since(&start);
+	} while (seconds < minimum_seconds);
+
+	if (mismatches) {
+		printf("benchmarked kernel read %ld words wrong!\n", mismatches);
+		exit(1);
+	}
+	return repetitions * word_count * 17 / seconds / 1e6;
+}
+
+// MB/s of input the whole unpack reads, with its log (and getline's perror) sent to /dev/null.
+// the output is kept in memory, to compare the paths.
+static double unpack_megabytes_per_second (
+	const char * input_filename,
+	bool scalar,
+	char ** output,
+	size_t * output_size
+) {
+	scalar_only = scalar;
+	fflush(stdout);
+	const int stdout_fd = dup(STDOUT_FILENO);
+	const int stderr_fd = dup(STDERR_FILENO);
+	const int null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, STDOUT_FILENO);
+	dup2(null_fd, STDERR_FILENO);
+
+	unsigned long repetitions = 0;
+	unsigned long input_size = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	double seconds;
+	do {
+		FILE * input_file = fopen(input_filename, "r");
+		if (!input_file) {
+			perror(input_filename);
+			exit(1);
+		}
+		struct stat status;
+		fstat(fileno(input_file), &status);
+		input_size = status.st_size;
+
+		free(*output);
+		FILE * output_file = open_memstream(output, output_size);
+		unpack_input(fileno(input_file), input_file, output_file);
+		fclose(output_file);
+		fclose(input_file);
+		repetitions++;
+		seconds = seconds_since(&start);
+	} while (seconds < minimum_seconds);
+
+	fflush(stdout);
+	dup2(stdout_fd, STDOUT_FILENO);
+	dup2(stderr_fd, STDERR_FILENO);
+	close(stdout_fd);
+	close(stderr_fd);
+	close(null_fd);
+	scalar_only = false;
+	return repetitions * input_size / seconds / 1e6;
+}
+
+// compares the scalar decoder and getline with the kernels and the mapped input
+static void run_benchmark (const char * input_filename) {
+	const unsigned long word_count = 1 << 16;
+	unsigned long * words = (unsigned long *) malloc(word_count * sizeof(unsigned long));
+	// 16 digits and a space per word, like in the lines, and room for sprintf's '\0'
+	char * digits = (char *) malloc(word_count * 17 + 1);
+	if (!words || !digits) {
+		perror("malloc benchmark data");
+		exit(1);
+	}
+	unsigned long state = 0x2545f4914f6cdd1d;
+	for (unsigned long w = 0; w < word_count; w++) {
+		state = state * 6364136223846793005ul + 1442695040888963407ul;
+		// the high bits are zero in many words of a trace
+		words[w] = w % 2 ? state : state >> 40;
+		sprintf(digits + 17 * w, "%016lx ", words[w]);
+	}
+
+	printf("%16s %16s %8s\n", "hex kernel", "[MB/s]", "speedup");
+	const double scalar_hex = hex_megabytes_per_second(hex_word_scalar, digits, words, word_count);
+	printf("%16s %16.1f %7.1fx\n", "scalar", scalar_hex, 1.0);
+	const double table_hex = hex_megabytes_per_second(hex_word_table, digits, words, word_count);
+	printf("%16s %16.1f %7.1fx\n", "table", table_hex, table_hex / scalar_hex);
+#ifdef __SSE2__
+	const double vector_hex = hex_megabytes_per_second(hex_word_vector, digits, words, word_count);
+	printf("%16s %16.1f %7.1fx\n", "sse2", vector_hex, vector_hex / scalar_hex);
+#endif
+	free(words);
+	free(digits);
+
+	char * scalar_output = 0;
+	char * fast_output = 0;
+	size_t scalar_output_size = 0;
+	size_t fast_output_size = 0;
+	printf("%16s %16s %8s\n", "unpack", "[MB/s]", "speedup");
+	const double scalar_unpack = unpack_megabytes_per_second(input_filename, true, &scalar_output, &scalar_output_size);
+	printf("%16s %16.1f %7.1fx\n", "getline, scalar", scalar_unpack, 1.0);
+	const double fast_unpack = unpack_megabytes_per_second(input_filename, false, &fast_output, &fast_output_size);
+	printf("%16s %16.1f %7.1fx\n", "mmap, kernel", fast_unpack, fast_unpack / scalar_unpack);
+
+	if (scalar_output_size != fast_output_size || memcmp(scalar_output, fast_output, fast_output_size)) {
+		printf("the paths unpacked '%s' differently!\n", input_filename);
+		exit(1);
+	}
+	free(scalar_output);
+	free(fast_output);
+}
+
 int main(int argc, char * argv []) {
 	// TODO: use argp
+	if (argc > 2 && strcmp(argv[1], "bench") == 0) {
+		run_benchmark(argv[2]);
+		return 0;
+	}
+	if (argc > 1 && strcmp(argv[1], "--scalar") == 0) {
+		scalar_only = true;
+		argc--;
+		argv++;
+	}
 
 	if (argc <= 2) {
 		printf("no input and output filenames given!\n");
@@ -432,91 +1170,7 @@ int main(int argc, char * argv []) {
 	FILE * input_file = fdopen(input_fd, "r");
 	FILE * output_file = fdopen(output_fd, "w");
 
-	char * line_buffer;
-	unsigned long line_buffer_filled;
-	unsigned long line_number = 0;
-
-	const unsigned long block_array_capacity = BLOCK_ARRAY_CAPACITY;
-	block_t blocks [BLOCK_ARRAY_CAPACITY];
-	bool block_used [BLOCK_ARRAY_CAPACITY] = { false };
-
-	block_t * current_block = &blocks[0];
-	// how many words do we already have towards the next block
-	unsigned long block_buffer_filled = 0;
-
-	// maps block ids starting from block_id_start to their blocks.
-	// null entries mark missing blocks
-	unsigned long reorder_block_id_start;
-	// make_reorder will realloc and change this value
-	unsigned long reorder_capacity = BLOCK_ARRAY_CAPACITY;
-	const block_t ** reorder = (const block_t **) malloc(sizeof(const block_t *) * reorder_capacity);
-
-	while (true) {
-		// find a line with the specified marker in the input. replace \n by \0
-		line_buffer_filled = get_block_line(
-			&line_buffer,
-			input_file,
-			&line_number,
-			block_marker_default
-		);
-		if (!line_buffer_filled)
-			// we got no data from input, no more input exists
-			// TODO: does this handle incomplete blocks?
-			// => they should not exist, I believe
-			break;
-
-		add_to_raw_block_data(
-			(unsigned long *) current_block,
-			&block_buffer_filled,
-			line_buffer,
-			line_buffer_filled
-		);
-
-		if (block_buffer_filled < sizeof(block_t) / sizeof(unsigned long))
-			continue;
-
-		unsigned long block_index = current_block - &blocks[0];
-		if (dbg) printf(
-			"filled block idx = %ld, id = %ld (@%p) with %ld words\n",
-			block_index, blocks[block_index].id, current_block, block_buffer_filled
-		);
-		block_used[block_index] = true;
-
-		for (
-			unsigned long d = block_buffer_filled -
-				(sizeof(block_t) / sizeof(unsigned long) - block_data_capacity_in_words);
-			d < block_data_capacity_in_words;
-			d++
-		) {
-			current_block->data[d] = 0;
-		}
-
-		// the block we just completed
-		block_t * block = current_block;
-		current_block = get_free_block(blocks, block_used, block_array_capacity);
-		block_buffer_filled = 0;
-
-		if (!(block->flags & BLOCK_REDUNDANCY))
-			// get next block, we are not at the checking stage yet.
-			continue;
-
-		// the redundancy block has the index of the first block its redundancy covers
-		long block_id_start = block->id;
-		unsigned long reorder_filled = make_reorder(
-			&reorder, &reorder_capacity,
-			blocks, block_used, block_array_capacity,
-			block_id_start
-		);
-
-		printf("write blocks\n");
-		write_block_data(output_file, reorder, reorder_filled);
-
-		for (unsigned long r = 0; r < reorder_filled; r++) {
-			unsigned long index = reorder[r] - &blocks[0];
-			block_used[index] = false;
-		}
-		printf("done\n");
-	}
+	unpack_input(input_fd, input_file, output_file);
 
 	// the check is for stdin, this code is not correct, but we don't need it anymore anyways...
 	if (close_input_fd_at_end) {
@@ -529,3 +1183,4 @@ int main(int argc, char * argv []) {
 		close(output_fd);
 	}
 }
+#endif
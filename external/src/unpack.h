@@ -0,0 +1,75 @@
+#pragma once
+#include <stdbool.h>
+
+#include <block.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// how many blocks the pool allocates first, each further allocation doubles them.
+// that many doublings are more than any address space holds
+#define BLOCK_POOL_INITIAL_CAPACITY 64
+#define BLOCK_POOL_CHUNKS 48
+
+// the blocks unpack is working on. they are allocated in chunks that are never moved or freed
+// before the pool is, blocks that are done with go onto the stack of free ones.
+typedef struct block_pool_s {
+	block_t * chunks [BLOCK_POOL_CHUNKS];
+	unsigned long chunks_filled;
+	unsigned long capacity;
+	block_t ** free_blocks;
+	unsigned long free_blocks_filled;
+} block_pool_t;
+
+// the blocks of the current section, as they come in from the lines of the capture.
+// unpack feeds it from a .cleaned file, interpret straight from the capture.
+typedef struct unpacker_s {
+	block_pool_t pool;
+	block_t * current_block;
+	// how many words do we already have towards the next block
+	unsigned long block_buffer_filled;
+
+	// the completed data blocks by id, section_blocks[id - base_id] for ids from base_id up to end_id.
+	// null entries mark missing blocks. when a section is written, they are all released.
+	block_t ** section_blocks;
+	unsigned long section_blocks_capacity;
+	unsigned long section_blocks_filled;
+	unsigned long base_id;
+	unsigned long end_id;
+	// blocks before this id belong to sections that were written or dropped already
+	unsigned long next_section_id;
+} unpacker_t;
+
+// gets the data words of each complete section, in order
+typedef void (* write_words_t) (void * context, const unsigned long * words, unsigned long count);
+
+void unpacker_init (unpacker_t * unpacker);
+void unpacker_free (unpacker_t * unpacker);
+
+// adds a line that starts with the block marker. line_buffer_filled counts the line's '\0'.
+// the line that completes a section's redundancy block writes the section's data.
+void unpacker_add_line (
+	unpacker_t * unpacker,
+	const char * line_buffer,
+	unsigned long line_buffer_filled,
+	unsigned long line_number,
+	write_words_t write_words,
+	void * context
+);
+
+// where the block marker starts in the line, or null
+const char * find_block_marker (
+	const char * line_buffer,
+	unsigned long line_buffer_filled,
+	const char * block_marker
+);
+
+// what `cat -v | sed 's/\^\[\[[0-9]*m//g' | sed 's/\^M//g'` (the .cleaned rule) makes of a line without its '\n':
+// control characters shown as ^X or M-X, then color codes and carriage returns removed.
+// target needs room for 4 * length + 1 chars, it is '\0' terminated. returns its length.
+unsigned long clean_line (char * target, const char * source, unsigned long length);
+
+#ifdef __cplusplus
+}
+#endif
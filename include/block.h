@@ -22,11 +22,19 @@ enum block_flags_t {
 	BLOCK_REDUNDANCY = (1UL << 0),
 };
 
+// how the lines after the header line of a block are printed.
+// the header line is always hex, so the reader knows the encoding before it needs it.
+// older exports had a reserved 0 word here, which is hex.
+enum block_encoding_t {
+	BLOCK_ENCODING_HEX    = 0,
+	BLOCK_ENCODING_BASE64 = 1,
+};
+
 typedef struct block_t_struct {
 	unsigned long id;
 	unsigned long data_length_in_words;
 	unsigned long flags;
-	unsigned long reserved;
+	unsigned long encoding;
 	unsigned long data [BLOCK_DATA_SIZE / sizeof(unsigned long)];
 } block_t;
 // outside of the l4re module compilation environment, we have no static assert macro
@@ -41,7 +49,8 @@ static inline
 block_t make_block(
 	const unsigned long * data,
 	unsigned long data_length_in_words,
-	unsigned long flags
+	unsigned long flags,
+	unsigned long encoding
 ) {
 	static unsigned long id = 0;
 
@@ -50,7 +59,7 @@ block_t make_block(
 	block.id = id;
 	block.data_length_in_words = data_length_in_words;
 	block.flags = flags;
-	block.reserved = 0;
+	block.encoding = encoding;
 
 	if (data_length_in_words > block_data_capacity_in_words) {
 		data_length_in_words = block_data_capacity_in_words;
@@ -71,8 +80,8 @@ block_t make_block(
 static inline
 void xor_blocks(block_t * target, const block_t * to_add) {
 	unsigned long min_len = target->data_length_in_words;
-	if (target->data_length_in_words < min_len) {
-		min_len = target->data_length_in_words;
+	if (to_add->data_length_in_words < min_len) {
+		min_len = to_add->data_length_in_words;
 	}
 	for (unsigned long i = 0; i < min_len; i++) {
 		target->data[i] = target->data[i] ^ to_add->data[i];
@@ -85,6 +94,53 @@ const unsigned long block_format_offset_chars = 2;
 const char * const block_format_default = "%s [%08lx.%02x] ";
 const char * const block_marker_default = ">=<";
 
+// the id, length, flags and encoding words, printed as the first hex line of every block
+const unsigned long block_header_words = 4;
+// with BLOCK_ENCODING_BASE64, the data words of a block are printed in 4 lines of 31 words.
+// each line ends in a space and the checksum of its bytes as 4 hex digits.
+#define BLOCK_BASE64_WORD_COLUMNS 31
+const unsigned long block_base64_word_columns = BLOCK_BASE64_WORD_COLUMNS;
+const unsigned long block_base64_checksum_chars = 4;
+const char * const block_base64_alphabet =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// fletcher-16 over the bytes of one printed line
+static inline
+unsigned block_line_checksum(const unsigned char * bytes, unsigned long length) {
+	unsigned sum_1 = 0;
+	unsigned sum_2 = 0;
+	for (unsigned long i = 0; i < length; i++) {
+		sum_1 = (sum_1 + bytes[i]) % 255;
+		sum_2 = (sum_2 + sum_1)    % 255;
+	}
+	return (sum_2 << 8) | sum_1;
+}
+
+// base64 without padding, writes a '\0'-terminated string and returns its length
+static inline
+unsigned long encode_base64(char * target, const unsigned char * bytes, unsigned long length) {
+	unsigned long t = 0;
+	unsigned long i = 0;
+	for (; i + 3 <= length; i += 3) {
+		unsigned long triple = (bytes[i] << 16) | (bytes[i + 1] << 8) | bytes[i + 2];
+		target[t++] = block_base64_alphabet[(triple >> 18) & 0x3f];
+		target[t++] = block_base64_alphabet[(triple >> 12) & 0x3f];
+		target[t++] = block_base64_alphabet[(triple >>  6) & 0x3f];
+		target[t++] = block_base64_alphabet[ triple        & 0x3f];
+	}
+	if (i < length) {
+		unsigned long triple = bytes[i] << 16;
+		if (i + 1 < length)
+			triple |= bytes[i + 1] << 8;
+		target[t++] = block_base64_alphabet[(triple >> 18) & 0x3f];
+		target[t++] = block_base64_alphabet[(triple >> 12) & 0x3f];
+		if (i + 1 < length)
+			target[t++] = block_base64_alphabet[(triple >> 6) & 0x3f];
+	}
+	target[t] = '\0';
+	return t;
+}
+
 static inline
 void print_block(
 	const block_t * block,
@@ -92,21 +148,41 @@ void print_block(
 ) {
 
 	const unsigned word_columns = 4;
+	const unsigned block_words = sizeof(block_t) / sizeof(unsigned long);
 	unsigned long * raw_block = (unsigned long *) block;
 
 	if (!block_marker)
 		block_marker = block_marker_default;
 
-	for (unsigned w = 0; w < sizeof(block_t) / sizeof(unsigned long); w++) {
+	// every line is printed with a single call, so lines of other threads
+	// can only come between our lines, not inside them (unpack skips those).
+	char line [512];
+	int line_filled = 0;
+
+	unsigned w = 0;
+	for (; w < block_words && (w < block_header_words || block->encoding != BLOCK_ENCODING_BASE64); w++) {
 		if (w % word_columns == 0) {
-			printf(block_format_default, block_marker, block->id, w);
+			line_filled = snprintf(line, sizeof(line), block_format_default, block_marker, block->id, w);
+		}
+
+		line_filled += snprintf(line + line_filled, sizeof(line) - line_filled, "%016lx ", raw_block[w]);
+		if (w % word_columns == word_columns - 1) {
+			printf("%s\n", line);
+			line_filled = 0;
 		}
+	}
 
-		printf("%016lx ", raw_block[w]);
-		if (w % word_columns == word_columns - 1)
-			printf("\n");
+	for (; w < block_words; w += block_base64_word_columns) {
+		unsigned long words = block_words - w;
+		if (words > block_base64_word_columns)
+			words = block_base64_word_columns;
+		const unsigned char * bytes = (const unsigned char *) (raw_block + w);
+		const unsigned long length = words * sizeof(unsigned long);
+
+		line_filled = snprintf(line, sizeof(line), block_format_default, block_marker, block->id, w);
+		line_filled += encode_base64(line + line_filled, bytes, length);
+		printf("%s %04x\n", line, block_line_checksum(bytes, length));
 	}
 
 	printf("\n");
 }
-
@@ -281,7 +281,8 @@ void print_backtrace_buffer_section (const unsigned long * buffer, unsigned long
 	block_t xor_block = make_block (
 		buffer,
 		(block_data_capacity_in_words < words ? block_data_capacity_in_words : words),
-		0
+		0,
+		export_block_encoding
 	);
 
 	// print while it still behaves like the first block of data.
@@ -293,7 +294,8 @@ void print_backtrace_buffer_section (const unsigned long * buffer, unsigned long
 		block_t block = make_block(
 			buffer + b * block_data_capacity_in_words,
 			block_data_capacity_in_words,
-			0
+			0,
+			export_block_encoding
 		);
 
 		print_block(&block, 0);
@@ -307,7 +309,8 @@ void print_backtrace_buffer_section (const unsigned long * buffer, unsigned long
 		block_t block = make_block(
 			buffer + words - remainder,
 			remainder,
-			0
+			0,
+			export_block_encoding
 		);
 
 		print_block(&block, 0);
@@ -37,6 +37,30 @@ void print_measure_line (
 	l4_uint64_t btb_words,
 	enum measure_format format
 );
+typedef struct measure_statistics_s {
+	l4_uint64_t rounds;
+	double us_mean;
+	double us_median;
+	double us_p90;
+	double us_p99;
+	double us_stddev;
+	// half width of the 95 % confidence interval of the mean
+	double us_confidence;
+	double btb_words_mean;
+} measure_statistics_t;
+
+void measure_compute_statistics (
+	l4_uint64_t * us_durations,
+	const l4_uint64_t * btb_words,
+	l4_uint64_t rounds,
+	measure_statistics_t * statistics
+);
+void print_statistics_line (
+	const char * program_name,
+	l4_uint64_t us_trace_interval,
+	const measure_statistics_t * statistics,
+	const measure_statistics_t * baseline
+);
 int measure_loop(
 	int (*workload) (void *, l4_uint64_t),
 	void * workload_arg,
@@ -192,6 +216,137 @@ inline void print_measure_line (
 	}
 }
 
+// no libm needed for this: newton iteration, good enough for a standard deviation
+static double measure_sqrt (double x) {
+	if (x <= 0.0)
+		return 0.0;
+	double root = x > 1.0 ? x : 1.0;
+	for (int i = 0; i < 64; i++) {
+		double next = (root + x / root) / 2.0;
+		if (next >= root)
+			break;
+		root = next;
+	}
+	return root;
+}
+
+// two-sided 95 % quantile of student's t distribution, for rounds - 1 degrees of freedom
+static double measure_t_95 (l4_uint64_t rounds) {
+	static const double t_95 [] = {
+		0.0,   12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+		2.228, 2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+		2.086, 2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+		2.042,
+	};
+	const l4_uint64_t degrees = rounds - 1;
+	if (degrees < sizeof(t_95) / sizeof(t_95[0]))
+		return t_95[degrees];
+	return 1.960;
+}
+
+// nearest rank on sorted durations
+static double measure_percentile (const l4_uint64_t * sorted, l4_uint64_t rounds, l4_uint64_t percent) {
+	l4_uint64_t rank = (percent * rounds + 99) / 100;
+	if (rank < 1)
+		rank = 1;
+	return (double) sorted[rank - 1];
+}
+
+// mean and variance of the durations so far, updated per round (welford),
+// for the early stop of measure_loop without going over all rounds again
+typedef struct measure_running_s {
+	l4_uint64_t rounds;
+	double us_mean;
+	// sum of the squared differences from the mean
+	double us_squares;
+} measure_running_t;
+
+static void measure_running_add (measure_running_t * running, l4_uint64_t us_duration) {
+	running->rounds++;
+	double difference = (double) us_duration - running->us_mean;
+	running->us_mean += difference / running->rounds;
+	running->us_squares += difference * ((double) us_duration - running->us_mean);
+}
+
+static double measure_running_stddev (const measure_running_t * running) {
+	return running->rounds > 1 ? measure_sqrt(running->us_squares / (running->rounds - 1)) : 0.0;
+}
+
+// half width of the 95 % confidence interval of the mean
+static double measure_running_confidence (const measure_running_t * running) {
+	return running->rounds > 1
+		? measure_t_95(running->rounds) * measure_running_stddev(running) / measure_sqrt((double) running->rounds)
+		: 0.0;
+}
+
+// sorts us_durations in place for the percentiles, call it once the rounds are done
+inline void measure_compute_statistics (
+	l4_uint64_t * us_durations,
+	const l4_uint64_t * btb_words,
+	l4_uint64_t rounds,
+	measure_statistics_t * statistics
+) {
+	measure_running_t running = { 0, 0.0, 0.0 };
+	double btb_words_sum = 0.0;
+	for (l4_uint64_t i = 0; i < rounds; i++) {
+		measure_running_add(&running, us_durations[i]);
+		btb_words_sum += (double) btb_words[i];
+	}
+
+	statistics->rounds = rounds;
+	statistics->us_mean = running.us_mean;
+	statistics->btb_words_mean = rounds ? btb_words_sum / rounds : 0.0;
+	statistics->us_stddev = measure_running_stddev(&running);
+	statistics->us_confidence = measure_running_confidence(&running);
+	if (!rounds) {
+		statistics->us_median = statistics->us_p90 = statistics->us_p99 = 0.0;
+		return;
+	}
+
+	// insertion sort, we have at most measure_rounds samples and sort them once
+	for (l4_uint64_t i = 1; i < rounds; i++) {
+		l4_uint64_t value = us_durations[i];
+		l4_uint64_t j = i;
+		for (; j > 0 && us_durations[j - 1] > value; j--)
+			us_durations[j] = us_durations[j - 1];
+		us_durations[j] = value;
+	}
+
+	statistics->us_median = rounds % 2
+		? (double) us_durations[rounds / 2]
+		: ((double) us_durations[rounds / 2 - 1] + (double) us_durations[rounds / 2]) / 2.0;
+	statistics->us_p90 = measure_percentile(us_durations, rounds, 90);
+	statistics->us_p99 = measure_percentile(us_durations, rounds, 99);
+}
+
+const char * const statistics_header = "=#=#= [trace_interval,rounds,mean,median,p90,p99,stddev,ci95,overhead,btb_words,program] us";
+
+inline void print_statistics_line (
+	const char * program_name,
+	l4_uint64_t us_trace_interval,
+	const measure_statistics_t * statistics,
+	const measure_statistics_t * baseline
+) {
+	// overhead relative to the untraced rounds, -1 if there were none
+	double overhead = baseline && baseline->us_mean > 0.0
+		? statistics->us_mean / baseline->us_mean - 1.0
+		: -1.0;
+	printf(
+		"=#=#= [%16lld,%4lld,%16.1f,%16.1f,%16.1f,%16.1f,%12.1f,%12.1f,%10.4f,%16.1f,%s] us\n",
+		us_trace_interval,
+		statistics->rounds,
+		statistics->us_mean,
+		statistics->us_median,
+		statistics->us_p90,
+		statistics->us_p99,
+		statistics->us_stddev,
+		statistics->us_confidence,
+		overhead,
+		statistics->btb_words_mean,
+		program_name
+	);
+}
+
 inline int measure_loop(
 	int (*workload) (void *, l4_uint64_t),
 	void * workload_arg,
@@ -202,13 +357,23 @@ inline int measure_loop(
 	l4_uint64_t us_starts [trace_interval_count][measure_rounds];
 	l4_uint64_t us_stops  [trace_interval_count][measure_rounds];
 	l4_uint64_t btb_words [trace_interval_count][measure_rounds];
+	l4_uint64_t us_durations [trace_interval_count][measure_rounds];
+	l4_uint64_t rounds_done [trace_interval_count];
+	measure_running_t running;
 
-	puts(csv_header);
+	if (measure_statistics)
+		puts(statistics_header);
+	else
+		puts(csv_header);
 
 	long unsigned int old_btb_words = measure_btb_words();
 	int result = 0; // to avoid optimizing out
 	for (l4_uint64_t trace_interval_index = 0; trace_interval_index <  trace_interval_count; trace_interval_index++) {
 		l4_uint64_t us_trace_interval = us_trace_intervals[trace_interval_index];
+		rounds_done[trace_interval_index] = 0;
+		running.rounds = 0;
+		running.us_mean = 0.0;
+		running.us_squares = 0.0;
 	for (l4_uint64_t        measure_round = 0;        measure_round <        measure_rounds;        measure_round++) {
 		if (ubt_debug) printf(
 			"measurement round %16lld: trace interval %16.3f s, program: %s\n",
@@ -223,12 +388,31 @@ inline int measure_loop(
 		l4_uint64_t new_btb_words = measure_btb_words();
 		btb_words[trace_interval_index][measure_round] = new_btb_words - old_btb_words;
 		old_btb_words = new_btb_words;
+		us_durations[trace_interval_index][measure_round] =
+			us_stops [trace_interval_index][measure_round] -
+			us_starts[trace_interval_index][measure_round];
+		rounds_done[trace_interval_index] = measure_round + 1;
 
 		if (!do_export)
 			// clear buffer after measuring its content
 			// TODO: user is responsible for managing overflow as of now
 			l4_debugger_backtracing_reset(dbg_cap);
 
+		if (measure_statistics) {
+			// measure_rounds is the upper limit, stop as soon as the mean is known well enough
+			measure_running_add(&running, us_durations[trace_interval_index][measure_round]);
+			if (measure_round + 1 < measure_min_rounds)
+				continue;
+			double us_confidence = measure_running_confidence(&running);
+			if (ubt_debug) printf(
+				"round %lld: mean %.1f us +- %.1f us\n",
+				measure_round, running.us_mean, us_confidence
+			);
+			if (us_confidence <= measure_relative_confidence * running.us_mean)
+				break;
+			continue;
+		}
+
 		print_measure_line (
 			program_name,
 			us_trace_intervals[trace_interval_index],
@@ -252,6 +436,29 @@ inline int measure_loop(
 	}
 	}
 
+	if (measure_statistics) {
+		// the untraced rounds are the baseline for all others
+		measure_statistics_t statistics [trace_interval_count];
+		const measure_statistics_t * baseline = NULL;
+		for (l4_uint64_t trace_interval_index = 0; trace_interval_index <  trace_interval_count; trace_interval_index++) {
+			measure_compute_statistics(
+				us_durations[trace_interval_index],
+				btb_words[trace_interval_index],
+				rounds_done[trace_interval_index],
+				&statistics[trace_interval_index]
+			);
+			if (!us_trace_intervals[trace_interval_index] && !baseline)
+				baseline = &statistics[trace_interval_index];
+		}
+		for (l4_uint64_t trace_interval_index = 0; trace_interval_index <  trace_interval_count; trace_interval_index++)
+			print_statistics_line(
+				program_name,
+				us_trace_intervals[trace_interval_index],
+				&statistics[trace_interval_index],
+				baseline
+			);
+	}
+
 	printf("-- measure_loop complete --\n");
 
 	return result;
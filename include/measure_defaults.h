@@ -9,8 +9,30 @@ static const l4_uint64_t us_trace_intervals [] =  {       1000 };
 static const l4_uint64_t trace_interval_count = 1;
 static const l4_uint64_t measure_rounds = 1;
 static const int do_overhead = 0;
+// measure_loop: instead of printing every round, print mean, median, p90, p99, stddev
+// and the overhead against the untraced (0) interval once per trace interval.
+// then measure_rounds is an upper limit: an interval stops after at least measure_min_rounds
+// when the 95 % confidence interval of the mean is within measure_relative_confidence of it.
+static const int measure_statistics = 0;
+static const l4_uint64_t measure_min_rounds = 5;
+static const double measure_relative_confidence = 0.01;
 // for backtracer/main.cc
 static const int do_export = 1;
+// print one section while the next ones are fetched and compressed (needs a second thread)
+static const int export_pipelined = 1;
+// how block lines are printed: BLOCK_ENCODING_HEX (0) or the denser BLOCK_ENCODING_BASE64 (1)
+static const int export_block_encoding = 1;
+// export full sections while tracing is still running, so the kernel buffer does not limit how long we trace.
+// whatever is left is exported after tracing stops, as without this.
+static const int export_continuously = 0;
+// export each distinct stack of a section once, with the number of samples and their time range,
+// instead of every sample. interpret spreads the samples over that range again. for flame graphs.
+static const int export_intern_stacks = 0;
+// with export_continuously, drain at least every us_drain_interval,
+// or sooner when about drain_high_watermark_in_words are waiting in the kernel buffer (checked every us_drain_poll).
+static const l4_uint64_t us_drain_interval = 1000000;
+static const l4_uint64_t us_drain_poll = 10000;
+static const l4_uint64_t drain_high_watermark_in_words = 1 << 20;
 static const int app_controls_tracing = 1;
 static const int app_prints_steps = 0;
 
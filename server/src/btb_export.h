@@ -18,92 +18,281 @@
 #include <l4/sys/types.h>
 #include <l4/re/c/util/kumem_alloc.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 #include <l4/backtracer/btb_control.h>
 
 #include "compress.cpp"
 
+static const unsigned kumem_page_order = 3;
+static const unsigned kumem_capacity_in_pages   = (1 << kumem_page_order);
+static const unsigned kumem_capacity_in_kibytes = kumem_capacity_in_pages * 4;
+static const unsigned kumem_capacity_in_bytes   = kumem_capacity_in_kibytes << 10;
+static const unsigned kumem_capacity_in_words   = kumem_capacity_in_bytes / sizeof(unsigned long);
+
+// how many sections can be in flight between fetching and printing.
+// one is being printed, one is being compressed, one is being copied by the kernel.
+static const unsigned export_pipeline_depth = 3;
+
+// one kumem buffer and what was made from its content, ready to be printed.
+typedef struct export_slot_s {
+	l4_addr_t kumem;
+	// compress_smart writes header, dictionary and compressed data in here
+	unsigned long dictionary_and_compressed [kumem_capacity_in_words];
+
+	// points either into kumem or into dictionary_and_compressed
+	const unsigned long * result_buffer;
+	unsigned long result_words;
+
+	unsigned long returned_words;
+	unsigned long remaining_words;
+} export_slot_t;
+
 static inline
-unsigned long
-export_backtrace_buffer_section (l4_cap_idx_t cap, bool full_section_only, bool try_compress) {
-	const unsigned kumem_page_order = 3;
-	const unsigned kumem_capacity_in_pages   = (1 << kumem_page_order);
-	const unsigned kumem_capacity_in_kibytes = kumem_capacity_in_pages * 4;
-	const unsigned kumem_capacity_in_bytes   = kumem_capacity_in_kibytes << 10;
-	const unsigned kumem_capacity_in_words   = kumem_capacity_in_bytes / sizeof(unsigned long);
-	static l4_addr_t kumem = 0;
-	if (!kumem) {
-		// TODO: this allocation is never freed. this makes sense,
-		// because it basically has life-of-the-process lifetime.
-		if (l4re_util_kumem_alloc(&kumem, kumem_page_order, L4_BASE_TASK_CAP, l4re_env()->rm)) {
-			printf("!!! could not allocate %d kiB kumem!!!\n", kumem_capacity_in_kibytes);
-		}
-		printf("successfully allocated %d kiB kumem at %p\n", kumem_capacity_in_kibytes, (void *) kumem);
+bool allocate_export_kumem (l4_addr_t * kumem) {
+	// TODO: this allocation is never freed. this makes sense,
+	// because it basically has life-of-the-process lifetime.
+	if (l4re_util_kumem_alloc(kumem, kumem_page_order, L4_BASE_TASK_CAP, l4re_env()->rm)) {
+		printf("!!! could not allocate %d kiB kumem!!!\n", kumem_capacity_in_kibytes);
+		return false;
 	}
+	printf("successfully allocated %d kiB kumem at %p\n", kumem_capacity_in_kibytes, (void *) *kumem);
+	return true;
+}
 
+// copies the next section out of the kernel into slot->kumem, counts repeated stacks
+// (with export_intern_stacks) and compresses it.
+// prints only single complete lines, so it may run while another thread prints blocks.
+static inline
+void fetch_backtrace_buffer_section (
+	l4_cap_idx_t cap,
+	export_slot_t * slot,
+	bool full_section_only,
+	bool try_compress
+) {
 	// pointer is redirected if we use compression, length also changes then.
-	unsigned long * actual_result_buffer = (unsigned long *) kumem;
-	unsigned long actual_result_words;
+	slot->result_buffer = (const unsigned long *) slot->kumem;
 
-	compression_header_t * compression_header_1 = (compression_header_t *) kumem;
+	compression_header_t * compression_header_1 = (compression_header_t *) slot->kumem;
 
 	const unsigned long header_capacity_in_words = (
 		try_compress
 		? (sizeof(compression_header_t) - 1) / sizeof(unsigned long) + 1
 		: 0
 	);
-	const unsigned long buffer_capacity_in_words = kumem_capacity_in_words - header_capacity_in_words;
 
-	unsigned long * buffer = ((unsigned long *) kumem) + header_capacity_in_words;
-	unsigned long returned_words;
-	unsigned long remaining_words;
+	unsigned long * buffer = ((unsigned long *) slot->kumem) + header_capacity_in_words;
 	l4_debugger_get_backtrace_buffer_section(
 		cap,
-		(unsigned long *) kumem,
+		(unsigned long *) slot->kumem,
 		kumem_capacity_in_words,
 		header_capacity_in_words, // at what offset data should be copied within kumem
 		(full_section_only ? FULL_SECTION_ONLY : 0),
-		&returned_words,
-		&remaining_words
+		&slot->returned_words,
+		&slot->remaining_words
 	);
 
-	unsigned long dictionary_and_compressed [header_capacity_in_words + returned_words];
-	if (returned_words && try_compress) {
+	// what is left of the section after repeated stacks were counted instead
+	unsigned long section_words = slot->returned_words;
+	if (section_words && export_intern_stacks)
+		section_words = stack_intern_section(std::span<uint64_t> { (uint64_t *) buffer, section_words });
+
+	if (section_words && try_compress) {
 		// we will try to compress into this data buffer,
-		// if dictionary + compressed data don't fit, it's not worth it.
-		printf(
-			"trying to compress\n"
-			"    btb  %16p (cap %8lx w, len %8lx w)\n",
-			buffer, buffer_capacity_in_words, returned_words
-			// continued inside compress_smart, different vars are visible inside or outside
-		);
+		// if the encoded section doesn't fit, it's not worth it.
+		// compress_smart prints a line about what it did.
 		ssize_t compressed_in_words = compress_smart(
-			dictionary_and_compressed,
-			returned_words + header_capacity_in_words,
+			slot->dictionary_and_compressed,
+			section_words + header_capacity_in_words,
 			buffer,
-			returned_words,
+			section_words,
 			compression_header_1
 		);
 		if (compressed_in_words < 0) {
 			// couldn't compress into the given compressed buffer,
-			// leave actual_result_buffer where it is.
-			actual_result_words = header_capacity_in_words + returned_words;
+			// leave result_buffer where it is.
+			slot->result_words = header_capacity_in_words + section_words;
 		} else {
-			actual_result_buffer = &dictionary_and_compressed[0];
-			actual_result_words = compressed_in_words;
+			slot->result_buffer = &slot->dictionary_and_compressed[0];
+			slot->result_words = compressed_in_words;
 		}
 	} else {
-		actual_result_words = header_capacity_in_words + returned_words;
+		slot->result_words = header_capacity_in_words + section_words;
 	}
+}
 
-	if (returned_words) {
-		printf(
-			"printing %16p (len %8lx w =    %8lx B)\n",
-			actual_result_buffer, actual_result_words, actual_result_words * sizeof(unsigned long)
-		);
-		print_backtrace_buffer_section(actual_result_buffer, actual_result_words);
+static inline
+void print_export_slot (const export_slot_t * slot) {
+	if (!slot->returned_words)
+		return;
+
+	printf(
+		"printing %16p (len %8lx w =    %8lx B)\n",
+		slot->result_buffer, slot->result_words, slot->result_words * sizeof(unsigned long)
+	);
+	print_backtrace_buffer_section(slot->result_buffer, slot->result_words);
+}
+
+static inline
+export_slot_t * single_export_slot (void) {
+	static export_slot_t slot;
+	if (!slot.kumem)
+		allocate_export_kumem(&slot.kumem);
+	return &slot;
+}
+
+static inline
+unsigned long
+export_backtrace_buffer_section (l4_cap_idx_t cap, bool full_section_only, bool try_compress) {
+	export_slot_t * slot = single_export_slot();
+
+	fetch_backtrace_buffer_section(cap, slot, full_section_only, try_compress);
+	print_export_slot(slot);
+
+	return slot->remaining_words;
+}
+
+// fetches and prints full sections while the kernel may still write into the buffer,
+// until it has no full section left. returns the number of words drained,
+// *remaining_words is how much was left in the kernel buffer after that.
+static inline
+unsigned long drain_backtrace_buffer_sections (
+	l4_cap_idx_t cap,
+	bool try_compress,
+	unsigned long * remaining_words
+) {
+	export_slot_t * slot = single_export_slot();
+
+	unsigned long drained_words = 0;
+	do {
+		fetch_backtrace_buffer_section(cap, slot, true, try_compress);
+		print_export_slot(slot);
+		drained_words += slot->returned_words;
+	} while (slot->returned_words && slot->remaining_words);
+
+	*remaining_words = slot->remaining_words;
+	return drained_words;
+}
+
+// how long the two stages of the export were busy,
+// if they ran one after the other, the export would have taken the sum.
+typedef struct export_statistics_s {
+	unsigned long sections;
+	l4_uint64_t us_fetching;
+	l4_uint64_t us_printing;
+} export_statistics_t;
+
+// called on the printing thread after each section that had words, with the time it took to print it.
+// for per-section figures of a simulated export, the server does not need it.
+typedef void (* export_section_printed_t) (const export_slot_t * slot, l4_uint64_t us_printing, void * context);
+
+// the fetching thread fills slots, the printing thread empties them in the same order.
+typedef struct export_pipeline_s {
+	export_slot_t slots [export_pipeline_depth];
+
+	pthread_mutex_t lock;
+	pthread_cond_t  changed;
+	// running counts, slot index is count % export_pipeline_depth
+	unsigned long fetched;
+	unsigned long printed;
+	bool all_fetched;
+
+	export_statistics_t statistics;
+	export_section_printed_t section_printed;
+	void * section_printed_context;
+} export_pipeline_t;
+
+static void * export_pipeline_printer (void * pipeline_arg) {
+	export_pipeline_t * pipeline = (export_pipeline_t *) pipeline_arg;
+
+	pthread_mutex_lock(&pipeline->lock);
+	while (true) {
+		while (pipeline->printed == pipeline->fetched && !pipeline->all_fetched)
+			pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+		if (pipeline->printed == pipeline->fetched)
+			break;
+
+		const export_slot_t * slot = &pipeline->slots[pipeline->printed % export_pipeline_depth];
+		pthread_mutex_unlock(&pipeline->lock);
+
+		l4_uint64_t us_start = l4_tsc_to_us(l4_rdtsc());
+		print_export_slot(slot);
+		l4_uint64_t us_stop  = l4_tsc_to_us(l4_rdtsc());
+		if (pipeline->section_printed && slot->returned_words)
+			pipeline->section_printed(slot, us_stop - us_start, pipeline->section_printed_context);
+
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->statistics.us_printing += us_stop - us_start;
+		pipeline->printed ++;
+		pthread_cond_broadcast(&pipeline->changed);
 	}
+	pthread_mutex_unlock(&pipeline->lock);
 
-	return remaining_words;
+	return NULL;
 }
 
+// exports the whole backtrace buffer, while one section is printed,
+// the next ones are already copied out of the kernel and compressed.
+// returns false if the pipeline could not be set up, nothing was exported then.
+// section_printed may be NULL.
+static inline
+bool export_backtrace_buffer_pipelined (
+	l4_cap_idx_t cap,
+	bool full_section_only,
+	bool try_compress,
+	export_statistics_t * statistics,
+	export_section_printed_t section_printed,
+	void * section_printed_context
+) {
+	static export_pipeline_t pipeline;
+	for (unsigned s = 0; s < export_pipeline_depth; s++) {
+		if (!pipeline.slots[s].kumem && !allocate_export_kumem(&pipeline.slots[s].kumem))
+			return false;
+	}
+
+	pthread_mutex_init(&pipeline.lock, NULL);
+	pthread_cond_init(&pipeline.changed, NULL);
+	pipeline.fetched = 0;
+	pipeline.printed = 0;
+	pipeline.all_fetched = false;
+	pipeline.statistics.sections    = 0;
+	pipeline.statistics.us_fetching = 0;
+	pipeline.statistics.us_printing = 0;
+	pipeline.section_printed = section_printed;
+	pipeline.section_printed_context = section_printed_context;
+
+	pthread_t printer;
+	if (pthread_create(&printer, NULL, export_pipeline_printer, &pipeline)) {
+		printf("!!! could not start the export printer thread !!!\n");
+		return false;
+	}
+
+	unsigned long remaining_words = 1;
+	while (remaining_words) {
+		pthread_mutex_lock(&pipeline.lock);
+		while (pipeline.fetched - pipeline.printed == export_pipeline_depth)
+			pthread_cond_wait(&pipeline.changed, &pipeline.lock);
+		export_slot_t * slot = &pipeline.slots[pipeline.fetched % export_pipeline_depth];
+		pthread_mutex_unlock(&pipeline.lock);
+
+		l4_uint64_t us_start = l4_tsc_to_us(l4_rdtsc());
+		fetch_backtrace_buffer_section(cap, slot, full_section_only, try_compress);
+		l4_uint64_t us_stop  = l4_tsc_to_us(l4_rdtsc());
+		remaining_words = slot->remaining_words;
+
+		pthread_mutex_lock(&pipeline.lock);
+		pipeline.statistics.us_fetching += us_stop - us_start;
+		pipeline.statistics.sections ++;
+		pipeline.fetched ++;
+		pipeline.all_fetched = !remaining_words;
+		pthread_cond_broadcast(&pipeline.changed);
+		pthread_mutex_unlock(&pipeline.lock);
+	}
+
+	pthread_join(printer, NULL);
+	pthread_cond_destroy(&pipeline.changed);
+	pthread_mutex_destroy(&pipeline.lock);
+
+	*statistics = pipeline.statistics;
+	return true;
+}
@@ -1,11 +1,16 @@
 #include <algorithm>
 #include <cstdio>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <span>
 #include <type_traits>
 #include <vector>
 
+#include <l4/util/rdtsc.h>
+
 #include "compress.hpp"
 
 void assert_dictionary_capacity (const size_t dictionary_size);
@@ -27,6 +32,143 @@ extern "C" ssize_t compress_c (
 	return compress(compressed, raw_data, dictionary);
 }
 
+// a section that can't be recovered only breaks the following sections until the next full dictionary
+static constexpr size_t dictionary_full_interval = 16;
+
+typedef struct persistent_dictionary_s {
+	bool valid = false;
+	size_t sections_since_full = 0;
+	std::vector<uint64_t> dictionary;
+} persistent_dictionary_t;
+
+// the dictionary the decoder knows after the last dictionary compressed section
+static persistent_dictionary_t persistent_dictionary;
+
+/**
+ * section encoders: compress_smart estimates what each of them would make of the section
+ * and uses the cheapest. the estimates of the dictionary coders only compress the first
+ * section_sample_words words and scale that up, since the start of a section says a lot
+ * about the rest of it (a start full of BTE_MAPPING and BTE_INFO entries compresses worse
+ * than the stacks later on, so the estimate rather errs towards the raw encoders).
+ * to add an encoder, give it a new id in compress.hpp, an entry here and a case
+ * in the decoder (external/src/decompress.cpp).
+ */
+typedef struct section_encoder_s {
+	const char * name;
+	// works on the words from stack_delta_encode instead of the raw words
+	bool stack_delta;
+	// dictionary coded, with dictionary delta and entropy stage when they are shorter
+	bool dictionary;
+} section_encoder_t;
+
+static const section_encoder_t section_encoders [section_encoder_count] = {
+	{ "raw",                    false, false },
+	{ "dictionary",             false, true  },
+	{ "stack_delta",            true,  false },
+	{ "stack_delta+dictionary", true,  true  },
+};
+
+static constexpr size_t section_sample_words = 512;
+
+const char * section_encoder_name (unsigned long encoder) {
+	if (encoder >= section_encoder_count)
+		return "unknown";
+	return section_encoders[encoder].name;
+}
+
+static size_t estimate_dictionary_bytes (std::span<const uint64_t> const & words) {
+	std::span const sample = words.first(std::min(words.size(), section_sample_words));
+	if (sample.empty())
+		return 0;
+
+	std::vector<uint64_t> dictionary (dictionary_capacity, 0);
+	const size_t dictionary_length = create_dictionary(std::span { dictionary }, sample);
+	std::vector<uint8_t> compressed (sample.size() * (1 + sizeof(uint64_t)));
+	const size_t compressed_bytes = compress(std::span { compressed }, sample, dictionary);
+
+	return dictionary_length * sizeof(uint64_t) + compressed_bytes * words.size() / sample.size();
+}
+
+// writes dictionary (or its delta) and the compressed data of words behind header_capacity_in_words.
+// returns the number of words used with the header, -1 if it does not fit, *flags gets the stages used.
+static ssize_t encode_dictionary (
+	std::span<uint64_t>       const   c_dictionary_and_compressed,
+	size_t                    const   header_capacity_in_words,
+	std::span<const uint64_t> const & words,
+	size_t                          & dictionary_length,
+	size_t                          & compressed_bytes,
+	unsigned long                   & flags
+) {
+	if (c_dictionary_and_compressed.size() <= header_capacity_in_words + dictionary_capacity)
+		return -1;
+
+	std::vector<uint64_t> fresh_dictionary (dictionary_capacity, 0);
+	const size_t fresh_dictionary_length = create_dictionary(std::span { fresh_dictionary }, words);
+
+	// after a full dictionary, following sections only send the slots that change,
+	// if that is shorter, and as long as the next full one is not due.
+	persistent_dictionary_t & persistent = persistent_dictionary;
+	std::vector<uint64_t> evolved_dictionary;
+	std::vector<uint64_t> dictionary_delta;
+	if (persistent.valid && persistent.sections_since_full + 1 < dictionary_full_interval)
+		make_dictionary_delta(persistent.dictionary, fresh_dictionary, evolved_dictionary, dictionary_delta);
+	const bool use_dictionary_delta = (
+		!dictionary_delta.empty()
+		&& dictionary_delta.size() < fresh_dictionary_length
+	);
+
+	// the data is compressed with used_dictionary, printed_dictionary is what the decoder needs for that
+	const std::vector<uint64_t> & used_dictionary    = use_dictionary_delta ? evolved_dictionary : fresh_dictionary;
+	const std::vector<uint64_t> & printed_dictionary = use_dictionary_delta ? dictionary_delta   : fresh_dictionary;
+	dictionary_length = use_dictionary_delta ? dictionary_delta.size() : fresh_dictionary_length;
+	uint64_t * c_dictionary = &c_dictionary_and_compressed[header_capacity_in_words];
+	std::copy(printed_dictionary.begin(), printed_dictionary.begin() + dictionary_length, c_dictionary);
+
+	uint8_t * c_compressed = reinterpret_cast<uint8_t *> (c_dictionary + dictionary_length);
+	const size_t compressed_capacity_in_bytes = (
+		c_dictionary_and_compressed.size()
+		- dictionary_length
+		- header_capacity_in_words
+	) * sizeof(unsigned long);
+	std::span compressed { c_compressed, compressed_capacity_in_bytes };
+
+	ssize_t result_bytes = compress(compressed, words, std::span { used_dictionary });
+	if (result_bytes < 0)
+		return -1;
+
+	// the key stream is usually very skewed, huffman coding it may save a lot more.
+	bool use_entropy = false;
+	if (result_bytes > 0) {
+		std::vector<uint8_t> entropy_coded (result_bytes);
+		const ssize_t entropy_bytes = entropy_encode(
+			std::span { entropy_coded },
+			std::span<const uint8_t> { c_compressed, static_cast<size_t>(result_bytes) }
+		);
+		if (entropy_bytes >= 0 && entropy_bytes < result_bytes) {
+			std::copy(entropy_coded.begin(), entropy_coded.begin() + entropy_bytes, c_compressed);
+			result_bytes = entropy_bytes;
+			use_entropy = true;
+		}
+	}
+
+	// the compressed data ends within its last word, don't print what was there before
+	for (size_t padding = result_bytes; padding % sizeof(unsigned long); padding++)
+		c_compressed[padding] = 0;
+
+	// only now the decoder will see this dictionary
+	persistent.dictionary = used_dictionary;
+	persistent.valid = true;
+	persistent.sections_since_full = use_dictionary_delta ? persistent.sections_since_full + 1 : 0;
+
+	compressed_bytes = result_bytes;
+	flags = (
+		compression_flag_dictionary
+		| (use_dictionary_delta ? compression_flag_dictionary_delta : 0)
+		| (use_entropy          ? compression_flag_entropy          : 0)
+	);
+	return header_capacity_in_words + dictionary_length + (compressed_bytes + sizeof(unsigned long) - 1) / sizeof(unsigned long);
+}
+
 ssize_t compress_smart (
 	uint64_t       c_dictionary_and_compressed [], // and header
 	size_t   const c_dictionary_and_compressed_in_words,
@@ -34,82 +176,102 @@ ssize_t compress_smart (
 	size_t   const c_raw_data_in_words,
 	compression_header_t * compression_header_1
 ) {
+	static unsigned long section_counter = 0;
+	// the same clock as the export timings in btb_export.h
+	const l4_uint64_t us_start = l4_tsc_to_us(l4_rdtsc());
+
 	// we will try to compress into this data buffer,
-	// if dictionary + compressed data don't fit, it's not worth it and we return -1.
+	// if the encoded data doesn't fit, it's not worth it and we return -1.
 	const unsigned long header_capacity_in_words = (sizeof(compression_header_t) - 1) / sizeof(unsigned long) + 1;
 	compression_header_t * compression_header_2 = (compression_header_t *) &c_dictionary_and_compressed[0];
-	uint64_t * c_dictionary = &c_dictionary_and_compressed[header_capacity_in_words];
+	std::span const output { c_dictionary_and_compressed, c_dictionary_and_compressed_in_words };
+	std::span const raw_data { c_raw_data, c_raw_data_in_words };
 
-	if (static_cast<ssize_t>(c_dictionary_and_compressed_in_words) - header_capacity_in_words <= dictionary_capacity) {
-		printf("dictionary_and_compressed is too short for header and dictionary.\n");
-		compression_header_1->is_compressed = false;
-		compression_header_1->dictionary_length = 0;
-		compression_header_1->dictionary_offset = header_capacity_in_words;
-		compression_header_1->data_length_in_bytes = c_raw_data_in_words * sizeof(unsigned long);
-		return -1;
+	// has to see every section, even if it is not compressed, to keep track of entry boundaries
+	std::vector<uint64_t> delta_data;
+	const bool stack_delta = stack_delta_encode(delta_data, raw_data);
+
+	size_t estimated_bytes [section_encoder_count];
+	estimated_bytes[section_encoder_raw]        = raw_data.size() * sizeof(uint64_t);
+	estimated_bytes[section_encoder_dictionary] = estimate_dictionary_bytes(raw_data);
+	estimated_bytes[section_encoder_stack_delta] = (
+		stack_delta ? delta_data.size() * sizeof(uint64_t) : SIZE_MAX
+	);
+	estimated_bytes[section_encoder_stack_delta_dictionary] = (
+		stack_delta ? estimate_dictionary_bytes(delta_data) : SIZE_MAX
+	);
+
+	unsigned long encoder = section_encoder_raw;
+	for (unsigned long e = 0; e < section_encoder_count; e++) {
+		if (estimated_bytes[e] < estimated_bytes[encoder])
+			encoder = e;
 	}
 
-	std::span const raw_data   {   c_raw_data, c_raw_data_in_words };
-	std::span       dictionary { c_dictionary, dictionary_capacity };
-	const size_t dictionary_length = create_dictionary(dictionary, raw_data);
+	std::span const words = (
+		section_encoders[encoder].stack_delta
+		? std::span<const uint64_t> { delta_data }
+		: std::span<const uint64_t> { raw_data }
+	);
 
-	uint8_t * c_compressed = reinterpret_cast<uint8_t *> (c_dictionary + dictionary_length);
-	const size_t compressed_capacity_in_bytes = (
-		c_dictionary_and_compressed_in_words
-		- dictionary_length
-		- header_capacity_in_words
-	) * sizeof(unsigned long);
-	std::span compressed { c_compressed, compressed_capacity_in_bytes };
+	ssize_t result_words = -1;
+	size_t dictionary_length = 0;
+	size_t data_length_in_bytes = 0;
+	unsigned long flags = 0;
+	if (section_encoders[encoder].dictionary) {
+		result_words = encode_dictionary(
+			output, header_capacity_in_words, words,
+			dictionary_length, data_length_in_bytes, flags
+		);
+		if (result_words < 0) {
+			// the estimate was off, fall back to the same words without dictionary
+			encoder = section_encoders[encoder].stack_delta ? section_encoder_stack_delta : section_encoder_raw;
+			dictionary_length = 0;
+			flags = 0;
+		}
+	}
+	if (encoder == section_encoder_stack_delta) {
+		// the delta coded words are shorter than the raw words, so they fit
+		std::copy(delta_data.begin(), delta_data.end(), &output[header_capacity_in_words]);
+		data_length_in_bytes = delta_data.size() * sizeof(unsigned long);
+		result_words = header_capacity_in_words + delta_data.size();
+	}
+	if (section_encoders[encoder].stack_delta)
+		flags |= compression_flag_stack_delta;
 
-	printf(
-		// first part is printed in caller
-		// "trying to compress\n"
-		// "    btb  %16p (cap %8ld w, len %ld w)\n"
-		"    into %16p (cap %8lx w =    %8lx B),\n"
-		"    dict %16p (cap %8lx w =    %8lx B)\n",
-		c_compressed, compressed_capacity_in_bytes / sizeof(unsigned long), compressed_capacity_in_bytes,
-		c_dictionary, dictionary_length, dictionary_length * sizeof(unsigned long)
+	compression_header_t * actual_compression_header = (
+		encoder == section_encoder_raw
+		? compression_header_1
+		: compression_header_2
+	);
+	if (encoder == section_encoder_raw) {
+		// the header goes in front of the raw data
+		data_length_in_bytes = raw_data.size() * sizeof(unsigned long);
+		result_words = -1;
+	}
+	compression_header_set(actual_compression_header, encoder, flags);
+	actual_compression_header->dictionary_length = dictionary_length;
+	actual_compression_header->dictionary_offset = header_capacity_in_words;
+	actual_compression_header->data_length_in_bytes = data_length_in_bytes;
+
+	const size_t printed_words = (
+		result_words < 0
+		? header_capacity_in_words + raw_data.size()
+		: result_words
 	);
-	const ssize_t compressed_bytes = compress(compressed, raw_data, dictionary);
-	compression_header_t * actual_compression_header;
-	const uint64_t * actual_result_buffer;
-	if (compressed_bytes < 0) {
-		actual_result_buffer = &c_raw_data[0];
-		// write the header struct it points to
-		compression_header_1->is_compressed = false;
-		compression_header_1->dictionary_length = 0;
-		compression_header_1->dictionary_offset = header_capacity_in_words;
-		compression_header_1->data_length_in_bytes = (c_raw_data_in_words - header_capacity_in_words) * sizeof(unsigned long);
-		actual_compression_header = compression_header_1;
-	} else {
-		actual_result_buffer = &c_dictionary_and_compressed[0];
-		compression_header_2->is_compressed = true;
-		compression_header_2->dictionary_length = dictionary_length;
-		compression_header_2->dictionary_offset = header_capacity_in_words;
-		compression_header_2->data_length_in_bytes = compressed_bytes;
-		actual_compression_header = compression_header_2;
-	}
-
-	size_t data_length_in_words = (actual_compression_header->data_length_in_bytes - 1) / sizeof(unsigned long) + 1;
+	const l4_uint64_t us_taken = l4_tsc_to_us(l4_rdtsc()) - us_start;
 	printf(
-		"compressed: %s,\n"
-		"    dict %16p (len %8lx w =    %8lx B),\n"
-		"    data %16p (len %8lx w<=    %8lx B)\n",
-		actual_compression_header->is_compressed ? "True" : "False",
-		actual_result_buffer + actual_compression_header->dictionary_offset,
-		actual_compression_header->dictionary_length,
-		actual_compression_header->dictionary_length * sizeof(unsigned long),
-		actual_result_buffer +
-		actual_compression_header->dictionary_offset +
-		actual_compression_header->dictionary_length,
-		data_length_in_words,
-		actual_compression_header->data_length_in_bytes
+		"section %4ld: %-22s %s%s %6ld w -> %6ld w %6.2f %% %6ld us\n",
+		section_counter,
+		section_encoder_name(encoder),
+		flags & compression_flag_dictionary_delta ? "d" : "-",
+		flags & compression_flag_entropy          ? "e" : "-",
+		raw_data.size(), printed_words,
+		100.0 * printed_words / raw_data.size(),
+		static_cast<long>(us_taken)
 	);
+	section_counter ++;
 
-	if (compressed_bytes < 0)
-		return compressed_bytes;
-	else
-		return header_capacity_in_words + dictionary_length + data_length_in_words;
+	return result_words;
 }
 
 /**
@@ -121,11 +283,10 @@ ssize_t compress_smart (
  * 	any other: use as index in dictionary
  *
  * 	these could be changed, but currently create_dictionary relies on:
- * 	 zero_marker < raw_marker (both are noted as 0,
- * 	    compressing 0 would otherwise use the raw marker instead of the zero marker)
- * 	 raw_marker < all free keys (the used size of the dictionary returned by create_dictionary
- * 	    could not include one of the two markers, since it is set
- * 	    with the first dict key that has no dict_heap to fill it)
+ * 	 both markers < all free keys (the used size of the dictionary returned by create_dictionary
+ * 	    could not include one of the two markers, since it counts
+ * 	    the markers and then the filled keys)
+ * 	 raw 0 never gets a dictionary key, compress always uses zero_marker for it.
  */
 static constexpr uint8_t zero_marker = 0x00;
 static constexpr uint8_t  raw_marker = 0x01;
@@ -149,75 +310,202 @@ public:
 
 	dict_node () = default;
 	dict_node (uint64_t raw) : raw(raw), occurrences(1) {}
+	dict_node (uint64_t raw, uint64_t occurrences) : raw(raw), occurrences(occurrences) {}
 
 	bool operator < (const dict_node & other) {
 		return occurrences < other.occurrences;
 	}
 };
 
-size_t create_dictionary (
-	std::span<      uint64_t> const & dictionary,
-	std::span<const uint64_t> const & raw_data
-) {
-	assert_dictionary_capacity (dictionary.size());
+/**
+ * open addressing hash table (linear probing) from raw words to a count or key.
+ * raw 0 is never stored (it has the zero_marker), so it marks empty slots.
+ * capacity is a power of two and at least twice the number of words stored,
+ * so probe sequences stay short.
+ */
+class word_table {
+	std::vector<uint64_t> raws;
+	std::vector<uint64_t> values;
+	size_t mask;
+	unsigned shift;
 
-	std::vector<dict_node> dict_heap;
-	dict_heap.reserve(dictionary.size());
+	size_t slot (uint64_t raw) const {
+		// fibonacci hashing: the high bits of the product are well mixed
+		size_t s = static_cast<size_t>((raw * 0x9e3779b97f4a7c15ULL) >> shift);
+		while (raws[s] != 0 && raws[s] != raw)
+			s = (s + 1) & mask;
+		return s;
+	}
 
-	for (const auto & raw : raw_data) {
-		const auto node_ptr = std::find_if(dict_heap.begin(), dict_heap.end(),
-			[&raw] (const dict_node & node) {
-				return node.raw == raw;
-			}
-		);
-		if (node_ptr != dict_heap.end()) {
-			node_ptr->occurrences ++;
-			std::make_heap(dict_heap.begin(), dict_heap.end());
-		} else {
-			dict_heap.emplace_back(raw);
-			std::push_heap(dict_heap.begin(), dict_heap.end());
+public:
+	word_table (size_t max_words) {
+		size_t capacity = 16;
+		unsigned bits = 4;
+		while (capacity < 2 * max_words) {
+			capacity <<= 1;
+			bits ++;
 		}
+		raws.assign(capacity, 0);
+		values.assign(capacity, 0);
+		mask = capacity - 1;
+		shift = 64 - bits;
+	}
 
-		// this cutting off of rare words causes slightly worse compression
-		// but spares us a lot of realloc if raw_data is diverse
-		if (dict_heap.size() >= 2 * dictionary.size()) {
-			dict_heap.resize(dictionary.size());
-		}
+	// returns the value stored for raw, inserting it with value 0 if it is new.
+	uint64_t & operator [] (uint64_t raw) {
+		size_t s = slot(raw);
+		raws[s] = raw;
+		return values[s];
 	}
 
-	auto entry = dictionary.begin();
+	bool find (uint64_t raw, uint64_t & value) const {
+		size_t s = slot(raw);
+		if (raws[s] == 0)
+			return false;
+		value = values[s];
+		return true;
+	}
 
-	size_t actual_dictionary_used = 0;
+	template <typename Function>
+	void for_each (Function function) const {
+		for (size_t s = 0; s < raws.size(); s++)
+			if (raws[s] != 0)
+				function(raws[s], values[s]);
+	}
+};
 
-	for (; entry < dictionary.end(); ++entry) {
-		uint8_t key = entry - dictionary.begin();
-		if (key == zero_marker) {
-			*entry = 0;
-			continue;
-		}
-		if (key == raw_marker) {
-			*entry = 0;
+/**
+ * dictionary delta: instead of the whole dictionary, a section may only send what changed
+ * against the dictionary of the previous dictionary compressed section:
+ * 	dictionary_checksum of that previous dictionary, so a missing section is noticed,
+ * 	a bitmap of the changed slots (bit s % 64 of word s / 64),
+ * 	the new words of the changed slots in slot order.
+ * words that stay in the dictionary keep their slot, new words take the slots of words
+ * that are not wanted anymore.
+ */
+static constexpr size_t dictionary_delta_bitmap_words = dictionary_capacity / 64;
+static constexpr size_t dictionary_delta_header_words = 1 + dictionary_delta_bitmap_words;
+
+uint64_t dictionary_checksum (std::span<const uint64_t> const & dictionary) {
+	// FNV-1a over whole words, zeros up to dictionary_capacity count as well
+	uint64_t checksum = 0xcbf29ce484222325;
+	for (size_t key = 0; key < dictionary_capacity; key++) {
+		checksum ^= key < dictionary.size() ? dictionary[key] : 0;
+		checksum *= 0x100000001b3;
+	}
+	return checksum;
+}
+
+void make_dictionary_delta (
+	std::span<const uint64_t> const & previous,
+	std::span<const uint64_t> const & fresh,
+	std::vector<uint64_t>           & evolved,
+	std::vector<uint64_t>           & delta
+) {
+	assert_dictionary_capacity (previous.size());
+	assert_dictionary_capacity (fresh.size());
+
+	word_table fresh_words    { fresh.size() };
+	word_table previous_words { previous.size() };
+	for (size_t key = marker_reserved; key < dictionary_capacity; key++) {
+		if (fresh[key])
+			fresh_words[fresh[key]] = key;
+		if (previous[key])
+			previous_words[previous[key]] = key;
+	}
+
+	uint64_t unused;
+	std::vector<size_t> free_slots;
+	for (size_t key = marker_reserved; key < dictionary_capacity; key++) {
+		if (!previous[key] || !fresh_words.find(previous[key], unused))
+			free_slots.push_back(key);
+	}
+
+	// fresh is sorted by occurrences, so the most frequent new words come first.
+	// there are always enough free slots: each fresh word that is not new keeps one occupied.
+	evolved.assign(previous.begin(), previous.end());
+	auto free_slot = free_slots.begin();
+	for (size_t key = marker_reserved; key < dictionary_capacity; key++) {
+		if (fresh[key] && !previous_words.find(fresh[key], unused))
+			evolved[*free_slot++] = fresh[key];
+	}
+
+	delta.assign(dictionary_delta_header_words, 0);
+	delta[0] = dictionary_checksum(previous);
+	for (size_t key = 0; key < dictionary_capacity; key++) {
+		if (evolved[key] == previous[key])
 			continue;
-		}
-		if (dict_heap.empty()) {
-			if (actual_dictionary_used == 0) {
-				actual_dictionary_used = entry - dictionary.begin();
-			}
-			*entry = 0;
+		delta[1 + key / 64] |= 1UL << (key % 64);
+		delta.push_back(evolved[key]);
+	}
+}
+
+bool apply_dictionary_delta (
+	std::vector<uint64_t>           & dictionary,
+	std::span<const uint64_t> const & delta
+) {
+	if (delta.size() < dictionary_delta_header_words)
+		return false;
+	if (dictionary_checksum(dictionary) != delta[0])
+		return false;
+
+	dictionary.resize(dictionary_capacity, 0);
+	auto changed = delta.begin() + dictionary_delta_header_words;
+	for (size_t key = 0; key < dictionary_capacity; key++) {
+		if (!(delta[1 + key / 64] & (1UL << (key % 64))))
 			continue;
-		}
+		if (changed == delta.end())
+			return false;
+		dictionary[key] = *changed++;
+	}
+	return changed == delta.end();
+}
+
+size_t create_dictionary (
+	std::span<      uint64_t> const & dictionary,
+	std::span<const uint64_t> const & raw_data
+) {
+	assert_dictionary_capacity (dictionary.size());
 
-		std::pop_heap(dict_heap.begin(), dict_heap.end());
-		uint64_t raw = dict_heap.back().raw;
-		dict_heap.pop_back();
+	word_table occurrences { raw_data.size() };
+	size_t distinct_words = 0;
+	for (const auto & raw : raw_data) {
+		// 0 always has its own marker, a dictionary entry would be wasted on it
+		if (raw == 0)
+			continue;
 
-		*entry = raw;
+		uint64_t & count = occurrences[raw];
+		if (count == 0)
+			distinct_words ++;
+		count ++;
 	}
-	if (actual_dictionary_used == 0) {
-		actual_dictionary_used = dictionary.size();
+
+	std::vector<dict_node> nodes;
+	nodes.reserve(distinct_words);
+	occurrences.for_each([&nodes] (uint64_t raw, uint64_t count) {
+		nodes.emplace_back(raw, count);
+	});
+
+	// only the most frequent words get a key, in descending order of occurrences.
+	// ties are broken by raw value so the dictionary does not depend on the hashing.
+	const size_t free_keys = dictionary.size() - marker_reserved;
+	const size_t selected = std::min(free_keys, nodes.size());
+	std::partial_sort(nodes.begin(), nodes.begin() + selected, nodes.end(),
+		[] (const dict_node & a, const dict_node & b) {
+			if (a.occurrences != b.occurrences)
+				return a.occurrences > b.occurrences;
+			return a.raw < b.raw;
+		}
+	);
+
+	std::fill(dictionary.begin(), dictionary.end(), 0);
+	for (size_t n = 0; n < selected; n++) {
+		dictionary[marker_reserved + n] = nodes[n].raw;
 	}
 
-	return actual_dictionary_used;
+	if (selected < free_keys)
+		return marker_reserved + selected;
+	return dictionary.size();
 }
 
 ssize_t compress (
@@ -227,11 +515,21 @@ ssize_t compress (
 ) {
 	auto comp = compressed.begin();
 
-	auto push_key = [&] (std::remove_reference<decltype(dictionary)>::type::iterator const & key_as_it) {
+	// reverse index raw -> key. if a raw is in the dictionary twice, the first key is used.
+	word_table keys { dictionary.size() };
+	for (size_t key = marker_reserved; key < dictionary.size(); key++) {
+		if (dictionary[key] == 0)
+			continue;
+
+		uint64_t & stored_key = keys[dictionary[key]];
+		if (stored_key == 0)
+			stored_key = key;
+	}
+
+	auto push_key = [&] (uint64_t key) {
 		if (comp + 1 > compressed.end())
 			return false;
 
-		auto key = key_as_it - dictionary.begin();
 		*comp = static_cast<uint8_t> (key);
 		++comp;
 		return true;
@@ -251,13 +549,16 @@ ssize_t compress (
 	};
 
 	for (const auto & raw : raw_data) {
-		auto key = std::find(dictionary.begin(), dictionary.end(), raw);
-		if (key == dictionary.end()) {
-			if (!push_raw(raw))
+		uint64_t key;
+		if (raw == 0) {
+			if (!push_key(zero_marker))
 				return -1;
-		} else {
+		} else if (keys.find(raw, key)) {
 			if (!push_key(key))
 				return -1;
+		} else {
+			if (!push_raw(raw))
+				return -1;
 		}
 	}
 	return comp - compressed.begin();
@@ -302,3 +603,754 @@ std::vector<uint64_t> decompress (
 
 	return result;
 }
+
+/**
+ * stack delta coding: consecutive samples of the same cpu and task mostly share
+ * their outermost frames (the end of the payload) and often the kernel entry path
+ * (the start of the payload). every complete BTE_STACK entry is replaced by
+ * 	stack_delta_marker, entry_length,
+ * 	the other header words: cpu_id and task_id as they are, all others as difference
+ * 	    to the previous stack of the same cpu and task (tsc_time becomes the time since it),
+ * 	(shared_prefix << 32) | shared_suffix, the number of payload words equal to the
+ * 	    start and the end of the previous payload,
+ * 	the payload words in between.
+ * all other entries, and entries that continue into the next section, are copied as they are.
+ * in front of that are stack_delta_header_words:
+ * 	number of words before the first entry starts (rest of an entry from the previous section),
+ * 	header length, offset of cpu_id and offset of task_id in BTE_STACK entries.
+ * the first stack of each cpu and task in a section is not delta coded against anything,
+ * so every section can be decoded on its own.
+ */
+static constexpr uint64_t stack_delta_marker = 0x5354414b44454c54; // "STAKDELT", no entry type
+static constexpr size_t stack_delta_header_words = 4;
+// entry types as in external/src/EntryDescriptor.hpp
+static constexpr uint64_t stack_delta_bte_stack = 1 << 0;
+static constexpr uint64_t stack_delta_bte_info  = 1 << 2;
+static constexpr size_t words_per_entry_name = 2;
+
+typedef std::pair<uint64_t, uint64_t> stack_delta_key_t; // cpu_id, task_id
+
+typedef struct stack_delta_state_s {
+	// read from the BTE_INFO entry, stacks are copied as they are until then
+	bool layout_known = false;
+	size_t header_length = 0;
+	size_t cpu_id_offset = 0;
+	size_t task_id_offset = 0;
+	// 0 if the stack entries do not have them
+	size_t tsc_time_offset = 0;
+	size_t tsc_duration_offset = 0;
+	// the payload is a ring buffer that starts at this index, see Entry::payload_word
+	size_t start_index_offset = 0;
+
+	// the last entry of the previous section continues for this many words
+	size_t continued_words = 0;
+	// the previous section ended after the entry_type word, continued_words is not known yet
+	bool continued_length_unknown = false;
+} stack_delta_state_t;
+
+// the server exports all sections in buffer order from one thread, so one state is enough
+static stack_delta_state_t stack_delta_state;
+
+static bool read_stack_layout (
+	stack_delta_state_t             & state,
+	std::span<const uint64_t> const & info_entry
+) {
+	// same layout as read by EntryDescriptorMap in external/src/EntryDescriptor.cpp
+	if (info_entry.size() < 7)
+		return false;
+
+	const size_t padding = info_entry[4] == 2 ? 1 : 0;
+	const uint64_t type_count = info_entry[5];
+	const size_t names_offset = 6 + padding + type_count;
+	if (type_count == 0 || names_offset > info_entry.size())
+		return false;
+
+	// stacks are the first entry type, their names start right away
+	const size_t header_length = info_entry[6 + padding];
+	if (names_offset + header_length * words_per_entry_name > info_entry.size())
+		return false;
+
+	auto find_name = [&] (const char * wanted) -> ssize_t {
+		for (size_t a = 0; a < header_length; a++) {
+			const char * name = reinterpret_cast<const char *>(
+				&info_entry[names_offset + a * words_per_entry_name]
+			);
+			if (strncmp(name, wanted, words_per_entry_name * sizeof(uint64_t)) == 0)
+				return a;
+		}
+		return -1;
+	};
+	const ssize_t cpu_id_offset  = find_name("cpu_id");
+	const ssize_t task_id_offset = find_name("task_id");
+	if (cpu_id_offset < 2 || task_id_offset < 2)
+		return false;
+
+	state.layout_known   = true;
+	state.header_length  = header_length;
+	state.cpu_id_offset  = cpu_id_offset;
+	state.task_id_offset = task_id_offset;
+	state.tsc_time_offset     = std::max<ssize_t>(find_name("tsc_time"), 0);
+	state.tsc_duration_offset = std::max<ssize_t>(find_name("tsc_duration"), 0);
+	state.start_index_offset  = std::max<ssize_t>(find_name("start_index"), 0);
+	return true;
+}
+
+bool stack_delta_encode (
+	std::vector<uint64_t>           & encoded,
+	std::span<const uint64_t> const & raw_data
+) {
+	stack_delta_state_t & state = stack_delta_state;
+
+	encoded.clear();
+	encoded.reserve(raw_data.size() + stack_delta_header_words);
+	encoded.resize(stack_delta_header_words);
+
+	if (state.continued_length_unknown && raw_data.size()) {
+		// the entry_length already counts the entry_type from the previous section
+		state.continued_words = raw_data[0] ? raw_data[0] - 1 : raw_data.size();
+		state.continued_length_unknown = false;
+	}
+	const size_t continued = std::min(state.continued_words, raw_data.size());
+	state.continued_words -= continued;
+	encoded.insert(encoded.end(), raw_data.begin(), raw_data.begin() + continued);
+
+	std::map<stack_delta_key_t, std::span<const uint64_t>> previous_stacks;
+	bool usable = true;
+	size_t position = continued;
+	while (position < raw_data.size()) {
+		const size_t available = raw_data.size() - position;
+		const uint64_t entry_type = raw_data[position];
+		if (entry_type == stack_delta_marker) {
+			// the decoder could not tell this apart from a delta coded stack
+			usable = false;
+		}
+		if (available < 2) {
+			encoded.push_back(entry_type);
+			state.continued_length_unknown = true;
+			break;
+		}
+
+		const uint64_t entry_length = raw_data[position + 1];
+		if (entry_length < 2) {
+			// no proper entry, there's no telling where the next one starts
+			encoded.insert(encoded.end(), raw_data.begin() + position, raw_data.end());
+			break;
+		}
+		if (entry_length > available) {
+			encoded.insert(encoded.end(), raw_data.begin() + position, raw_data.end());
+			state.continued_words = entry_length - available;
+			break;
+		}
+
+		std::span const entry = raw_data.subspan(position, entry_length);
+		position += entry_length;
+
+		if (entry_type == stack_delta_bte_info)
+			read_stack_layout(state, entry);
+
+		if (
+			entry_type != stack_delta_bte_stack
+			|| !state.layout_known
+			|| entry_length < state.header_length
+		) {
+			encoded.insert(encoded.end(), entry.begin(), entry.end());
+			continue;
+		}
+
+		const stack_delta_key_t key { entry[state.cpu_id_offset], entry[state.task_id_offset] };
+		const auto found = previous_stacks.find(key);
+		std::span<const uint64_t> previous;
+		if (found != previous_stacks.end())
+			previous = found->second;
+
+		encoded.push_back(stack_delta_marker);
+		encoded.push_back(entry_length);
+		for (size_t offset = 2; offset < state.header_length; offset++) {
+			if (offset == state.cpu_id_offset || offset == state.task_id_offset || previous.empty())
+				encoded.push_back(entry[offset]);
+			else
+				encoded.push_back(entry[offset] - previous[offset]);
+		}
+
+		std::span const payload = entry.subspan(state.header_length);
+		std::span const previous_payload = (
+			previous.empty() ? previous : previous.subspan(state.header_length)
+		);
+		const size_t shareable = std::min(payload.size(), previous_payload.size());
+		size_t shared_prefix = 0;
+		while (
+			shared_prefix < shareable
+			&& payload[shared_prefix] == previous_payload[shared_prefix]
+		)
+			shared_prefix ++;
+		size_t shared_suffix = 0;
+		while (
+			shared_prefix + shared_suffix < shareable
+			&& payload[payload.size() - 1 - shared_suffix]
+			== previous_payload[previous_payload.size() - 1 - shared_suffix]
+		)
+			shared_suffix ++;
+
+		encoded.push_back((static_cast<uint64_t>(shared_prefix) << 32) | shared_suffix);
+		encoded.insert(
+			encoded.end(),
+			payload.begin() + shared_prefix,
+			payload.end() - shared_suffix
+		);
+		previous_stacks[key] = entry;
+	}
+
+	encoded[0] = continued;
+	encoded[1] = state.header_length;
+	encoded[2] = state.cpu_id_offset;
+	encoded[3] = state.task_id_offset;
+
+	return usable && state.layout_known && encoded.size() < raw_data.size();
+}
+
+std::vector<uint64_t> stack_delta_decode (
+	std::span<const uint64_t> const & encoded
+) {
+	auto fail = [] (const char * reason) {
+		printf("stack delta coded data is broken: %s\n", reason);
+		exit(1);
+	};
+
+	if (encoded.size() < stack_delta_header_words)
+		fail("too short for header");
+
+	const size_t continued      = encoded[0];
+	const size_t header_length  = encoded[1];
+	const size_t cpu_id_offset  = encoded[2];
+	const size_t task_id_offset = encoded[3];
+	if (
+		continued > encoded.size() - stack_delta_header_words
+		|| cpu_id_offset  >= header_length
+		|| task_id_offset >= header_length
+	)
+		fail("header does not fit the data");
+
+	std::vector<uint64_t> result;
+	result.reserve(encoded.size() * 2);
+	result.insert(
+		result.end(),
+		encoded.begin() + stack_delta_header_words,
+		encoded.begin() + stack_delta_header_words + continued
+	);
+
+	// entries are referenced by index, result moves when it grows
+	std::map<stack_delta_key_t, size_t> previous_stacks;
+	size_t position = stack_delta_header_words + continued;
+	while (position < encoded.size()) {
+		const size_t available = encoded.size() - position;
+		if (encoded[position] != stack_delta_marker) {
+			// copied as is, same decisions as in stack_delta_encode
+			const uint64_t entry_length = available < 2 ? 0 : encoded[position + 1];
+			const size_t copied = entry_length < 2 ? available : std::min<size_t>(entry_length, available);
+			result.insert(
+				result.end(),
+				encoded.begin() + position,
+				encoded.begin() + position + copied
+			);
+			position += copied;
+			continue;
+		}
+
+		if (available < header_length + 1)
+			fail("delta coded stack is cut off");
+
+		const uint64_t entry_length = encoded[position + 1];
+		if (entry_length < header_length)
+			fail("delta coded stack is shorter than its header");
+
+		const stack_delta_key_t key { encoded[position + cpu_id_offset], encoded[position + task_id_offset] };
+		const auto found = previous_stacks.find(key);
+		const bool has_previous = found != previous_stacks.end();
+		const size_t previous = has_previous ? found->second : 0;
+		const size_t previous_payload_length = has_previous ? result[previous + 1] - header_length : 0;
+
+		const size_t entry_start = result.size();
+		result.push_back(stack_delta_bte_stack);
+		result.push_back(entry_length);
+		for (size_t offset = 2; offset < header_length; offset++) {
+			if (offset == cpu_id_offset || offset == task_id_offset || !has_previous)
+				result.push_back(encoded[position + offset]);
+			else
+				result.push_back(encoded[position + offset] + result[previous + offset]);
+		}
+
+		const uint64_t shared = encoded[position + header_length];
+		const size_t shared_prefix = shared >> 32;
+		const size_t shared_suffix = shared & 0xffffffff;
+		const size_t payload_length = entry_length - header_length;
+		if (
+			shared_prefix + shared_suffix > payload_length
+			|| shared_prefix + shared_suffix > previous_payload_length
+		)
+			fail("delta coded stack shares more than the previous stack has");
+
+		const size_t new_frames = payload_length - shared_prefix - shared_suffix;
+		position += header_length + 1;
+		if (new_frames > encoded.size() - position)
+			fail("delta coded stack frames are cut off");
+
+		const size_t previous_payload = previous + header_length;
+		for (size_t f = 0; f < shared_prefix; f++)
+			result.push_back(result[previous_payload + f]);
+		result.insert(
+			result.end(),
+			encoded.begin() + position,
+			encoded.begin() + position + new_frames
+		);
+		for (size_t f = previous_payload_length - shared_suffix; f < previous_payload_length; f++)
+			result.push_back(result[previous_payload + f]);
+		position += new_frames;
+
+		previous_stacks[key] = entry_start;
+	}
+
+	return result;
+}
+
+/**
+ * stack interning: in tight loops, the same stack is sampled over and over.
+ * complete BTE_STACK entries are looked up in a table by cpu_id, task_id, start_index and payload,
+ * and counted instead of exported. the other header words (like timer_step) are kept
+ * from the first sample only, tsc_time and tsc_duration as described below.
+ * at the end of the section, each stack that was seen is written once:
+ * 	as the original BTE_STACK entry, if it was seen once and the receiver has no definition,
+ * 	as a BTE_STACK_REF entry (see stack_ref_* in compress.hpp) with the number of samples,
+ * 	    the time of the first and the last one and the sum of their durations,
+ * 	    followed by the first sample as stack definition, if the receiver does not have it yet.
+ * the table slot is the stack_id. a stack whose slot is taken by another one seen in this section
+ * is exported as it is. each time a slot gets a different stack, its generation is counted up.
+ * references carry it, so the receiver can tell if it missed the section with the new definition.
+ * definitions are sent again every stack_intern_resend_interval sections,
+ * so a capture that missed the start can be expanded after a while.
+ * entries that continue into the next section are copied as they are, behind the written stacks.
+ * the result is never longer than the section.
+ */
+static constexpr size_t stack_intern_slots = 1024;
+static constexpr size_t stack_intern_resend_interval = 16;
+
+typedef struct stack_intern_slot_s {
+	// the first sample, also the key
+	std::vector<uint64_t> entry;
+	uint64_t hash = 0;
+	// counted up whenever the slot gets a different stack
+	uint64_t generation = 0;
+	// the receiver has entry as definition of this stack_id
+	bool defined = false;
+
+	// samples in the current section
+	uint64_t count = 0;
+	uint64_t tsc_first = 0;
+	uint64_t tsc_last = 0;
+	uint64_t tsc_duration_sum = 0;
+} stack_intern_slot_t;
+
+typedef struct stack_intern_state_s {
+	// only the layout and the continuation across sections are used
+	stack_delta_state_t stream;
+	std::vector<stack_intern_slot_t> slots { stack_intern_slots };
+	size_t sections = 0;
+} stack_intern_state_t;
+
+static stack_intern_state_t stack_intern_state;
+
+// what makes two samples the same stack: cpu_id, task_id and the payload,
+// with start_index, because the same payload words are another stack if they start elsewhere
+static bool stack_intern_is_key (const stack_delta_state_t & stream, size_t offset) {
+	return (
+		offset < 2
+		|| offset == stream.cpu_id_offset
+		|| offset == stream.task_id_offset
+		|| (stream.start_index_offset && offset == stream.start_index_offset)
+		|| offset >= stream.header_length
+	);
+}
+
+static uint64_t stack_intern_hash (
+	const stack_delta_state_t       & stream,
+	std::span<const uint64_t> const & entry
+) {
+	uint64_t hash = 0xcbf29ce484222325;
+	for (size_t i = 0; i < entry.size(); i++) {
+		if (!stack_intern_is_key(stream, i))
+			continue;
+		hash ^= entry[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static bool stack_intern_equal (
+	const stack_delta_state_t       & stream,
+	std::span<const uint64_t> const & a,
+	std::span<const uint64_t> const & b
+) {
+	if (a.size() != b.size())
+		return false;
+	for (size_t i = 0; i < a.size(); i++)
+		if (stack_intern_is_key(stream, i) && a[i] != b[i])
+			return false;
+	return true;
+}
+
+size_t stack_intern_section (
+	std::span<uint64_t> const section
+) {
+	stack_intern_state_t & state = stack_intern_state;
+	stack_delta_state_t & stream = state.stream;
+
+	if (state.sections++ % stack_intern_resend_interval == 0)
+		for (stack_intern_slot_t & slot : state.slots)
+			slot.defined = false;
+
+	std::vector<uint64_t> interned;
+	interned.reserve(section.size());
+
+	if (stream.continued_length_unknown && section.size()) {
+		stream.continued_words = section[0] ? section[0] - 1 : section.size();
+		stream.continued_length_unknown = false;
+	}
+	const size_t continued = std::min(stream.continued_words, section.size());
+	stream.continued_words -= continued;
+	interned.insert(interned.end(), section.begin(), section.begin() + continued);
+
+	std::vector<size_t> seen_slots;
+	size_t position = continued;
+	size_t unfinished = section.size();
+	while (position < section.size()) {
+		const size_t available = section.size() - position;
+		if (available < 2) {
+			stream.continued_length_unknown = true;
+			unfinished = position;
+			break;
+		}
+		const uint64_t entry_type = section[position];
+		const uint64_t entry_length = section[position + 1];
+		if (entry_length < 2) {
+			// no proper entry, leave the rest alone
+			unfinished = position;
+			break;
+		}
+		if (entry_length > available) {
+			stream.continued_words = entry_length - available;
+			unfinished = position;
+			break;
+		}
+
+		std::span<const uint64_t> const entry { section.data() + position, entry_length };
+		position += entry_length;
+
+		if (entry_type == stack_delta_bte_info)
+			read_stack_layout(stream, entry);
+
+		if (
+			entry_type != stack_delta_bte_stack
+			|| !stream.layout_known
+			|| entry_length < stream.header_length
+			// the receiver puts the times of the samples where BTE_STACK_REF has them
+			|| stream.tsc_time_offset != stack_ref_tsc_time
+			|| stream.tsc_duration_offset != stack_ref_tsc_duration
+			// a reference with definition has to be shorter than two samples
+			|| entry_length <= stack_ref_header_words
+		) {
+			interned.insert(interned.end(), entry.begin(), entry.end());
+			continue;
+		}
+
+		const uint64_t hash = stack_intern_hash(stream, entry);
+		const size_t slot_index = hash % stack_intern_slots;
+		stack_intern_slot_t & slot = state.slots[slot_index];
+		const bool same = slot.hash == hash && stack_intern_equal(stream, slot.entry, entry);
+		if (!same && slot.count) {
+			// the slot is in use by another stack in this section
+			interned.insert(interned.end(), entry.begin(), entry.end());
+			continue;
+		}
+		if (!same) {
+			slot.hash = hash;
+			slot.generation ++;
+			slot.defined = false;
+		}
+		if (!slot.count && !slot.defined) {
+			// will be sent, so it may as well be this section's first sample
+			slot.entry.assign(entry.begin(), entry.end());
+		}
+		if (!slot.count) {
+			seen_slots.push_back(slot_index);
+			slot.tsc_first = entry[stream.tsc_time_offset];
+			slot.tsc_duration_sum = 0;
+		}
+		slot.count ++;
+		slot.tsc_last = entry[stream.tsc_time_offset];
+		slot.tsc_duration_sum += entry[stream.tsc_duration_offset];
+	}
+
+	for (const size_t slot_index : seen_slots) {
+		stack_intern_slot_t & slot = state.slots[slot_index];
+		if (slot.count == 1 && !slot.defined) {
+			// the sample itself is shorter than its reference with definition
+			interned.insert(interned.end(), slot.entry.begin(), slot.entry.end());
+			interned[interned.size() - slot.entry.size() + stream.tsc_time_offset] = slot.tsc_first;
+			interned[interned.size() - slot.entry.size() + stream.tsc_duration_offset] = slot.tsc_duration_sum;
+		} else {
+			const size_t definition_words = slot.defined ? 0 : slot.entry.size();
+			interned.push_back(stack_ref_entry_type);
+			interned.push_back(stack_ref_header_words + definition_words);
+			interned.push_back(slot.tsc_last);
+			interned.push_back(slot.tsc_duration_sum);
+			interned.push_back(slot_index);
+			interned.push_back(slot.count);
+			interned.push_back(slot.tsc_first);
+			interned.push_back(slot.generation);
+			interned.insert(interned.end(), slot.entry.begin(), slot.entry.begin() + definition_words);
+			slot.defined = true;
+		}
+		slot.count = 0;
+	}
+
+	interned.insert(interned.end(), section.begin() + unfinished, section.end());
+	std::copy(interned.begin(), interned.end(), section.begin());
+	return interned.size();
+}
+
+/**
+ * entropy coding of the output of compress: the keys are huffman coded,
+ * the raw words after raw_marker are moved out in front of them, uncoded.
+ * 	uint32_t number of keys, uint32_t number of raw words,
+ * 	code length of each key (4 bit, two per byte, low nibble first, 0 means unused),
+ * 	raw words,
+ * 	canonical huffman codes of the keys, most significant bit first, 0-padded to the last byte.
+ * code lengths are limited to entropy_max_code_length, so the decoder gets by with
+ * a table of 1 << entropy_max_code_length entries.
+ */
+static constexpr unsigned entropy_max_code_length = 12;
+static constexpr size_t entropy_symbols = 256;
+static constexpr size_t entropy_header_bytes = 2 * sizeof(uint32_t) + entropy_symbols / 2;
+
+// huffman code lengths for counts. zero counts get length 0.
+static void entropy_code_lengths (
+	std::span<const uint64_t> const & counts,
+	std::span<uint8_t>        const & lengths
+) {
+	std::vector<uint64_t> limited_counts (counts.begin(), counts.end());
+	while (true) {
+		// nodes 0..entropy_symbols-1 are the leaves, the others are made up while merging
+		std::vector<uint64_t> weight;
+		std::vector<size_t> parent;
+		std::vector<size_t> queue;
+		for (size_t symbol = 0; symbol < entropy_symbols; symbol++) {
+			weight.push_back(limited_counts[symbol]);
+			parent.push_back(0);
+			if (limited_counts[symbol])
+				queue.push_back(symbol);
+		}
+
+		std::fill(lengths.begin(), lengths.end(), 0);
+		if (queue.size() <= 1) {
+			if (queue.size())
+				lengths[queue[0]] = 1;
+			return;
+		}
+
+		auto heavier = [&weight] (size_t a, size_t b) {
+			if (weight[a] != weight[b])
+				return weight[a] > weight[b];
+			return a > b;
+		};
+		std::make_heap(queue.begin(), queue.end(), heavier);
+		while (queue.size() > 1) {
+			std::pop_heap(queue.begin(), queue.end(), heavier);
+			const size_t a = queue.back();
+			queue.pop_back();
+			std::pop_heap(queue.begin(), queue.end(), heavier);
+			const size_t b = queue.back();
+			queue.pop_back();
+
+			const size_t node = weight.size();
+			weight.push_back(weight[a] + weight[b]);
+			parent.push_back(0);
+			parent[a] = parent[b] = node;
+			queue.push_back(node);
+			std::push_heap(queue.begin(), queue.end(), heavier);
+		}
+
+		// the root is the last node made, parents always come after their children
+		std::vector<uint8_t> depth (weight.size(), 0);
+		unsigned max_length = 0;
+		for (size_t node = weight.size() - 1; node-- > 0;) {
+			if (node >= entropy_symbols || limited_counts[node]) {
+				depth[node] = depth[parent[node]] + 1;
+				if (node < entropy_symbols)
+					max_length = std::max<unsigned>(max_length, depth[node]);
+			}
+		}
+		if (max_length <= entropy_max_code_length) {
+			for (size_t symbol = 0; symbol < entropy_symbols; symbol++)
+				lengths[symbol] = limited_counts[symbol] ? depth[symbol] : 0;
+			return;
+		}
+
+		// too deep: flatten the distribution and try again
+		for (auto & count : limited_counts)
+			count = count ? count / 2 + 1 : 0;
+	}
+}
+
+// canonical codes: shorter codes first, same length in symbol order
+static void entropy_canonical_codes (
+	std::span<const uint8_t>  const & lengths,
+	std::span<uint16_t>       const & codes
+) {
+	uint16_t code = 0;
+	for (unsigned length = 1; length <= entropy_max_code_length; length++) {
+		for (size_t symbol = 0; symbol < entropy_symbols; symbol++) {
+			if (lengths[symbol] == length)
+				codes[symbol] = code++;
+		}
+		code <<= 1;
+	}
+}
+
+ssize_t entropy_encode (
+	std::span<uint8_t>       const   coded,
+	std::span<const uint8_t> const & compressed
+) {
+	std::vector<uint64_t> counts (entropy_symbols, 0);
+	uint32_t key_count = 0;
+	uint32_t raw_count = 0;
+	for (size_t c = 0; c < compressed.size(); c++) {
+		counts[compressed[c]] ++;
+		key_count ++;
+		if (compressed[c] == raw_marker) {
+			c += sizeof(uint64_t);
+			raw_count ++;
+		}
+	}
+
+	std::vector<uint8_t> lengths (entropy_symbols, 0);
+	std::vector<uint16_t> codes (entropy_symbols, 0);
+	entropy_code_lengths(counts, lengths);
+	entropy_canonical_codes(lengths, codes);
+
+	uint64_t coded_bits = 0;
+	for (size_t symbol = 0; symbol < entropy_symbols; symbol++)
+		coded_bits += counts[symbol] * lengths[symbol];
+	const size_t coded_bytes = (
+		entropy_header_bytes
+		+ raw_count * sizeof(uint64_t)
+		+ (coded_bits + 7) / 8
+	);
+	if (coded_bytes > coded.size())
+		return -1;
+
+	uint8_t * out = coded.data();
+	memcpy(out, &key_count, sizeof(uint32_t));
+	out += sizeof(uint32_t);
+	memcpy(out, &raw_count, sizeof(uint32_t));
+	out += sizeof(uint32_t);
+	for (size_t symbol = 0; symbol < entropy_symbols; symbol += 2)
+		*out++ = lengths[symbol] | (lengths[symbol + 1] << 4);
+
+	uint8_t * raw_out = out;
+	uint8_t * bits_out = out + raw_count * sizeof(uint64_t);
+	uint64_t bit_buffer = 0;
+	unsigned bits_buffered = 0;
+	for (size_t c = 0; c < compressed.size(); c++) {
+		const uint8_t key = compressed[c];
+		bit_buffer = (bit_buffer << lengths[key]) | codes[key];
+		bits_buffered += lengths[key];
+		while (bits_buffered >= 8) {
+			bits_buffered -= 8;
+			*bits_out++ = static_cast<uint8_t> (bit_buffer >> bits_buffered);
+		}
+
+		if (key == raw_marker) {
+			memcpy(raw_out, &compressed[c + 1], sizeof(uint64_t));
+			raw_out += sizeof(uint64_t);
+			c += sizeof(uint64_t);
+		}
+	}
+	if (bits_buffered)
+		*bits_out++ = static_cast<uint8_t> (bit_buffer << (8 - bits_buffered));
+
+	return bits_out - coded.data();
+}
+
+std::vector<uint8_t> entropy_decode (
+	std::span<const uint8_t> const & coded
+) {
+	auto fail = [] (const char * reason) {
+		printf("entropy coded data is broken: %s\n", reason);
+		exit(1);
+	};
+	if (coded.size() < entropy_header_bytes)
+		fail("too short for header");
+
+	uint32_t key_count;
+	uint32_t raw_count;
+	memcpy(&key_count, &coded[0], sizeof(uint32_t));
+	memcpy(&raw_count, &coded[sizeof(uint32_t)], sizeof(uint32_t));
+	std::vector<uint8_t> lengths (entropy_symbols, 0);
+	for (size_t symbol = 0; symbol < entropy_symbols; symbol += 2) {
+		const uint8_t both = coded[2 * sizeof(uint32_t) + symbol / 2];
+		lengths[symbol]     = both & 0xf;
+		lengths[symbol + 1] = both >> 4;
+	}
+	std::vector<uint16_t> codes (entropy_symbols, 0);
+	entropy_canonical_codes(lengths, codes);
+
+	// every code, padded with all possible following bits, points to its key and length
+	std::vector<uint16_t> table (1 << entropy_max_code_length, 0);
+	for (size_t symbol = 0; symbol < entropy_symbols; symbol++) {
+		if (!lengths[symbol])
+			continue;
+		const unsigned free_bits = entropy_max_code_length - lengths[symbol];
+		const size_t first = static_cast<size_t>(codes[symbol]) << free_bits;
+		for (size_t t = first; t < first + (1 << free_bits); t++)
+			table[t] = static_cast<uint16_t> (symbol | (lengths[symbol] << 8));
+	}
+
+	const size_t raw_offset = entropy_header_bytes;
+	const size_t bits_offset = raw_offset + static_cast<size_t>(raw_count) * sizeof(uint64_t);
+	if (bits_offset > coded.size())
+		fail("raw words overflow the data");
+
+	std::vector<uint8_t> compressed;
+	compressed.reserve(key_count + raw_count * sizeof(uint64_t));
+	const uint8_t * raw_in = &coded[raw_offset];
+	const uint8_t * raw_end = raw_in + raw_count * sizeof(uint64_t);
+	const uint8_t * bits_in = coded.data() + bits_offset;
+	const uint8_t * bits_end = coded.data() + coded.size();
+	uint64_t bit_buffer = 0;
+	unsigned bits_buffered = 0;
+	for (uint32_t k = 0; k < key_count; k++) {
+		while (bits_buffered < entropy_max_code_length) {
+			// past the end, pad with zeroes. the last code can't need them.
+			bit_buffer = (bit_buffer << 8) | (bits_in < bits_end ? *bits_in++ : 0);
+			bits_buffered += 8;
+		}
+		const uint16_t entry = table[
+			(bit_buffer >> (bits_buffered - entropy_max_code_length))
+			& ((1 << entropy_max_code_length) - 1)
+		];
+		const uint8_t key = entry & 0xff;
+		const unsigned length = entry >> 8;
+		if (!length)
+			fail("no key has this code");
+		bits_buffered -= length;
+
+		compressed.push_back(key);
+		if (key == raw_marker) {
+			if (raw_in + sizeof(uint64_t) > raw_end)
+				fail("more raw markers than raw words");
+			compressed.insert(compressed.end(), raw_in, raw_in + sizeof(uint64_t));
+			raw_in += sizeof(uint64_t);
+		}
+	}
+
+	return compressed;
+}
@@ -11,15 +11,71 @@ ssize_t compress_c (
 	size_t   const   c_dictionary_in_words // expected to be 256
 );
 
+// flags in the low bits of compression_header_t::is_compressed, which stages the decoder has to undo.
+// compression_flag_dictionary is 1, so headers written as true / false before there were flags still mean the same.
+static const unsigned long compression_flag_dictionary  = 1 << 0;
+static const unsigned long compression_flag_stack_delta = 1 << 1;
+static const unsigned long compression_flag_dictionary_delta = 1 << 2;
+static const unsigned long compression_flag_entropy = 1 << 3;
+static const unsigned long compression_flags_mask = 0xffff;
+
+// which encoder compress_smart chose for a section, from compression_header_version 1 on.
+// the ids are never reused, the decoder dispatches on them.
+enum section_encoder_e {
+	section_encoder_raw                    = 0,
+	section_encoder_dictionary             = 1,
+	section_encoder_stack_delta            = 2,
+	section_encoder_stack_delta_dictionary = 3,
+	section_encoder_count
+};
+static const unsigned long compression_encoder_shift = 16;
+static const unsigned long compression_encoder_mask  = 0xff;
+// version 0 headers only have the flags
+static const unsigned long compression_version_shift = 56;
+static const unsigned long compression_header_version = 1;
+
 // added infront of data that is compressed (or not)
 typedef struct compression_header_s {
-	// if true, dictionary follows at dictionary_offset after the start of this struct
+	// compression_flag_* | encoder << compression_encoder_shift | version << compression_version_shift,
+	// use the compression_header_get_* functions. 0 means the data is not compressed at all.
+	// with compression_flag_dictionary, dictionary follows at dictionary_offset after the start of this struct
 	//  then the compressed data, which needs a byte-size since its end is not word-aligned
-	// if false, dictionary_length is 0 and uncompressed data starts instead of dictionary
+	// without it, dictionary_length is 0 and the words start instead of dictionary
+	// with compression_flag_stack_delta, the words (after undoing the dictionary) are stack delta coded
+	// with compression_flag_dictionary_delta, the dictionary only has the changes against the previous one
+	// with compression_flag_entropy, the compressed data is huffman coded and has to go through entropy_decode first
 	unsigned long is_compressed;
 	unsigned long dictionary_offset;
 	unsigned long dictionary_length;
 	unsigned long data_length_in_bytes;
 } compression_header_t;
 
+static inline unsigned long compression_header_get_version (const compression_header_t * header) {
+	return header->is_compressed >> compression_version_shift;
+}
+
+static inline unsigned long compression_header_get_flags (const compression_header_t * header) {
+	return header->is_compressed & compression_flags_mask;
+}
+
+static inline unsigned long compression_header_get_encoder (const compression_header_t * header) {
+	if (compression_header_get_version(header) == 0) {
+		// the flags were all there was, and they map onto the first encoders
+		return header->is_compressed & (compression_flag_dictionary | compression_flag_stack_delta);
+	}
+	return (header->is_compressed >> compression_encoder_shift) & compression_encoder_mask;
+}
+
+static inline void compression_header_set (
+	compression_header_t * header,
+	unsigned long encoder,
+	unsigned long flags
+) {
+	header->is_compressed = (
+		(compression_header_version << compression_version_shift)
+		| (encoder << compression_encoder_shift)
+		| flags
+	);
+}
+
 
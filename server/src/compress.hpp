@@ -1,5 +1,7 @@
+#pragma once
 #include <cstdint>
 #include <span>
+#include <vector>
 
 static constexpr size_t dictionary_capacity = 256;
 // returns -1 if compressed is too large, then c_compressed is almost filled
@@ -12,17 +14,77 @@ extern "C" ssize_t compress_c (
 	size_t   const   c_dictionary_in_words // expected to be 256
 );
 
+// flags in the low bits of compression_header_t::is_compressed, which stages the decoder has to undo.
+// compression_flag_dictionary is 1, so headers written as true / false before there were flags still mean the same.
+static constexpr unsigned long compression_flag_dictionary  = 1 << 0;
+static constexpr unsigned long compression_flag_stack_delta = 1 << 1;
+static constexpr unsigned long compression_flag_dictionary_delta = 1 << 2;
+static constexpr unsigned long compression_flag_entropy = 1 << 3;
+static constexpr unsigned long compression_flags_mask = 0xffff;
+
+// which encoder compress_smart chose for a section, from compression_header_version 1 on.
+// the ids are never reused, the decoder dispatches on them.
+enum section_encoder_e {
+	section_encoder_raw                    = 0,
+	section_encoder_dictionary             = 1,
+	section_encoder_stack_delta            = 2,
+	section_encoder_stack_delta_dictionary = 3,
+	section_encoder_count
+};
+static constexpr unsigned long compression_encoder_shift = 16;
+static constexpr unsigned long compression_encoder_mask  = 0xff;
+// version 0 headers only have the flags
+static constexpr unsigned long compression_version_shift = 56;
+static constexpr unsigned long compression_header_version = 1;
+
 // added infront of data that is compressed (or not)
 typedef struct compression_header_s {
-	// if true, dictionary follows at dictionary_offset after the start of this struct
+	// compression_flag_* | encoder << compression_encoder_shift | version << compression_version_shift,
+	// use the compression_header_get_* functions. 0 means the data is not compressed at all.
+	// with compression_flag_dictionary, dictionary follows at dictionary_offset after the start of this struct
 	//  then the compressed data, which needs a byte-size since its end is not word-aligned
-	// if false, dictionary_length is 0 and uncompressed data starts instead of dictionary
+	// without it, dictionary_length is 0 and the words start instead of dictionary
+	// with compression_flag_stack_delta, the words (after undoing the dictionary) are stack delta coded
+	// with compression_flag_dictionary_delta, the dictionary only has the changes against the previous one
+	// with compression_flag_entropy, the compressed data is huffman coded and has to go through entropy_decode first
 	unsigned long is_compressed;
 	unsigned long dictionary_offset;
 	unsigned long dictionary_length;
 	unsigned long data_length_in_bytes;
 } compression_header_t;
 
+static inline unsigned long compression_header_get_version (const compression_header_t * header) {
+	return header->is_compressed >> compression_version_shift;
+}
+
+static inline unsigned long compression_header_get_flags (const compression_header_t * header) {
+	return header->is_compressed & compression_flags_mask;
+}
+
+static inline unsigned long compression_header_get_encoder (const compression_header_t * header) {
+	if (compression_header_get_version(header) == 0) {
+		// the flags were all there was, and they map onto the first encoders
+		return header->is_compressed & (compression_flag_dictionary | compression_flag_stack_delta);
+	}
+	return (header->is_compressed >> compression_encoder_shift) & compression_encoder_mask;
+}
+
+static inline void compression_header_set (
+	compression_header_t * header,
+	unsigned long encoder,
+	unsigned long flags
+) {
+	header->is_compressed = (
+		(compression_header_version << compression_version_shift)
+		| (encoder << compression_encoder_shift)
+		| flags
+	);
+}
+
+const char * section_encoder_name (unsigned long encoder);
+
+// chooses an encoder for the section, see section_encoders in compress.cpp.
+// returns -1 if the raw data behind compression_header_1 should be printed instead.
 ssize_t compress_smart (
 	uint64_t       * c_dictionary_and_compressed,
 	size_t   const   c_dictionary_and_compressed_in_words,
@@ -31,6 +93,22 @@ ssize_t compress_smart (
 	compression_header_t * compression_header_1
 );
 
+uint64_t dictionary_checksum (std::span<const uint64_t> const & dictionary);
+
+// evolved is previous with the words of fresh in it, delta is what has to be sent for that.
+void make_dictionary_delta (
+	std::span<const uint64_t> const & previous,
+	std::span<const uint64_t> const & fresh,
+	std::vector<uint64_t>           & evolved,
+	std::vector<uint64_t>           & delta
+);
+
+// returns false if delta was not made against dictionary (a section is missing), or is broken
+bool apply_dictionary_delta (
+	std::vector<uint64_t>           & dictionary,
+	std::span<const uint64_t> const & delta
+);
+
 size_t create_dictionary (
 	std::span<      uint64_t> const & dictionary,
 	std::span<const uint64_t> const & raw_data
@@ -46,3 +124,50 @@ std::vector<uint64_t> decompress (
 	std::span<const uint8_t>  const & compressed,
 	std::span<const uint64_t> const & dictionary
 );
+
+// stack delta coding of whole sections, applied before the dictionary coder.
+// stack_delta_encode must see all sections in buffer order, it learns the layout of
+// stack entries from the BTE_INFO entry and follows entries across section boundaries.
+// returns false if encoded is not used (layout unknown yet or no words saved).
+bool stack_delta_encode (
+	std::vector<uint64_t>           & encoded,
+	std::span<const uint64_t> const & raw_data
+);
+
+std::vector<uint64_t> stack_delta_decode (
+	std::span<const uint64_t> const & encoded
+);
+
+// BTE_STACK_REF, written by stack_intern_section instead of repeated BTE_STACK entries.
+// tsc_time and tsc_duration are where they are in all entries, so the offsets also work on BTE_STACK.
+// stacks are only interned if the BTE_INFO entry puts them there, too.
+// the entry type continues the ones in external/src/EntryDescriptor.hpp, the kernel does not describe it.
+static constexpr uint64_t stack_ref_entry_type = 1 << 5;
+enum stack_ref_offsets_e {
+	// entry_type and entry_length as usual
+	stack_ref_tsc_time     = 2, // of the last sample
+	stack_ref_tsc_duration = 3, // sum over all samples
+	stack_ref_stack_id     = 4,
+	stack_ref_count        = 5,
+	stack_ref_tsc_first    = 6, // tsc_time of the first sample
+	stack_ref_generation   = 7, // of stack_id, the definition has to be from the same one
+	// if the entry is longer, the BTE_STACK entry of the first sample follows as new definition of stack_id
+	stack_ref_header_words = 8,
+};
+
+// replaces repeated BTE_STACK entries in section by BTE_STACK_REF entries,
+// returns the new length of section. must see all sections in buffer order, like stack_delta_encode.
+size_t stack_intern_section (
+	std::span<uint64_t> const section
+);
+
+// huffman codes the keys of the output of compress, returns -1 if coded is too small.
+ssize_t entropy_encode (
+	std::span<uint8_t>       const   coded,
+	std::span<const uint8_t> const & compressed
+);
+
+// returns what entropy_encode got, the input for decompress
+std::vector<uint8_t> entropy_decode (
+	std::span<const uint8_t> const & coded
+);
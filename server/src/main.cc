@@ -19,6 +19,67 @@
 
 #include "btb_export.h"
 
+// with export_continuously: what the last drain left behind
+typedef struct drain_state_s {
+	l4_uint64_t us_last_drain;
+	// get_btb_words_no_entry() right after the last drain
+	l4_uint64_t btb_words_at_last_drain;
+	// words the kernel still had after the last drain (less than a full section)
+	l4_uint64_t words_waiting_at_last_drain;
+
+	unsigned long drains;
+	l4_uint64_t words_drained;
+} drain_state_t;
+
+static drain_state_t drain_state;
+
+static void drain_start () {
+	drain_state.us_last_drain = l4_tsc_to_us(l4_rdtsc());
+	drain_state.btb_words_at_last_drain = get_btb_words_no_entry();
+	drain_state.words_waiting_at_last_drain = 0;
+}
+
+static void drain_now () {
+	unsigned long remaining_words = 0;
+	drain_state.words_drained += drain_backtrace_buffer_sections(dbg_cap, true, &remaining_words);
+	drain_state.drains ++;
+
+	drain_state.us_last_drain = l4_tsc_to_us(l4_rdtsc());
+	drain_state.btb_words_at_last_drain = get_btb_words_no_entry();
+	drain_state.words_waiting_at_last_drain = remaining_words;
+}
+
+// like l4_usleep, but with export_continuously, full sections are exported in the meantime:
+// every us_drain_interval, or sooner when the kernel buffer fills up to drain_high_watermark_in_words.
+static void sleep_or_drain (l4_uint64_t us_sleeptime) {
+	if (!export_continuously) {
+		l4_usleep(us_sleeptime);
+		return;
+	}
+
+	l4_uint64_t us_now  = l4_tsc_to_us(l4_rdtsc());
+	l4_uint64_t us_wake = us_now + us_sleeptime;
+	while (us_now < us_wake) {
+		l4_uint64_t words_waiting = (
+			get_btb_words_no_entry()
+			- drain_state.btb_words_at_last_drain
+			+ drain_state.words_waiting_at_last_drain
+		);
+		if (
+			us_now - drain_state.us_last_drain >= us_drain_interval
+			|| words_waiting >= drain_high_watermark_in_words
+		) {
+			if (ubt_debug)
+				printf("draining about %lld waiting words while tracing\n", words_waiting);
+			drain_now();
+		} else {
+			l4_uint64_t us_left = us_wake - us_now;
+			l4_usleep(us_left < us_drain_poll ? us_left : us_drain_poll);
+		}
+		us_now = l4_tsc_to_us(l4_rdtsc());
+	}
+}
+
 static l4_uint64_t others_control_tracing () {
 	l4_uint64_t us_start = l4_tsc_to_us(l4_rdtsc());
 
@@ -34,10 +95,11 @@ static l4_uint64_t others_control_tracing () {
 		l4_usleep(us_sleeptime);
 	}
 
+	drain_start();
 	while (backtracing_is_running()) {
 		if (ubt_debug)
 			printf("backtracing is still running, wait...\n");
-		l4_usleep(us_sleeptime);
+		sleep_or_drain(us_sleeptime);
 	}
 
 	return us_start;
@@ -48,11 +110,26 @@ static l4_uint64_t we_control_tracing () {
 	l4_uint64_t us_start = measure_start(us_sleep_before_tracing, us_trace_intervals[0]);
 
 	// how long to let tracing happen before stopping and exporting.
-	usleep(us_backtracer_waits_for_app);
+	drain_start();
+	sleep_or_drain(us_backtracer_waits_for_app);
 
 	return us_start;
 }
 
+static void print_export_statistics (const export_statistics_t * statistics, l4_uint64_t us_export) {
+	// without the pipeline, fetching and printing would have happened one after the other
+	l4_uint64_t us_sequential = statistics->us_fetching + statistics->us_printing;
+	printf(
+		"export pipeline: %ld sections, fetch+compress %16.3f s, print %16.3f s\n"
+		"export pipeline: wall time %16.3f s, saved %16.3f s against single buffer\n",
+		statistics->sections,
+		(double) statistics->us_fetching / 1000000.0,
+		(double) statistics->us_printing / 1000000.0,
+		(double) us_export / 1000000.0,
+		((double) us_sequential - (double) us_export) / 1000000.0
+	);
+}
+
 static void try_to_shutdown () {
 	l4_cap_idx_t pfc_cap = l4re_env_get_cap("pfc");
 	bool is_valid = l4_is_valid_cap(pfc_cap) > 0;
@@ -82,8 +159,15 @@ int main(void) {
 
 	l4_uint64_t us_export_start = l4_tsc_to_us(l4_rdtsc());
 
+	export_statistics_t export_statistics;
+	bool exported_pipelined = (
+		export_pipelined
+		&& export_backtrace_buffer_pipelined(dbg_cap, false, true, &export_statistics, NULL, NULL)
+	);
+
+	// single buffer: fetch, compress and print one section after the other
 	unsigned long remaining_words = 1;
-	while (do_export && remaining_words) {
+	while (do_export && !exported_pipelined && remaining_words) {
 		remaining_words = export_backtrace_buffer_section(
 			dbg_cap, false, true
 		);
@@ -93,6 +177,12 @@ int main(void) {
 
 	measure_print("backtracer", us_init, us_start, us_stop);
 	measure_print("bt-export", us_init, us_export_start, us_export_stop);
+	if (exported_pipelined)
+		print_export_statistics(&export_statistics, us_export_stop - us_export_start);
+	if (export_continuously) printf(
+		"continuous export: %ld drains while tracing, %lld words\n",
+		drain_state.drains, drain_state.words_drained
+	);
 
 	try_to_shutdown();
 